@@ -0,0 +1,338 @@
+/* End-to-end benchmark of hcubature/pcubature on the test integrands.
+ *
+ * Copyright (c) 2005-2013 Steven G. Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Usage: ./cubature_bench [options]
+
+   Sweeps over every combination of the given dimensions, tolerances,
+   integrand dimensions (fdim), test integrands (see testfuncs.h), and
+   engines, and prints one record per combination:
+
+     -d 1,2,3      dimensions
+     -t 1e-3,1e-5  relative tolerances
+     -F 1          fdim values (each component is the same integrand)
+     -i 0,1,...,8  integrands (8 is only run for dim == 3)
+     -e h,hv,p,pv  engines: hcubature, hcubature_v, pcubature, pcubature_v
+     -r 5          repetitions of each run (for the timing statistics)
+     -m 1000000    maximum # function evaluations per run (0 for none)
+     -f json       output format: json or csv
+     -o file       output file (default: stdout)
+
+   Each record contains the return status, the integral and error
+   estimate of the first component, the true error, the number of
+   integrand points and calls, the number of regions (hcubature only,
+   deduced from the number of points per region), the minimum and median
+   wall-clock time over the repetitions, evaluations per second (based
+   on the median time), and the peak resident set size in kB.  For the
+   vectorized engines (which are called via the _ex interfaces), it also
+   contains the cubature_stats of the last repetition: the termination
+   reason, the number of refinement steps, the peak number of regions
+   (or pcubature cache blocks) and bytes, and the time spent in the
+   integrand.  If the library was compiled with -DCUBATURE_PROFILE, the
+   JSON records also contain the phase_cycles and (hardware) counters. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "cubature.h"
+#include "testfuncs.h"
+#include "benchutil.h"
+
+typedef struct {
+     int which; /* test integrand */
+     size_t npts; /* total # points evaluated */
+     size_t ncalls; /* total # integrand calls */
+} bench_data;
+
+static int f_scalar(unsigned dim, const double *x, void *d_,
+		    unsigned fdim, double *fval)
+{
+     bench_data *d = (bench_data *) d_;
+     double val = test_integrand(d->which, dim, x);
+     unsigned k;
+     for (k = 0; k < fdim; ++k) fval[k] = val;
+     d->npts += 1;
+     d->ncalls += 1;
+     return 0;
+}
+
+static int f_vector(unsigned dim, size_t npt, const double *x, void *d_,
+		    unsigned fdim, double *fval)
+{
+     bench_data *d = (bench_data *) d_;
+     size_t j;
+     unsigned k;
+     for (j = 0; j < npt; ++j) {
+	  double val = test_integrand(d->which, dim, x + j*dim);
+	  for (k = 0; k < fdim; ++k) fval[j*fdim + k] = val;
+     }
+     d->npts += npt;
+     d->ncalls += 1;
+     return 0;
+}
+
+#define NUM_ENGINES 4
+static const char *engine_names[NUM_ENGINES] = { "h", "hv", "p", "pv" };
+
+/* run the given engine, storing the statistics in *stats (for the
+   vectorized engines only) */
+static int run(int engine, bench_data *d, unsigned fdim, unsigned dim,
+	       const double *xmin, const double *xmax, size_t maxEval,
+	       double tol, double *val, double *err, cubature_stats *stats)
+{
+     cubature_options opt;
+     memset(&opt, 0, sizeof(opt));
+     opt.stats = stats;
+     switch (engine) {
+	 case 0: return hcubature(fdim, f_scalar, d, dim, xmin, xmax,
+				  maxEval, 0, tol, ERROR_INDIVIDUAL, val, err);
+	 case 1: return hcubature_ex(fdim, f_vector, d, dim, xmin, xmax,
+				     maxEval, 0, tol, ERROR_INDIVIDUAL, &opt,
+				     val, err);
+	 case 2: return pcubature(fdim, f_scalar, d, dim, xmin, xmax,
+				  maxEval, 0, tol, ERROR_INDIVIDUAL, val, err);
+	 default: return pcubature_ex(fdim, f_vector, d, dim, xmin, xmax,
+				      maxEval, 0, tol, ERROR_INDIVIDUAL, &opt,
+				      val, err);
+     }
+}
+
+/* # points per region of the default hcubature rules */
+static size_t hcubature_rule_points(unsigned dim)
+{
+     if (dim == 1) return 15; /* Gauss-Kronrod */
+     return 1 + 4*dim + 2*dim*(dim-1) + ((size_t) 1 << dim); /* Genz-Malik */
+}
+
+/* parse a comma-separated list of numbers into a new array, returning
+   the number of elements (exits on a parse error) */
+static size_t parse_list(const char *s, double **a)
+{
+     size_t n = 1, i;
+     const char *p;
+     char *end;
+     for (p = s; *p; ++p) if (*p == ',') ++n;
+     *a = (double *) malloc(sizeof(double) * n);
+     if (!*a) { fprintf(stderr, "out of memory\n"); exit(EXIT_FAILURE); }
+     for (i = 0, p = s; i < n; ++i) {
+	  (*a)[i] = strtod(p, &end);
+	  if (end == p || (*end && *end != ',')) {
+	       fprintf(stderr, "invalid list \"%s\"\n", s);
+	       exit(EXIT_FAILURE);
+	  }
+	  p = end + (*end == ',');
+     }
+     return n;
+}
+
+static int parse_engine(const char *s)
+{
+     int e;
+     for (e = 0; e < NUM_ENGINES; ++e)
+	  if (!strcmp(s, engine_names[e])) return e;
+     fprintf(stderr, "unknown engine \"%s\"\n", s);
+     exit(EXIT_FAILURE);
+     return -1;
+}
+
+static void usage(const char *prog)
+{
+     fprintf(stderr, "Usage: %s [-d dims] [-t tols] [-F fdims] "
+	     "[-i integrands] [-e engines] [-r reps] [-m maxeval] "
+	     "[-f json|csv] [-o file]\n", prog);
+     exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+     double *dims = NULL, *tols = NULL, *fdims = NULL, *whichs = NULL;
+     size_t ndims = 0, ntols = 0, nfdims = 0, nwhichs = 0;
+     int engines[NUM_ENGINES], nengines = 0;
+     unsigned reps = 5;
+     size_t maxEval = 1000000;
+     int csv = 0, first = 1;
+     FILE *out = stdout;
+     size_t id, it, iF, iw;
+     int ie, i;
+
+     for (i = 1; i < argc; ++i) {
+	  const char *arg = argv[i];
+	  if (arg[0] != '-' || !arg[1] || arg[2] || i + 1 >= argc)
+	       usage(argv[0]);
+	  ++i;
+	  switch (arg[1]) {
+	      case 'd': free(dims); ndims = parse_list(argv[i], &dims); break;
+	      case 't': free(tols); ntols = parse_list(argv[i], &tols); break;
+	      case 'F': free(fdims); nfdims = parse_list(argv[i], &fdims); break;
+	      case 'i': free(whichs); nwhichs = parse_list(argv[i], &whichs);
+		   break;
+	      case 'e': {
+		   char *s = argv[i], *tok;
+		   nengines = 0;
+		   for (tok = strtok(s, ","); tok && nengines < NUM_ENGINES;
+			tok = strtok(NULL, ","))
+			engines[nengines++] = parse_engine(tok);
+		   break;
+	      }
+	      case 'r': reps = (unsigned) atoi(argv[i]); break;
+	      case 'm': maxEval = (size_t) atof(argv[i]); break;
+	      case 'f':
+		   if (!strcmp(argv[i], "csv")) csv = 1;
+		   else if (!strcmp(argv[i], "json")) csv = 0;
+		   else usage(argv[0]);
+		   break;
+	      case 'o':
+		   if (!(out = fopen(argv[i], "w"))) {
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		   }
+		   break;
+	      default: usage(argv[0]);
+	  }
+     }
+     if (!ndims) ndims = parse_list("1,2,3", &dims);
+     if (!ntols) ntols = parse_list("1e-3,1e-5", &tols);
+     if (!nfdims) nfdims = parse_list("1", &fdims);
+     if (!nwhichs) nwhichs = parse_list("0,1,2,3,4,5,6,7,8", &whichs);
+     if (!nengines)
+	  for (ie = 0; ie < NUM_ENGINES; ++ie) engines[nengines++] = ie;
+     if (reps < 1) reps = 1;
+
+     if (csv)
+	  fprintf(out, "engine,integrand,dim,fdim,tol,status,val,err,"
+		  "true_err,evals,calls,regions,time_min,time_median,"
+		  "evals_per_sec,peak_rss_kb,reason,steps,peak_regions,"
+		  "peak_bytes,time_integrand\n");
+     else
+	  fprintf(out, "[\n");
+
+     for (id = 0; id < ndims; ++id)
+     for (it = 0; it < ntols; ++it)
+     for (iF = 0; iF < nfdims; ++iF)
+     for (iw = 0; iw < nwhichs; ++iw)
+     for (ie = 0; ie < nengines; ++ie) {
+	  unsigned dim = (unsigned) dims[id], fdim = (unsigned) fdims[iF];
+	  int which = (int) whichs[iw], engine = engines[ie];
+	  double tol = tols[it];
+	  double *xmin, *xmax, *val, *err, *times;
+	  double tmin, tmed, true_err;
+	  long rss;
+	  int status = 0;
+	  unsigned k, rep;
+	  bench_data d;
+	  long regions;
+	  cubature_stats stats;
+	  int has_stats = engine == 1 || engine == 3;
+
+	  if (which < 0 || which >= TEST_NUM_INTEGRANDS
+	      || dim < 1 || fdim < 1) {
+	       fprintf(stderr, "invalid integrand, dim, or fdim\n");
+	       return EXIT_FAILURE;
+	  }
+	  if (which == 8 && dim != 3) continue; /* only defined for dim 3 */
+
+	  xmin = (double *) malloc(sizeof(double) * (2*dim + 2*fdim + reps));
+	  if (!xmin) { fprintf(stderr, "out of memory\n"); return EXIT_FAILURE; }
+	  xmax = xmin + dim;
+	  val = xmax + dim;
+	  err = val + fdim;
+	  times = err + fdim;
+	  for (k = 0; k < dim; ++k) { xmin[k] = 0; xmax[k] = 1; }
+
+	  bench_reset_peak_rss();
+	  for (rep = 0; rep < reps; ++rep) {
+	       double t0;
+	       d.which = which; d.npts = d.ncalls = 0;
+	       t0 = bench_time();
+	       status = run(engine, &d, fdim, dim, xmin, xmax, maxEval, tol,
+			    val, err, &stats);
+	       times[rep] = bench_time() - t0;
+	  }
+	  rss = bench_peak_rss_kb();
+	  tmed = bench_median(times, reps);
+	  tmin = times[0]; /* sorted by bench_median */
+	  true_err = fabs(val[0] - exact_integral(which, dim, xmax));
+	  regions = engine < 2 ? (long) (d.npts / hcubature_rule_points(dim))
+	       : -1; /* not applicable to pcubature */
+
+	  if (csv) {
+	       fprintf(out, "%s,%d,%u,%u,%g,%d,%.15g,%g,%g,"
+		       "%lu,%lu,%ld,%g,%g,%g,%ld",
+		       engine_names[engine], which, dim, fdim, tol, status,
+		       val[0], err[0], true_err,
+		       (unsigned long) d.npts, (unsigned long) d.ncalls,
+		       regions, tmin, tmed,
+		       tmed > 0 ? d.npts / tmed : 0.0, rss);
+	       if (has_stats)
+		    fprintf(out, ",%d,%lu,%lu,%lu,%g\n", (int) stats.reason,
+			    (unsigned long) stats.numSteps,
+			    (unsigned long) stats.peak_regions,
+			    (unsigned long) stats.peak_bytes,
+			    stats.time_integrand);
+	       else
+		    fprintf(out, ",,,,,\n");
+	  }
+	  else {
+	       fprintf(out, "%s  {\"engine\": \"%s\", \"integrand\": %d, "
+		       "\"dim\": %u, \"fdim\": %u, \"tol\": %g, "
+		       "\"status\": %d, \"val\": %.15g, \"err\": %g, "
+		       "\"true_err\": %g, \"evals\": %lu, \"calls\": %lu, ",
+		       first ? "" : ",\n",
+		       engine_names[engine], which, dim, fdim, tol, status,
+		       val[0], err[0], true_err,
+		       (unsigned long) d.npts, (unsigned long) d.ncalls);
+	       if (regions >= 0)
+		    fprintf(out, "\"regions\": %ld, ", regions);
+	       else
+		    fprintf(out, "\"regions\": null, ");
+	       fprintf(out, "\"time_min\": %g, \"time_median\": %g, "
+		       "\"evals_per_sec\": %g, \"peak_rss_kb\": %ld",
+		       tmin, tmed, tmed > 0 ? d.npts / tmed : 0.0, rss);
+	       if (has_stats)
+		    fprintf(out, ", \"reason\": %d, \"steps\": %lu, "
+			    "\"peak_regions\": %lu, \"peak_bytes\": %lu, "
+			    "\"time_integrand\": %g", (int) stats.reason,
+			    (unsigned long) stats.numSteps,
+			    (unsigned long) stats.peak_regions,
+			    (unsigned long) stats.peak_bytes,
+			    stats.time_integrand);
+	       if (has_stats && stats.phase_cycles[CUBATURE_PHASE_INTEGRAND] > 0) {
+		    fprintf(out, ", \"phase_cycles\": [");
+		    for (k = 0; k < CUBATURE_NPHASES; ++k)
+			 fprintf(out, "%s%g", k ? ", " : "",
+				 stats.phase_cycles[k]);
+		    fprintf(out, "], \"counters\": [");
+		    for (k = 0; k < CUBATURE_NCOUNTERS; ++k)
+			 fprintf(out, "%s%g", k ? ", " : "", stats.counters[k]);
+		    fprintf(out, "]");
+	       }
+	       fprintf(out, "}");
+	  }
+	  first = 0;
+	  fflush(out);
+	  free(xmin);
+     }
+     if (!csv) fprintf(out, "\n]\n");
+
+     if (out != stdout) fclose(out);
+     free(whichs); free(fdims); free(tols); free(dims);
+     return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+/* Timing and memory-usage utilities for the benchmark programs. */
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#  define _POSIX_C_SOURCE 200112L /* for clock_gettime */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/time.h>
+#  include <sys/resource.h>
+#endif
+
+#include "benchutil.h"
+
+double bench_time(void)
+{
+#if defined(_WIN32)
+     LARGE_INTEGER t, f;
+     QueryPerformanceCounter(&t);
+     QueryPerformanceFrequency(&f);
+     return (double) t.QuadPart / (double) f.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return t.tv_sec + 1e-9 * t.tv_nsec;
+#else
+     struct timeval t;
+     gettimeofday(&t, NULL);
+     return t.tv_sec + 1e-6 * t.tv_usec;
+#endif
+}
+
+long bench_peak_rss_kb(void)
+{
+#if defined(_WIN32)
+     PROCESS_MEMORY_COUNTERS pmc;
+     if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+	  return (long) (pmc.PeakWorkingSetSize / 1024);
+     return 0;
+#else
+     struct rusage ru;
+     FILE *f = fopen("/proc/self/status", "r");
+     if (f) { /* Linux: VmHWM is resettable, unlike ru_maxrss */
+	  char line[256];
+	  long kb = 0;
+	  while (fgets(line, sizeof(line), f))
+	       if (!strncmp(line, "VmHWM:", 6)) {
+		    kb = atol(line + 6);
+		    break;
+	       }
+	  fclose(f);
+	  if (kb > 0) return kb;
+     }
+     if (getrusage(RUSAGE_SELF, &ru)) return 0;
+#  if defined(__APPLE__)
+     return ru.ru_maxrss / 1024; /* bytes on MacOS */
+#  else
+     return ru.ru_maxrss;
+#  endif
+#endif
+}
+
+int bench_reset_peak_rss(void)
+{
+#if defined(_WIN32)
+     return 0;
+#else
+     FILE *f = fopen("/proc/self/clear_refs", "w");
+     int ok;
+     if (!f) return 0;
+     ok = fputs("5", f) >= 0;
+     return (fclose(f) == 0) && ok;
+#endif
+}
+
+static int cmp_double(const void *a_, const void *b_)
+{
+     double a = *(const double *) a_, b = *(const double *) b_;
+     return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+double bench_median(double *t, size_t n)
+{
+     if (n == 0) return 0;
+     qsort(t, n, sizeof(double), cmp_double);
+     return n % 2 ? t[n/2] : 0.5 * (t[n/2 - 1] + t[n/2]);
+}
+
+void bench_measure(bench_kernel k, void *data,
+		   unsigned nsamples, double mintime, bench_stats *s)
+{
+     double *t, t0, dt;
+     size_t n = 1;
+     unsigned i;
+
+     if (nsamples < 1) nsamples = 1;
+     for (;;) { /* calibrate n (the first call also warms up the caches) */
+	  t0 = bench_time();
+	  k(data, n);
+	  dt = bench_time() - t0;
+	  if (dt >= mintime || n >= ((size_t) -1) / 4) break;
+	  n *= dt > 0 && mintime / dt < 64 ? 2 : 16;
+     }
+     s->n = n;
+     t = (double *) malloc(sizeof(double) * nsamples * 2);
+     if (!t) { /* just use the calibration run */
+	  s->min = s->median = dt / n;
+	  s->spread = 0;
+	  return;
+     }
+     for (i = 0; i < nsamples; ++i) {
+	  t0 = bench_time();
+	  k(data, n);
+	  t[i] = (bench_time() - t0) / n;
+     }
+     s->median = bench_median(t, nsamples);
+     s->min = t[0];
+     for (i = 0; i < nsamples; ++i)
+	  t[nsamples + i] = fabs(t[i] - s->median);
+     s->spread = s->median > 0 ?
+	  bench_median(t + nsamples, nsamples) / s->median : 0;
+     free(t);
+}
@@ -0,0 +1,37 @@
+/* Timing and memory-usage utilities for the benchmark programs. */
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <stdlib.h> /* for size_t */
+
+/* wall-clock time in seconds, from an arbitrary (monotonic) origin */
+double bench_time(void);
+
+/* peak resident set size of the process in kilobytes (0 if unknown) */
+long bench_peak_rss_kb(void);
+
+/* reset the peak resident set size to the current size, if supported
+   (Linux >= 4.0), so that bench_peak_rss_kb measures only what follows;
+   returns 0 if unsupported */
+int bench_reset_peak_rss(void);
+
+/* sort the n values in t and return their median */
+double bench_median(double *t, size_t n);
+
+/* a kernel to benchmark: performs n repetitions of some operation */
+typedef void (*bench_kernel)(void *data, size_t n);
+
+typedef struct {
+     size_t n; /* repetitions per sample */
+     double min, median; /* time per repetition, in seconds */
+     double spread; /* median absolute deviation / median */
+} bench_stats;
+
+/* time kernel k: n is first doubled until one call k(data, n) takes at
+   least mintime seconds, and then the time per repetition is sampled
+   nsamples times */
+void bench_measure(bench_kernel k, void *data,
+		   unsigned nsamples, double mintime, bench_stats *s);
+
+#endif /* BENCHUTIL_H */
@@ -0,0 +1,35 @@
+/* Runtime CPU dispatch of the inner kernels (point generation, the
+   cubature-rule reductions, pcubature's weight contraction, and the
+   norms in converged.h), which are marked CUBATURE_KERNEL.
+
+   With GCC on x86-64 GNU/Linux (glibc), each kernel is compiled into an
+   AVX-512, an AVX2 and a baseline (SSE2) variant with the target_clones
+   attribute, and the dynamic loader picks the best variant for the CPU
+   (from CPUID) once, when the library is loaded, via an ifunc.  So a
+   library compiled without any -march flags still uses the wider
+   vector units where they exist.  Elsewhere, or if CUBATURE_NO_DISPATCH
+   is defined, CUBATURE_KERNEL expands to nothing and the kernels are
+   compiled once for the target chosen by the compiler flags.
+
+   All of the variants compute bitwise-identical results as long as the
+   compiler does not contract a*b+c into fused multiply-adds (which the
+   AVX-512 variant could otherwise use), as is the case with -ansi/-std=c89;
+   the CMake build passes -ffp-contract=off for this.  (The including file
+   must include a standard header such as stdlib.h first, which defines
+   __GLIBC__.)
+
+   A helper that a kernel calls in its inner loops is marked
+   CUBATURE_KERNEL_INLINE, which forces it to be inlined into each
+   variant of the kernel (otherwise it is compiled once, for the
+   baseline ISA, and the AVX variants just call it). */
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 \
+     && defined(__x86_64__) && defined(__ELF__) && defined(__GLIBC__) \
+     && !defined(CUBATURE_NO_DISPATCH)
+#  define CUBATURE_KERNEL \
+     __attribute__((target_clones("avx512f", "avx2", "default")))
+#  define CUBATURE_KERNEL_INLINE __inline__ __attribute__((always_inline))
+#else
+#  define CUBATURE_KERNEL
+#  define CUBATURE_KERNEL_INLINE
+#endif
@@ -30,6 +30,7 @@
 #define CUBATURE_H
 
 #include <stdlib.h> /* for size_t */
+#include <stdio.h> /* for FILE */
 
 #ifdef __cplusplus
 extern "C"
@@ -56,6 +57,26 @@ typedef int (*integrand_v) (unsigned ndim, size_t npt,
 			    const double *x, void *,
 			    unsigned fdim, double *fval);
 
+/* a "masked" vectorized integrand (for hcubature_vm/pcubature_vm), which
+   only needs to compute the components k with active[k] != 0 (an array
+   of length fdim); the values fval[i*fdim + k] of the other components
+   are ignored. */
+typedef int (*integrand_vm) (unsigned ndim, size_t npt,
+			     const double *x, void *,
+			     unsigned fdim, const char *active,
+			     double *fval);
+
+/* a vectorized integrand for hcubature_executor (see below), evaluating
+   the npt points x of nseg integrations at once: the points (and
+   values) of the j-th integration are the next npts[j] points after
+   those of the integrations 0..j-1, and fdata[j] is the fdata of that
+   integration */
+typedef int (*integrand_vs) (unsigned ndim, size_t npt,
+			     const double *x,
+			     unsigned nseg, const size_t *npts,
+			     void *const *fdata,
+			     unsigned fdim, double *fval);
+
 /* Different ways of measuring the absolute and relative error when
    we have multiple integrands, given a vector e of error estimates
    in the individual components of a vector v of integrands.  These
@@ -69,7 +90,245 @@ typedef enum {
      ERROR_LINF /* abserr is L_\infty norm |e|, and relerr is |e|/|v| */
 } error_norm;
 
-/* Integrate the function f from xmin[dim] to xmax[dim], with at most
+/* Families of nested 1d quadrature rules whose tensor products are
+   used by pcubature.  Gauss-Patterson rules need roughly half as many
+   points as Clenshaw-Curtis rules of the same polynomial degree, and do
+   not evaluate the integrand on the boundaries, but only exist up to
+   511 points per dimension. */
+typedef enum {
+     PCUBATURE_CLENSHAW_CURTIS = 0, /* 2^(m+1)+1 points for degree m */
+     PCUBATURE_GAUSS_PATTERSON /* 2^(m+2)-1 points for degree m <= 7 */
+} pcubature_rule;
+
+/* Gauss-Kronrod rules used by hcubature for one-dimensional integrals:
+   a Kronrod rule of 2n+1 points, with the error estimated from the
+   embedded n-point Gauss rule.  Higher-order rules need fewer subdivisions
+   for smooth integrands, but more points per subdivision. */
+typedef enum {
+     HCUBATURE_GK15 = 0, /* 7-point Gauss, 15-point Kronrod */
+     HCUBATURE_GK21, /* 10-point Gauss, 21-point Kronrod */
+     HCUBATURE_GK31, /* 15-point Gauss, 31-point Kronrod */
+     HCUBATURE_GK61 /* 30-point Gauss, 61-point Kronrod */
+} hcubature_rule1d;
+
+/* File formats of the refinement trace of hcubature (see the trace
+   field of cubature_options, and the README) */
+typedef enum {
+     CUBATURE_TRACE_CSV = 0, /* one line of comma-separated text per record */
+     CUBATURE_TRACE_BINARY /* a type byte + native-endian doubles per record */
+} cubature_trace_format;
+
+/* Reasons for the termination of an integration (see cubature_stats) */
+typedef enum {
+     CUBATURE_CONVERGED = 0, /* the requested tolerance was achieved */
+     CUBATURE_MAXEVAL, /* maxEval function evaluations were exceeded */
+     CUBATURE_MAXDEGREE, /* pcubature: a rule cannot be refined further */
+     CUBATURE_ERROR, /* integrand error, out of memory, or invalid arguments */
+     CUBATURE_STOPPED, /* the progress callback requested a stop */
+     CUBATURE_MAXTIME /* the maxTime deadline was reached */
+} cubature_reason;
+
+/* Return value of the extended (_ex) interfaces if the maxTime deadline
+   (see cubature_options) was reached before convergence; val and err
+   then hold the estimates so far.  (Other nonzero values are errors.) */
+#define CUBATURE_TIMEOUT 2
+
+#define CUBATURE_STATS_NBATCH 32 /* length of batch_hist */
+#define CUBATURE_STATS_MAXDIM 20 /* length of m */
+
+/* Phases of an integration, for cubature_stats.phase_cycles */
+typedef enum {
+     CUBATURE_PHASE_POINTS = 0, /* generating the cubature points */
+     CUBATURE_PHASE_INTEGRAND, /* evaluating the integrand */
+     CUBATURE_PHASE_RULE, /* summing the rules and estimating the errors */
+     CUBATURE_PHASE_HEAP, /* managing the regions (hcubature heap) or
+			     the cached grids (pcubature) */
+     CUBATURE_PHASE_CONVERGED, /* convergence checks (and extrapolation) */
+     CUBATURE_NPHASES
+} cubature_phase;
+
+/* Hardware counters, for cubature_stats.counters */
+typedef enum {
+     CUBATURE_COUNTER_CYCLES = 0,
+     CUBATURE_COUNTER_INSTRUCTIONS,
+     CUBATURE_COUNTER_CACHE_MISSES,
+     CUBATURE_COUNTER_BRANCH_MISSES,
+     CUBATURE_NCOUNTERS
+} cubature_counter;
+
+/* Statistics of an integration, returned by the extended (_ex) interfaces
+   if the stats field of cubature_options is non-NULL. */
+typedef struct {
+     cubature_reason reason; /* why the integration stopped */
+     size_t numEval; /* # points at which the integrand was evaluated */
+     size_t numCalls; /* # calls to the (vectorized) integrand */
+     /* batch_hist[k] = # integrand calls with 2^k <= npt < 2^(k+1)
+	points (the last bin also counts all larger calls) */
+     size_t batch_hist[CUBATURE_STATS_NBATCH];
+     size_t max_batch; /* the largest # points in a single call */
+     /* # refinement steps: the batches of regions that were bisected
+	(hcubature) or the refinements of the grid (pcubature) */
+     size_t numSteps;
+     /* peak # of regions (hcubature) or of cached blocks of grid
+	points (pcubature) */
+     size_t peak_regions;
+     size_t peak_bytes; /* peak memory for regions/points/values */
+     unsigned m[CUBATURE_STATS_MAXDIM]; /* pcubature: final degree in each
+					  dimension (see pcubature_v_buf) */
+     double time_total; /* total wall-clock time (seconds) */
+     double time_integrand; /* wall-clock time in the integrand (seconds) */
+     /* Only if the library was compiled with -DCUBATURE_PROFILE (else 0):
+	the time spent in each phase, in ticks of the processor's cycle
+	counter (the time-stamp counter on x86), where available, or
+	else in nanoseconds. */
+     double phase_cycles[CUBATURE_NPHASES];
+     /* Only if the library was compiled with -DCUBATURE_PROFILE on Linux
+	and the kernel permits it (else -1): hardware counters (user
+	space only) over the whole integration, from perf_event_open. */
+     double counters[CUBATURE_NCOUNTERS];
+} cubature_stats;
+
+/* A progress callback for the extended (_ex) interfaces (see
+   cubature_options), called once per iteration of the adaptive
+   algorithm (after each new batch of integrand evaluations) with the
+   current estimates val[fdim] and err[fdim] of the
+   integral and its error, the number of integrand evaluations so far,
+   and the current number of regions (hcubature) or of cached blocks of
+   grid points (pcubature).  The void* parameter is the progress_data
+   field of cubature_options.  Return 0 to continue, or nonzero to stop
+   the integration early: the routine then returns 0 (success) with the
+   current estimates in val and err, and the CUBATURE_STOPPED reason.
+   With nthreads > 1 (see cubature_options), it is called by the worker
+   threads, one at a time, so it must be thread-safe; it is called
+   under a lock that every worker takes to merge its running totals,
+   so it blocks all of the workers while it runs. */
+typedef int (*cubature_progress) (void *, unsigned fdim,
+				  const double *val, const double *err,
+				  size_t numEval, size_t nregions);
+
+/* Optional parameters for the extended (_ex) interfaces below.  Every
+   field defaults to zero, so a zero-initialized struct (or passing a
+   NULL pointer) gives the same behavior as the plain routines. */
+typedef struct {
+     /* pcubature: in each step, refine not only the dimension with the
+	largest error estimate but every dimension whose error estimate
+	is >= refine_frac times the largest one, and evaluate all of the
+	new points as a single batch.  0 refines one dimension per step. */
+     double refine_frac;
+     /* pcubature: if refine_frac > 0, limit the number of new points in
+	one step to refine_overshoot times the number of points needed
+	to refine the worst dimension alone (0 for no limit) */
+     double refine_overshoot;
+     /* pcubature: family of 1d rules */
+     pcubature_rule rule;
+     /* hcubature: rule for 1d integrals (ignored for dim > 1) */
+     hcubature_rule1d rule1d;
+     /* hcubature: if nonzero, accelerate the convergence of 1d integrals
+	by Wynn's epsilon algorithm applied to the sequence of estimates
+	obtained by successively bisecting the smallest subintervals, as
+	in QUADPACK's QAGS.  This can reduce the number of evaluations
+	by orders of magnitude for (integrable) endpoint singularities.
+	(Ignored for dim > 1.) */
+     int extrapolate;
+     /* hcubature: breakpoints, e.g. the known locations of kinks,
+	discontinuities or peaks of the integrand.  If nbreak is non-NULL,
+	the domain is initially partitioned at the nbreak[i] points
+	breakpoints[i][0..nbreak[i]-1] along each dimension i (points not
+	strictly inside the domain are ignored), and all of the resulting
+	boxes are evaluated as the first batch.  (The routine fails if
+	there could be too many boxes to allocate.) */
+     const unsigned *nbreak;
+     const double *const *breakpoints;
+     /* hcubature: if nboxes > 0, integrate over the union of nboxes
+	non-overlapping boxes inside [xmin, xmax] instead of over all of
+	[xmin, xmax], where the k-th box is boxes[2*dim*k + i] <= x[i] <=
+	boxes[2*dim*k + dim + i].  The boxes are further partitioned by
+	any breakpoints.  (xmin and xmax are still used to determine the
+	change of variables for infinite limits, if any.) */
+     size_t nboxes;
+     const double *boxes;
+     /* if non-NULL, *stats is filled with statistics of the integration
+	(at the cost of timing each call of the integrand) */
+     cubature_stats *stats;
+     /* if non-NULL, called once per iteration with progress_data (see
+	cubature_progress), and can stop the integration early */
+     cubature_progress progress;
+     void *progress_data;
+     /* if > 0, a wall-clock time limit in seconds, checked between
+	batches of integrand evaluations: when it is reached, the routine
+	returns CUBATURE_TIMEOUT with the estimates so far.  Near the
+	deadline, batches of regions (hcubature_v) and refinements
+	(pcubature with refine_frac > 0) are shrunk according to the
+	measured time per evaluation, to avoid overshooting it, and
+	pcubature returns early if even the smallest refinement would
+	overshoot it. */
+     double maxTime;
+     /* Limits on the number of points per call of the vectorized
+	integrand (0 for none).  hcubature_v pads each batch of regions
+	with the next-worst regions (beyond what is needed to reach the
+	tolerance) to at least min_batch points, and evaluates batches
+	of more than max_batch points (which can occur late in the
+	integration, making the buffer of points very large) in chunks
+	that reuse a buffer of at most max_batch points (but at least one
+	region).  pcubature uses max_batch (default 2^20) for the size of
+	its buffer, and ignores min_batch. */
+     size_t min_batch, max_batch;
+     /* hcubature: if nonzero, store the estimates of each region (other
+	than those being evaluated) in single precision, halving the
+	memory per region for large fdim.  The rounding errors of the
+	values are added to the error estimates, so this is only useful
+	for relative tolerances well above FLT_EPSILON (about 1e-7); the
+	running totals are still accumulated in double precision. */
+     int compact;
+     /* hcubature_ex: if > 1, the number of threads that refine the
+	regions concurrently after the initial batch, each bisecting one
+	region (two regions of points per integrand call) at a time.  The
+	integrand must then be thread-safe, and the results are not
+	reproducible from run to run.  The progress callback, if any,
+	is then called by the workers, so it must be thread-safe too, and
+	it blocks all of the workers while it runs.  Ignored with extrapolate, by
+	hcubature_vm, and on Windows. */
+     unsigned nthreads;
+     /* hcubature_ex, pcubature_ex: if > 1, the number of worker
+	processes, forked at the start of the integration, among which
+	each batch of points is split (via shared memory), for using
+	several cores with integrands that are not thread-safe.  Side
+	effects of the integrand are not seen by the calling process.
+	Batches of more than max_batch points (default 65536) are
+	evaluated in several rounds.  Ignored on Windows. */
+     unsigned nprocs;
+     /* hcubature: if nonzero, the results are bitwise identical for any
+	nthreads, nprocs and max_batch (min_batch still changes which
+	regions are refined): nthreads > 1 threads then only share the
+	integrand evaluations of each batch of regions, instead of
+	refining regions independently, and the final sums over the
+	regions are computed exactly and rounded correctly, so that they
+	do not depend on the order of the regions.  (The results of
+	pcubature never depend on these options.) */
+     int deterministic;
+     /* hcubature: if non-NULL, a trace of the refinement is written to
+	this stream (which should be opened in binary mode for
+	CUBATURE_TRACE_BINARY), in the format trace_format: the initial
+	regions, every bisection of a region (the parent box, the split
+	dimension, and the error estimate of each component before and
+	after), and every batch of regions, e.g. for the cubature_tracesum
+	program.  The records are collected in a buffer of fixed size,
+	which is written out whenever it fills up; if a write fails, the
+	rest of the trace is dropped, but the integration continues. */
+     FILE *trace;
+     cubature_trace_format trace_format;
+     /* pcubature: the highest degree m of the rule in any dimension
+	(2^(m+1)+1 Clenshaw-Curtis points), beyond which the integration
+	stops with a nonzero return value and the CUBATURE_MAXDEGREE
+	reason, since the number of points (and the memory for their
+	cached values) doubles with each degree.  0 for the default, 19;
+	at most 29. */
+     unsigned maxm;
+} cubature_options;
+
+/* Integrate the function f from xmin[dim] to xmax[dim] (which may be
+   +/- HUGE_VAL for infinite limits, in which case a change of variables
+   is performed internally), with at most
    maxEval function evaluations (0 for no limit), until the given
    absolute or relative error is achieved.  val returns the integral,
    and err returns the estimate for the absolute error in val; both
@@ -93,6 +352,25 @@ int hcubature_v(unsigned fdim, integrand_v f, void *fdata,
 		error_norm norm,
 		double *val, double *err);
 
+/* as hcubature_v, but with the optional parameters in *opt (which may
+   be NULL for the defaults) */
+int hcubature_ex(unsigned fdim, integrand_v f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err);
+/* as hcubature_ex, but with a masked integrand: with ERROR_INDIVIDUAL,
+   each component of the integrand is retired as soon as its own error
+   estimate satisfies the tolerance, i.e. its estimate is frozen, and it
+   is no longer computed (for other norms, all components are always
+   active).  This saves work if the components converge at very
+   different rates. */
+int hcubature_vm(unsigned fdim, integrand_vm f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err);
+
 /* adaptive integration by increasing the degree of (tensor-product
    Clenshaw-Curtis) quadrature rules ("p-adaptive"), rather than
    subdividing the domain ("h-adaptive").  Possibly better for
@@ -110,12 +388,122 @@ int pcubature_v(unsigned fdim, integrand_v f, void *fdata,
 		size_t maxEval, double reqAbsError, double reqRelError, 
 		error_norm norm,
 		double *val, double *err);
+/* as pcubature_v, but with the optional parameters in *opt (which may
+   be NULL for the defaults) */
+int pcubature_ex(unsigned fdim, integrand_v f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err);
+/* as pcubature_ex, but with a masked integrand, as in hcubature_vm */
+int pcubature_vm(unsigned fdim, integrand_vm f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err);
 int pcubature(unsigned fdim, integrand f, void *fdata,
 	      unsigned dim, const double *xmin, const double *xmax, 
 	      size_t maxEval, double reqAbsError, double reqRelError, 
 	      error_norm norm,
 	      double *val, double *err);
 
+/* Reverse-communication ("caller-driven") versions of hcubature_ex and
+   pcubature_ex: instead of calling an integrand function, the
+   integration returns each batch of points to the caller, who can
+   evaluate the integrand however it likes (e.g. asynchronously, or
+   while interleaving several integrations) and then submits the
+   values.  For example:
+
+     hcubature_rc *rc = hcubature_rc_begin(fdim, dim, xmin, xmax, maxEval,
+                                           reqAbsError, reqRelError,
+                                           norm, opt);
+     const double *x;
+     size_t npt;
+     if (!rc) ...out of memory...
+     while (hcubature_rc_next(rc, &x, &npt)) {
+          ...compute fval[i*fdim + j] at the points x + i*dim...
+          hcubature_rc_submit(rc, fval);
+     }
+     status = hcubature_rc_end(rc, val, err);
+
+   The arguments of _begin are as for the _ex functions, and *opt (which
+   may be NULL) is copied, but opt->stats (if any) is filled in and must
+   remain valid until _end.  _next returns 1 if the integrand values at
+   the npt points x are needed (x remains valid until they are
+   submitted, and _next returns the same batch again if they were not),
+   or 0 if the integration is done.  _submit returns nonzero if there is
+   no pending batch.  _end frees the state and returns what the _ex
+   function would have returned; calling it before _next returns 0
+   aborts the integration (as if the integrand had returned an error).
+   Each state may only be used by one thread at a time. */
+typedef struct hcubature_rc_s hcubature_rc;
+hcubature_rc *hcubature_rc_begin(unsigned fdim, unsigned dim,
+				 const double *xmin, const double *xmax,
+				 size_t maxEval,
+				 double reqAbsError, double reqRelError,
+				 error_norm norm, const cubature_options *opt);
+int hcubature_rc_next(hcubature_rc *rc, const double **x, size_t *npt);
+int hcubature_rc_submit(hcubature_rc *rc, const double *fval);
+int hcubature_rc_end(hcubature_rc *rc, double *val, double *err);
+
+typedef struct pcubature_rc_s pcubature_rc;
+pcubature_rc *pcubature_rc_begin(unsigned fdim, unsigned dim,
+				 const double *xmin, const double *xmax,
+				 size_t maxEval,
+				 double reqAbsError, double reqRelError,
+				 error_norm norm, const cubature_options *opt);
+int pcubature_rc_next(pcubature_rc *rc, const double **x, size_t *npt);
+int pcubature_rc_submit(pcubature_rc *rc, const double *fval);
+int pcubature_rc_end(pcubature_rc *rc, double *val, double *err);
+
+/* A context for repeated pcubature_ex integrations of the same
+   integrand over the same domain (e.g. with successively smaller
+   tolerances): the integrand values on the nested grids are kept
+   between calls, so that each call only evaluates the integrand at the
+   points of the finer grids that it needs, if any.  Without maxEval
+   and maxTime, each call gives bitwise the same results as the
+   corresponding pcubature_ex call, so a call with a looser tolerance
+   than an earlier one needs no new evaluations at all.  The options
+   *opt (which may be NULL) are copied and apply to every call (with
+   stats, if any, describing each call separately, and maxEval counting
+   only the new evaluations of each call).  If the integrand returns an
+   error, the cached values are discarded.  pcubature_ctx_new returns
+   NULL if it runs out of memory or dim is too large. */
+typedef struct pcubature_ctx_s pcubature_ctx;
+pcubature_ctx *pcubature_ctx_new(unsigned fdim, integrand_v f, void *fdata,
+				 unsigned dim,
+				 const double *xmin, const double *xmax,
+				 const cubature_options *opt);
+int pcubature_ctx_integrate(pcubature_ctx *ctx, size_t maxEval,
+			    double reqAbsError, double reqRelError,
+			    error_norm norm, double *val, double *err);
+void pcubature_ctx_destroy(pcubature_ctx *ctx);
+
+/* A shared executor for hcubature integrations of the same fdim and
+   dim running concurrently on different threads, which merges the
+   batches of points of all of the integrations into combined calls of
+   a single vectorized integrand f (see integrand_vs), so that f sees
+   large batches even if each integration only needs a few points at a
+   time.  Each hcubature_executor_integrate call is an hcubature_ex
+   integration (ignoring opt->nthreads and opt->nprocs) with the given
+   fdata.  A combined call is made (by one of the waiting threads, so
+   that f is never called by two threads at once) as soon as all of the
+   running integrations are waiting for it, or as soon as the waiting
+   batches add up to at least min_batch points (if min_batch > 0).
+   hcubature_executor_new returns NULL if it runs out of memory (or on
+   Windows, where this is not supported), and hcubature_executor_destroy
+   must not be called while any integration is running. */
+typedef struct hcubature_executor_s hcubature_executor;
+hcubature_executor *hcubature_executor_new(unsigned fdim, integrand_vs f,
+					   unsigned dim, size_t min_batch);
+int hcubature_executor_integrate(hcubature_executor *e, void *fdata,
+				 const double *xmin, const double *xmax,
+				 size_t maxEval,
+				 double reqAbsError, double reqRelError,
+				 error_norm norm, const cubature_options *opt,
+				 double *val, double *err);
+void hcubature_executor_destroy(hcubature_executor *e);
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif /* __cplusplus */
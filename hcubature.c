@@ -26,6 +26,13 @@
  *
  */
 
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#  define _POSIX_C_SOURCE 200112L /* for clock_gettime in statswrapper.h */
+#endif
+#if defined(CUBATURE_PROFILE) && defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE /* for syscall in profile.h */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -109,6 +116,9 @@
 #define SUCCESS 0
 #define FAILURE 1
 
+#include "cpudispatch.h"
+#include "statswrapper.h"
+
 /***************************************************************************/
 /* Basic datatypes */
 
@@ -116,12 +126,15 @@ typedef struct {
      double val, err;
 } esterr;
 
-static double errMax(unsigned fdim, const esterr *ee)
+/* the maximum error of the components k with active[k] != 0 (or of all
+   components if active is NULL) */
+static double errMax(unsigned fdim, const esterr *ee, const char *active)
 {
      double errmax = 0;
      unsigned k;
      for (k = 0; k < fdim; ++k)
-	  if (ee[k].err > errmax) errmax = ee[k].err;
+	  if (ee[k].err > errmax && (!active || active[k]))
+	       errmax = ee[k].err;
      return errmax;
 }
 
@@ -181,8 +194,10 @@ typedef struct {
      hypercube h;
      unsigned splitDim;
      unsigned fdim; /* dimensionality of vector integrand */
-     esterr *ee; /* array of length fdim */
+     esterr *ee; /* array of length fdim (NULL if compacted) */
+     float *cee; /* compacted ee: fdim (val, err) pairs, or NULL */
      double errmax; /* max ee[k].err */
+     unsigned level; /* number of bisections that produced this region */
 } region;
 
 static region make_region(const hypercube *h, unsigned fdim)
@@ -192,7 +207,9 @@ static region make_region(const hypercube *h, unsigned fdim)
      R.splitDim = 0;
      R.fdim = fdim;
      R.ee = R.h.data ? (esterr *) malloc(sizeof(esterr) * fdim) : NULL;
+     R.cee = NULL;
      R.errmax = HUGE_VAL;
+     R.level = 0;
      return R;
 }
 
@@ -201,11 +218,14 @@ static void destroy_region(region *R)
      destroy_hypercube(&R->h);
      free(R->ee);
      R->ee = 0;
+     free(R->cee);
+     R->cee = 0;
 }
 
 static int cut_region(region *R, region *R2)
 {
      unsigned d = R->splitDim, dim = R->h.dim;
+     ++R->level;
      *R2 = *R;
      R->h.data[d + dim] *= 0.5;
      R->h.vol *= 0.5;
@@ -217,11 +237,81 @@ static int cut_region(region *R, region *R2)
      return R2->ee == NULL;
 }
 
+/* Compact storage of the estimates of the regions in the heap (see
+   cubature_options.compact): region_compact replaces R->ee by floats
+   in R->cee, rounding each val to nearest and adding its rounding error
+   to err, which is rounded up, so that the errors remain bounds (a
+   nonzero err below the normal range of float, where multiplying by
+   1 + FLT_EPSILON does not round it up, becomes FLT_MIN).  (R
+   stays uncompacted if out of memory, or if its estimates are beyond
+   the range of float.)  region_expand converts back, exactly. */
+static void region_compact(region *R)
+{
+     unsigned k, fdim = R->fdim;
+     float *cee;
+     for (k = 0; k < fdim; ++k)
+	  if (fabs(R->ee[k].val) > FLT_MAX || R->ee[k].err > 0.5 * FLT_MAX)
+	       return;
+     cee = (float *) malloc(sizeof(float) * 2 * fdim);
+     if (!cee) return;
+     for (k = 0; k < fdim; ++k) {
+	  float v = (float) R->ee[k].val;
+	  double e = R->ee[k].err + fabs(R->ee[k].val - v);
+	  float ef = (float) e;
+	  if (e > 0 && e < FLT_MIN)
+	       ef = FLT_MIN;
+	  else if (ef < e)
+	       ef = (float) (e * (1 + FLT_EPSILON));
+	  cee[2*k] = v;
+	  cee[2*k+1] = ef;
+     }
+     free(R->ee);
+     R->ee = NULL;
+     R->cee = cee;
+}
+
+static int region_expand(region *R)
+{
+     unsigned k, fdim = R->fdim;
+     if (!R->cee) return SUCCESS;
+     R->ee = (esterr *) malloc(sizeof(esterr) * fdim);
+     if (!R->ee) return FAILURE;
+     for (k = 0; k < fdim; ++k) {
+	  R->ee[k].val = R->cee[2*k];
+	  R->ee[k].err = R->cee[2*k+1];
+     }
+     free(R->cee);
+     R->cee = NULL;
+     return SUCCESS;
+}
+
+#define REGION_VAL(R, k) ((R)->ee ? (R)->ee[k].val : (double) (R)->cee[2*(k)])
+#define REGION_ERR(R, k) ((R)->ee ? (R)->ee[k].err : (double) (R)->cee[2*(k)+1])
+
+/* errMax for a region that may be compacted */
+static double region_errmax(const region *R, const char *active)
+{
+     double errmax = 0;
+     unsigned k;
+     if (R->ee) return errMax(R->fdim, R->ee, active);
+     for (k = 0; k < R->fdim; ++k)
+	  if (R->cee[2*k+1] > errmax && (!active || active[k]))
+	       errmax = R->cee[2*k+1];
+     return errmax;
+}
+
 struct rule_s; /* forward declaration */
 
-typedef int (*evalError_func)(struct rule_s *r,
-			      unsigned fdim, integrand_v f, void *fdata,
-			      unsigned nR, region *R);
+/* A rule is evaluated on nR regions R in two steps (so that the caller
+   can evaluate the integrand in between, see hcubature_rc_next):
+   evalPoints stores the num_points points of each region in r->pts,
+   and, once the integrand values at these points are in r->vals,
+   evalValues computes the integral and error estimates of each region
+   (and chooses the dimension to split), only for the components j with
+   active[j] != 0 if active is non-NULL. */
+typedef int (*evalPoints_func)(struct rule_s *r, unsigned nR, region *R);
+typedef void (*evalValues_func)(struct rule_s *r, unsigned fdim,
+				const char *active, unsigned nR, region *R);
 typedef void (*destroy_func)(struct rule_s *r);
 
 
@@ -229,9 +319,11 @@ typedef struct rule_s {
      unsigned dim, fdim;         /* the dimensionality & number of functions */
      unsigned num_points;       /* number of evaluation points */
      unsigned num_regions; /* max number of regions evaluated at once */
+     unsigned max_regions; /* limit on num_regions (0 for none) */
      double *pts; /* points to eval: num_regions * num_points * dim */
      double *vals; /* num_regions * num_points * fdim */
-     evalError_func evalError;
+     evalPoints_func evalPoints;
+     evalValues_func evalValues;
      destroy_func destroy;
 } rule;
 
@@ -254,6 +346,8 @@ static int alloc_rule_pts(rule *r, unsigned num_regions)
 			       repeatedly calling alloc_rule_pts with
 			       growing num_regions only needs
 			       a logarithmic number of allocations */
+	  if (r->max_regions && num_regions > r->max_regions)
+	       num_regions = r->max_regions;
 	  r->pts = (double *) malloc(sizeof(double) *
 				     (num_regions
 				      * r->num_points * (r->dim + r->fdim)));
@@ -266,7 +360,8 @@ static int alloc_rule_pts(rule *r, unsigned num_regions)
 
 static rule *make_rule(size_t sz, /* >= sizeof(rule) */
 		       unsigned dim, unsigned fdim, unsigned num_points,
-		       evalError_func evalError, destroy_func destroy)
+		       evalPoints_func evalPoints, evalValues_func evalValues,
+		       destroy_func destroy)
 {
      rule *r;
 
@@ -274,25 +369,15 @@ static rule *make_rule(size_t sz, /* >= sizeof(rule) */
      r = (rule *) malloc(sz);
      if (!r) return NULL;
      r->pts = r->vals = NULL;
-     r->num_regions = 0;
+     r->num_regions = r->max_regions = 0;
      r->dim = dim; r->fdim = fdim; r->num_points = num_points;
-     r->evalError = evalError;
+     r->evalPoints = evalPoints;
+     r->evalValues = evalValues;
      r->destroy = destroy;
      return r;
 }
 
 /* note: all regions must have same fdim */
-static int eval_regions(unsigned nR, region *R,
-			integrand_v f, void *fdata, rule *r)
-{
-     unsigned iR;
-     if (nR == 0) return SUCCESS; /* nothing to evaluate */
-     if (r->evalError(r, R->fdim, f, fdata, nR, R)) return FAILURE;
-     for (iR = 0; iR < nR; ++iR)
-	  R[iR].errmax = errMax(R->fdim, R[iR].ee);
-     return SUCCESS;
-}
-
 /***************************************************************************/
 /* Functions to loop over points in a hypercube. */
 
@@ -340,6 +425,7 @@ static unsigned ls0(unsigned n)
  *  A Gray-code ordering is used to minimize the number of coordinate updates
  *  in p, although this doesn't matter as much now that we are saving all pts.
  */
+CUBATURE_KERNEL
 static void evalR_Rfs(double *pts, unsigned dim, double *p, const double *c, const double *r)
 {
      unsigned i;
@@ -367,6 +453,7 @@ static void evalR_Rfs(double *pts, unsigned dim, double *p, const double *c, con
      }
 }
 
+CUBATURE_KERNEL
 static void evalRR0_0fs(double *pts, unsigned dim, double *p, const double *c, const double *r)
 {
      unsigned i, j;
@@ -389,6 +476,7 @@ static void evalRR0_0fs(double *pts, unsigned dim, double *p, const double *c, c
      }
 }
 
+CUBATURE_KERNEL
 static void evalR0_0fs4d(double *pts, unsigned dim, double *p, const double *c,
 			 const double *r1, const double *r2)
 {
@@ -454,25 +542,24 @@ static void destroy_rule75genzmalik(rule *r_)
      free(r->p);
 }
 
-static int rule75genzmalik_evalError(rule *r_, unsigned fdim, integrand_v f, void *fdata, unsigned nR, region *R)
+/* lambda2 = sqrt(9/70), lambda4 = sqrt(9/10), lambda5 = sqrt(9/19) */
+#define GM_LAMBDA2 0.3585685828003180919906451539079374954541
+#define GM_LAMBDA4 0.9486832980505137995996680633298155601160
+#define GM_LAMBDA5 0.6882472016116852977216287342936235251269
+
+static int rule75genzmalik_evalPoints(rule *r_, unsigned nR, region *R)
 {
-     /* lambda2 = sqrt(9/70), lambda4 = sqrt(9/10), lambda5 = sqrt(9/19) */
-     const double lambda2 = 0.3585685828003180919906451539079374954541;
-     const double lambda4 = 0.9486832980505137995996680633298155601160;
-     const double lambda5 = 0.6882472016116852977216287342936235251269;
-     const double weight2 = 980. / 6561.;
-     const double weight4 = 200. / 19683.;
-     const double weightE2 = 245. / 486.;
-     const double weightE4 = 25. / 729.;
-     const double ratio = (lambda2 * lambda2) / (lambda4 * lambda4);
+     const double lambda2 = GM_LAMBDA2;
+     const double lambda4 = GM_LAMBDA4;
+     const double lambda5 = GM_LAMBDA5;
 
      rule75genzmalik *r = (rule75genzmalik *) r_;
-     unsigned i, j, iR, dim = r_->dim;
+     unsigned i, iR, dim = r_->dim;
      size_t npts = 0;
-     double *diff, *pts, *vals;
+     double *pts;
 
      if (alloc_rule_pts(r_, nR)) return FAILURE;
-     pts = r_->pts; vals = r_->vals;
+     pts = r_->pts;
 
      for (iR = 0; iR < nR; ++iR) {
 	  const double *center = R[iR].h.data;
@@ -503,9 +590,23 @@ static int rule75genzmalik_evalError(rule *r_, unsigned fdim, integrand_v f, voi
 	  npts += numR_Rfs(dim);
      }
 
-     /* Evaluate the integrand function(s) at all the points */
-     if (f(dim, npts, pts, fdata, fdim, vals))
-	  return FAILURE;
+     return SUCCESS;
+}
+
+CUBATURE_KERNEL
+static void rule75genzmalik_evalValues(rule *r_, unsigned fdim,
+				       const char *active,
+				       unsigned nR, region *R)
+{
+     const double weight2 = 980. / 6561.;
+     const double weight4 = 200. / 19683.;
+     const double weightE2 = 245. / 486.;
+     const double weightE4 = 25. / 729.;
+     const double ratio = (GM_LAMBDA2 * GM_LAMBDA2) / (GM_LAMBDA4 * GM_LAMBDA4);
+
+     rule75genzmalik *r = (rule75genzmalik *) r_;
+     unsigned i, j, iR, dim = r_->dim;
+     double *diff, *pts = r_->pts, *vals = r_->vals;
 
      /* we are done with the points, and so we can re-use the pts
 	array to store the maximum difference diff[i] in each dimension
@@ -516,6 +617,7 @@ static int rule75genzmalik_evalError(rule *r_, unsigned fdim, integrand_v f, voi
      for (j = 0; j < fdim; ++j) {
 	  const double *v = vals + j;
 #         define VALS(i) v[fdim*(i)]
+	  if (active && !active[j]) continue;
 	  for (iR = 0; iR < nR; ++iR) {
 	       double result, res5th;
 	       double val0, sum2=0, sum3=0, sum4=0, sum5=0;
@@ -568,7 +670,8 @@ static int rule75genzmalik_evalError(rule *r_, unsigned fdim, integrand_v f, voi
 	  unsigned dimDiffMax = 0;
 
 	  for (j = 0; j < fdim; ++j)
-		df += R[iR].ee[j].err;
+	       if (!active || active[j])
+		    df += R[iR].ee[j].err;
 	  df /= R[iR].h.vol * r->df_scale;
 
 	  for (i = 0; i < dim; ++i) {
@@ -582,7 +685,6 @@ static int rule75genzmalik_evalError(rule *r_, unsigned fdim, integrand_v f, voi
 	  }
 	  R[iR].splitDim = dimDiffMax;
      }
-     return SUCCESS;
 }
 
 static rule *make_rule75genzmalik(unsigned dim, unsigned fdim)
@@ -602,7 +704,8 @@ static rule *make_rule75genzmalik(unsigned dim, unsigned fdim)
 				       dim, fdim,
 				       num0_0(dim) + 2 * numR0_0fs(dim)
 				       + numRR0_0fs(dim) + numR_Rfs(dim),
-				       rule75genzmalik_evalError,
+				       rule75genzmalik_evalPoints,
+				       rule75genzmalik_evalValues,
 				       destroy_rule75genzmalik);
      if (!r) return NULL;
 
@@ -625,51 +728,240 @@ static rule *make_rule75genzmalik(unsigned dim, unsigned fdim)
 }
 
 /***************************************************************************/
-/* 1d 15-point Gaussian quadrature rule, based on qk15.c and qk.c in
-   GNU GSL (which in turn is based on QUADPACK). */
-
-static int rule15gauss_evalError(rule *r,
-				 unsigned fdim, integrand_v f, void *fdata,
-				 unsigned nR, region *R)
-{
-     /* Gauss quadrature weights and kronrod quadrature abscissae and
-	weights as evaluated with 80 decimal digit arithmetic by
-	L. W. Fullerton, Bell Labs, Nov. 1981. */
-     const unsigned n = 8;
-     const double xgk[8] = {  /* abscissae of the 15-point kronrod rule */
-	  0.991455371120812639206854697526329,
-	  0.949107912342758524526189684047851,
-	  0.864864423359769072789712788640926,
-	  0.741531185599394439863864773280788,
-	  0.586087235467691130294144838258730,
-	  0.405845151377397166906606412076961,
-	  0.207784955007898467600689403773245,
-	  0.000000000000000000000000000000000
-	  /* xgk[1], xgk[3], ... abscissae of the 7-point gauss rule.
-	     xgk[0], xgk[2], ... to optimally extend the 7-point gauss rule */
-     };
-     static const double wg[4] = {  /* weights of the 7-point gauss rule */
-	  0.129484966168869693270611432679082,
-	  0.279705391489276667901467771423780,
-	  0.381830050505118944950369775488975,
-	  0.417959183673469387755102040816327
-     };
-     static const double wgk[8] = { /* weights of the 15-point kronrod rule */
-	  0.022935322010529224963732008058970,
-	  0.063092092629978553290700663189204,
-	  0.104790010322250183839876322541518,
-	  0.140653259715525918745189590510238,
-	  0.169004726639267902826583426598550,
-	  0.190350578064785409913256402421014,
-	  0.204432940075298892414161999234649,
-	  0.209482141084727828012999174891714
-     };
-     unsigned j, k, iR;
+/* 1d Gauss-Kronrod quadrature rules (G7-K15, G10-K21, G15-K31, and
+   G30-K61), based on qk15.c, qk21.c, qk31.c, qk61.c and qk.c in GNU GSL
+   (which in turn is based on QUADPACK).
+
+   Gauss quadrature weights and kronrod quadrature abscissae and
+   weights as evaluated with 80 decimal digit arithmetic (the 15-point
+   values are those of L. W. Fullerton, Bell Labs, Nov. 1981). */
+
+static const double xgk15[8] = { /* abscissae of the 15-point kronrod rule */
+     0.991455371120812639206854697526329,
+     0.949107912342758524526189684047851,
+     0.864864423359769072789712788640926,
+     0.741531185599394439863864773280788,
+     0.586087235467691130294144838258730,
+     0.405845151377397166906606412076961,
+     0.207784955007898467600689403773245,
+     0.000000000000000000000000000000000
+     /* xgk15[1], xgk15[3], ... abscissae of the 7-point gauss rule.
+        xgk15[0], xgk15[2], ... to optimally extend the 7-point gauss rule */
+};
+static const double wg15[4] = { /* weights of the 7-point gauss rule */
+     0.129484966168869693270611432679082,
+     0.279705391489276667901467771423780,
+     0.381830050505118944950369775488975,
+     0.417959183673469387755102040816327
+};
+static const double wgk15[8] = { /* weights of the 15-point kronrod rule */
+     0.022935322010529224963732008058970,
+     0.063092092629978553290700663189204,
+     0.104790010322250183839876322541518,
+     0.140653259715525918745189590510238,
+     0.169004726639267902826583426598550,
+     0.190350578064785409913256402421014,
+     0.204432940075298892414161999234649,
+     0.209482141084727828012999174891714
+};
+
+static const double xgk21[11] = { /* abscissae of the 21-point kronrod rule */
+     0.995657163025808080735527280689003,
+     0.973906528517171720077964012084452,
+     0.930157491355708226001207180059508,
+     0.865063366688984510732096688423493,
+     0.780817726586416897063717578345042,
+     0.679409568299024406234327365114874,
+     0.562757134668604683339000099272694,
+     0.433395394129247190799265943165784,
+     0.294392862701460198131126603103866,
+     0.148874338981631210884826001129720,
+     0.000000000000000000000000000000000
+     /* xgk21[1], xgk21[3], ... abscissae of the 10-point gauss rule.
+        xgk21[0], xgk21[2], ... to optimally extend the 10-point gauss rule */
+};
+static const double wg21[5] = { /* weights of the 10-point gauss rule */
+     0.066671344308688137593568809893332,
+     0.149451349150580593145776339657697,
+     0.219086362515982043995534934228163,
+     0.269266719309996355091226921569469,
+     0.295524224714752870173892994651338
+};
+static const double wgk21[11] = { /* weights of the 21-point kronrod rule */
+     0.011694638867371874278064396062192,
+     0.032558162307964727478818972459390,
+     0.054755896574351996031381300244580,
+     0.075039674810919952767043140916190,
+     0.093125454583697605535065465083366,
+     0.109387158802297641899210590325805,
+     0.123491976262065851077958109831074,
+     0.134709217311473325928054001771707,
+     0.142775938577060080797094273138717,
+     0.147739104901338491374841515972068,
+     0.149445554002916905664936468389821
+};
+
+static const double xgk31[16] = { /* abscissae of the 31-point kronrod rule */
+     0.998002298693397060285172840152271,
+     0.987992518020485428489565718586613,
+     0.967739075679139134257347978784337,
+     0.937273392400705904307758947710209,
+     0.897264532344081900882509656454496,
+     0.848206583410427216200648320774217,
+     0.790418501442465932967649294817947,
+     0.724417731360170047416186054613938,
+     0.650996741297416970533735895313275,
+     0.570972172608538847537226737253911,
+     0.485081863640239680693655740232351,
+     0.394151347077563369897207370981045,
+     0.299180007153168812166780024266389,
+     0.201194093997434522300628303394596,
+     0.101142066918717499027074231447392,
+     0.000000000000000000000000000000000
+     /* xgk31[1], xgk31[3], ... abscissae of the 15-point gauss rule.
+        xgk31[0], xgk31[2], ... to optimally extend the 15-point gauss rule */
+};
+static const double wg31[8] = { /* weights of the 15-point gauss rule */
+     0.030753241996117268354628393577204,
+     0.070366047488108124709267416450667,
+     0.107159220467171935011869546685869,
+     0.139570677926154314447804794511028,
+     0.166269205816993933553200860481209,
+     0.186161000015562211026800561866423,
+     0.198431485327111576456118326443839,
+     0.202578241925561272880620199967519
+};
+static const double wgk31[16] = { /* weights of the 31-point kronrod rule */
+     0.005377479872923348987792051430128,
+     0.015007947329316122538374763075807,
+     0.025460847326715320186874001019653,
+     0.035346360791375846222037948478360,
+     0.044589751324764876608227299373280,
+     0.053481524690928087265343147239430,
+     0.062009567800670640285139230960803,
+     0.069854121318728258709520077099147,
+     0.076849680757720378894432777482659,
+     0.083080502823133021038289247286104,
+     0.088564443056211770647275443693774,
+     0.093126598170825321225486872747346,
+     0.096642726983623678505179907627589,
+     0.099173598721791959332393173484603,
+     0.100769845523875595044946662617570,
+     0.101330007014791549017374792767493
+};
+
+static const double xgk61[31] = { /* abscissae of the 61-point kronrod rule */
+     0.999484410050490637571325895705811,
+     0.996893484074649540271630050918695,
+     0.991630996870404594858628366109486,
+     0.983668123279747209970032581605663,
+     0.973116322501126268374693868423707,
+     0.960021864968307512216871025581798,
+     0.944374444748559979415831324037439,
+     0.926200047429274325879324277080474,
+     0.905573307699907798546522558925958,
+     0.882560535792052681543116462530226,
+     0.857205233546061098958658510658944,
+     0.829565762382768397442898119732502,
+     0.799727835821839083013668942322683,
+     0.767777432104826194917977340974503,
+     0.733790062453226804726171131369528,
+     0.697850494793315796932292388026640,
+     0.660061064126626961370053668149271,
+     0.620526182989242861140477556431189,
+     0.579345235826361691756024932172540,
+     0.536624148142019899264169793311073,
+     0.492480467861778574993693061207709,
+     0.447033769538089176780609900322854,
+     0.400401254830394392535476211542661,
+     0.352704725530878113471037207089374,
+     0.304073202273625077372677107199257,
+     0.254636926167889846439805129817805,
+     0.204525116682309891438957671002025,
+     0.153869913608583546963794672743256,
+     0.102806937966737030147096751318001,
+     0.051471842555317695833025213166723,
+     0.000000000000000000000000000000000
+     /* xgk61[1], xgk61[3], ... abscissae of the 30-point gauss rule.
+        xgk61[0], xgk61[2], ... to optimally extend the 30-point gauss rule */
+};
+static const double wg61[15] = { /* weights of the 30-point gauss rule */
+     0.007968192496166605615465883474674,
+     0.018466468311090959142302131912047,
+     0.028784707883323369349719179611292,
+     0.038799192569627049596801936446348,
+     0.048402672830594052902938140422808,
+     0.057493156217619066481721689402056,
+     0.065974229882180495128128515115962,
+     0.073755974737705206268243850022191,
+     0.080755895229420215354694938460530,
+     0.086899787201082979802387530715126,
+     0.092122522237786128717632707087619,
+     0.096368737174644259639468626351810,
+     0.099593420586795267062780282103569,
+     0.101762389748405504596428952168554,
+     0.102852652893558840341285636705415
+};
+static const double wgk61[31] = { /* weights of the 61-point kronrod rule */
+     0.001389013698677007624551591226760,
+     0.003890461127099884051267201844516,
+     0.006630703915931292173319826369750,
+     0.009273279659517763428441146892024,
+     0.011823015253496341742232898853251,
+     0.014369729507045804812451432443580,
+     0.016920889189053272627572289420322,
+     0.019414141193942381173408951050128,
+     0.021828035821609192297167485738339,
+     0.024191162078080601365686370725232,
+     0.026509954882333101610601709335075,
+     0.028754048765041292843978785354334,
+     0.030907257562387762472884252943092,
+     0.032981447057483726031814191016854,
+     0.034979338028060024137499670731468,
+     0.036882364651821229223911065617136,
+     0.038678945624727592950348651532281,
+     0.040374538951535959111995279752468,
+     0.041969810215164246147147541285970,
+     0.043452539701356069316831728117073,
+     0.044814800133162663192355551616723,
+     0.046059238271006988116271735559374,
+     0.047185546569299153945261478181099,
+     0.048185861757087129140779492298305,
+     0.049055434555029778887528165367238,
+     0.049795683427074206357811569379942,
+     0.050405921402782346840893085653585,
+     0.050881795898749606492297473049805,
+     0.051221547849258772170656282604944,
+     0.051426128537459025933862879215781,
+     0.051494729429451567558340433647099
+};
+
+typedef struct {
+     unsigned n; /* number of kronrod abscissae >= 0 (including 0) */
+     const double *xgk, *wg, *wgk;
+} gausskronrod;
+
+static const gausskronrod gk15 = { 8, xgk15, wg15, wgk15 };
+static const gausskronrod gk21 = { 11, xgk21, wg21, wgk21 };
+static const gausskronrod gk31 = { 16, xgk31, wg31, wgk31 };
+static const gausskronrod gk61 = { 31, xgk61, wg61, wgk61 };
+
+typedef struct {
+     rule parent;
+     const gausskronrod *gk;
+} rulegauss;
+
+static int rulegauss_evalPoints(rule *r, unsigned nR, region *R)
+{
+     const gausskronrod *gk = ((rulegauss *) r)->gk;
+     const unsigned n = gk->n;
+     const double *xgk = gk->xgk;
+     unsigned j, iR;
      size_t npts = 0;
-     double *pts, *vals;
+     double *pts;
 
      if (alloc_rule_pts(r, nR)) return FAILURE;
-     pts = r->pts; vals = r->vals;
+     pts = r->pts;
 
      for (iR = 0; iR < nR; ++iR) {
 	  const double center = R[iR].h.data[0];
@@ -693,86 +985,151 @@ static int rule15gauss_evalError(rule *r,
 	  R[iR].splitDim = 0; /* no choice but to divide 0th dimension */
      }
 
-     if (f(1, npts, pts, fdata, fdim, vals))
-	  return FAILURE;
+     return SUCCESS;
+}
 
-     for (k = 0; k < fdim; ++k) {
-          const double *vk = vals + k;
-	  for (iR = 0; iR < nR; ++iR) {
-	       const double halfwidth = R[iR].h.data[1];
-	       double result_gauss = vk[0] * wg[n/2 - 1];
-	       double result_kronrod = vk[0] * wgk[n - 1];
-	       double result_abs = fabs(result_kronrod);
-	       double result_asc, mean, err;
-
-	       /* accumulate integrals */
-	       npts = 1;
-	       for (j = 0; j < (n - 1) / 2; ++j) {
-		    int j2 = 2*j + 1;
-		    double v = vk[fdim*npts] + vk[fdim*npts+fdim];
-		    result_gauss += wg[j] * v;
-		    result_kronrod += wgk[j2] * v;
-		    result_abs += wgk[j2] * (fabs(vk[fdim*npts])
-					     + fabs(vk[fdim*npts+fdim]));
-		    npts += 2;
-	       }
-	       for (j = 0; j < n/2; ++j) {
-		    int j2 = 2*j;
-		    result_kronrod += wgk[j2] * (vk[fdim*npts]
-						 + vk[fdim*npts+fdim]);
-		    result_abs += wgk[j2] * (fabs(vk[fdim*npts])
-					     + fabs(vk[fdim*npts+fdim]));
-		    npts += 2;
-	       }
+#define GK_BLOCK 8 /* # components whose sums are accumulated at once */
+
+/* Evaluate the Gauss-Kronrod rule gk for the components k0..k0+m-1
+   (m <= GK_BLOCK) of the region R, given the values v0 of all of its
+   components at its num_points points, which are contiguous arrays of
+   fdim components (the center, then the pairs of points symmetric about
+   it).  The sums for the m components are accumulated together, in
+   inner loops over contiguous data that the compiler can vectorize when
+   m is a constant (it performs the same operations, in the same order,
+   as for one component at a time).  All m components must be active. */
+static CUBATURE_KERNEL_INLINE
+void rulegauss_components(const gausskronrod *gk, unsigned fdim,
+			  const double *v0, unsigned k0, unsigned m,
+			  region *R)
+{
+     const unsigned n = gk->n;
+     const double *wg = gk->wg, *wgk = gk->wgk;
+     const double halfwidth = R->h.data[1];
+     double sg[GK_BLOCK], sk[GK_BLOCK], sabs[GK_BLOCK], sasc[GK_BLOCK];
+     const double *v;
+     unsigned j, k;
+
+     /* accumulate integrals */
+     v0 += k0;
+     for (k = 0; k < m; ++k) {
+	  /* the center is a gauss point only for odd-order gauss rules */
+	  sg[k] = n % 2 == 0 ? v0[k] * wg[n/2 - 1] : 0;
+	  sk[k] = v0[k] * wgk[n - 1];
+	  sabs[k] = fabs(sk[k]);
+     }
+     v = v0 + fdim;
+     for (j = 0; j < (n - 1) / 2; ++j, v += 2 * fdim) {
+	  const double w = wg[j], wk = wgk[2*j + 1];
+	  for (k = 0; k < m; ++k) {
+	       double s = v[k] + v[fdim + k];
+	       sg[k] += w * s;
+	       sk[k] += wk * s;
+	       sabs[k] += wk * (fabs(v[k]) + fabs(v[fdim + k]));
+	  }
+     }
+     for (j = 0; j < n/2; ++j, v += 2 * fdim) {
+	  const double wk = wgk[2*j];
+	  for (k = 0; k < m; ++k) {
+	       sk[k] += wk * (v[k] + v[fdim + k]);
+	       sabs[k] += wk * (fabs(v[k]) + fabs(v[fdim + k]));
+	  }
+     }
 
-	       /* integration result */
-	       R[iR].ee[k].val = result_kronrod * halfwidth;
-
-	       /* error estimate
-		  (from GSL, probably dates back to QUADPACK
-		  ... not completely clear to me why we don't just use
-	          fabs(result_kronrod - result_gauss) * halfwidth */
-	       mean = result_kronrod * 0.5;
-	       result_asc = wgk[n - 1] * fabs(vk[0] - mean);
-	       npts = 1;
-	       for (j = 0; j < (n - 1) / 2; ++j) {
-		    int j2 = 2*j + 1;
-		    result_asc += wgk[j2] * (fabs(vk[fdim*npts]-mean)
-					     + fabs(vk[fdim*npts+fdim]-mean));
-		    npts += 2;
-	       }
-	       for (j = 0; j < n/2; ++j) {
-		    int j2 = 2*j;
-		    result_asc += wgk[j2] * (fabs(vk[fdim*npts]-mean)
-					     + fabs(vk[fdim*npts+fdim]-mean));
-		    npts += 2;
-	       }
-	       err = fabs(result_kronrod - result_gauss) * halfwidth;
-	       result_abs *= halfwidth;
-	       result_asc *= halfwidth;
-	       if (result_asc != 0 && err != 0) {
-		    double scale = pow((200 * err / result_asc), 1.5);
-		    err = (scale < 1) ? result_asc * scale : result_asc;
-	       }
-	       if (result_abs > DBL_MIN / (50 * DBL_EPSILON)) {
-		    double min_err = 50 * DBL_EPSILON * result_abs;
-		    if (min_err > err) err = min_err;
-	       }
-	       R[iR].ee[k].err = err;
+     /* error estimate
+	(from GSL, probably dates back to QUADPACK
+	... not completely clear to me why we don't just use
+	fabs(result_kronrod - result_gauss) * halfwidth */
+     for (k = 0; k < m; ++k)
+	  sasc[k] = wgk[n - 1] * fabs(v0[k] - sk[k] * 0.5);
+     v = v0 + fdim;
+     for (j = 0; j < (n - 1) / 2; ++j, v += 2 * fdim) {
+	  const double wk = wgk[2*j + 1];
+	  for (k = 0; k < m; ++k) {
+	       double mean = sk[k] * 0.5;
+	       sasc[k] += wk * (fabs(v[k] - mean) + fabs(v[fdim + k] - mean));
+	  }
+     }
+     for (j = 0; j < n/2; ++j, v += 2 * fdim) {
+	  const double wk = wgk[2*j];
+	  for (k = 0; k < m; ++k) {
+	       double mean = sk[k] * 0.5;
+	       sasc[k] += wk * (fabs(v[k] - mean) + fabs(v[fdim + k] - mean));
+	  }
+     }
+
+     for (k = 0; k < m; ++k) {
+	  double err = fabs(sk[k] - sg[k]) * halfwidth;
+	  double result_abs = sabs[k] * halfwidth;
+	  double result_asc = sasc[k] * halfwidth;
+
+	  /* integration result */
+	  R->ee[k0 + k].val = sk[k] * halfwidth;
 
-	       /* increment vk to point to next batch of results */
-	       vk += 15*fdim;
+	  if (result_asc != 0 && err != 0) {
+	       /* (200 * err / result_asc)^1.5, without calling pow */
+	       double x = 200 * err / result_asc;
+	       double scale = x * sqrt(x);
+	       err = (scale < 1) ? result_asc * scale : result_asc;
 	  }
+	  if (result_abs > DBL_MIN / (50 * DBL_EPSILON)) {
+	       double min_err = 50 * DBL_EPSILON * result_abs;
+	       if (min_err > err) err = min_err;
+	  }
+	  R->ee[k0 + k].err = err;
+     }
+}
+
+CUBATURE_KERNEL
+static void rulegauss_evalValues(rule *r, unsigned fdim,
+				 const char *active, unsigned nR, region *R)
+{
+     const gausskronrod *gk = ((rulegauss *) r)->gk;
+     const double *v0 = r->vals;
+     unsigned i, k, iR;
+
+     /* the blocks of GK_BLOCK components that are all active are summed
+	together, and the other active components one at a time (the
+	values of retired components are not computed by the integrand) */
+     for (iR = 0; iR < nR; ++iR, v0 += r->num_points * fdim) {
+	  for (k = 0; k + GK_BLOCK <= fdim; k += GK_BLOCK) {
+	       unsigned nactive = GK_BLOCK;
+	       if (active)
+		    for (i = nactive = 0; i < GK_BLOCK; ++i)
+			 nactive += active[k + i] != 0;
+	       if (nactive == GK_BLOCK)
+		    rulegauss_components(gk, fdim, v0, k, GK_BLOCK, R + iR);
+	       else if (nactive > 0)
+		    for (i = k; i < k + GK_BLOCK; ++i)
+			 if (active[i])
+			      rulegauss_components(gk, fdim, v0, i, 1, R + iR);
+	  }
+	  for (; k < fdim; ++k) /* the rest, one at a time */
+	       if (!active || active[k])
+		    rulegauss_components(gk, fdim, v0, k, 1, R + iR);
      }
-     return SUCCESS;
 }
 
-static rule *make_rule15gauss(unsigned dim, unsigned fdim)
+static rule *make_rulegauss(unsigned dim, unsigned fdim,
+			    hcubature_rule1d which)
 {
+     const gausskronrod *gk;
+     rulegauss *r;
+
      if (dim != 1) return NULL; /* this rule is only for 1d integrals */
 
-     return make_rule(sizeof(rule), dim, fdim, 15,
-		      rule15gauss_evalError, 0);
+     switch (which) {
+	 case HCUBATURE_GK15: gk = &gk15; break;
+	 case HCUBATURE_GK21: gk = &gk21; break;
+	 case HCUBATURE_GK31: gk = &gk31; break;
+	 case HCUBATURE_GK61: gk = &gk61; break;
+	 default: return NULL;
+     }
+     r = (rulegauss *) make_rule(sizeof(rulegauss), dim, fdim, 2*gk->n - 1,
+				 rulegauss_evalPoints, rulegauss_evalValues, 0);
+     if (!r) return NULL;
+     r->gk = gk;
+     return (rule *) r;
 }
 
 /***************************************************************************/
@@ -832,10 +1189,16 @@ static int heap_push(heap *h, heap_item hi)
      int insert;
      unsigned i, fdim = h->fdim;
 
-     for (i = 0; i < fdim; ++i) {
-	  h->ee[i].val += hi.ee[i].val;
-	  h->ee[i].err += hi.ee[i].err;
-     }
+     if (hi.cee)
+	  for (i = 0; i < fdim; ++i) {
+	       h->ee[i].val += hi.cee[2*i];
+	       h->ee[i].err += hi.cee[2*i+1];
+	  }
+     else
+	  for (i = 0; i < fdim; ++i) {
+	       h->ee[i].val += hi.ee[i].val;
+	       h->ee[i].err += hi.ee[i].err;
+	  }
      insert = h->n;
      if (++(h->n) > h->nalloc) {
 	  heap_resize(h, h->n * 2);
@@ -861,18 +1224,10 @@ static int heap_push_many(heap *h, size_t ni, heap_item *hi)
      return SUCCESS;
 }
 
-static heap_item heap_pop(heap *h)
+/* move the item i down to its place in the heap order */
+static void heap_sift_down(heap *h, int i)
 {
-     heap_item ret;
-     int i, n, child;
-
-     if (!(h->n)) {
-	  fprintf(stderr, "attempted to pop an empty heap\n");
-	  exit(EXIT_FAILURE);
-     }
-
-     ret = h->items[0];
-     h->items[i = 0] = h->items[n = --(h->n)];
+     int n = h->n, child;
      while ((child = i * 2 + 1) < n) {
 	  int largest;
 	  heap_item swap;
@@ -889,194 +1244,2090 @@ static heap_item heap_pop(heap *h)
 	  h->items[i] = h->items[largest];
 	  h->items[i = largest] = swap;
      }
+}
+
+static heap_item heap_pop(heap *h)
+{
+     heap_item ret;
+
+     if (!(h->n)) {
+	  fprintf(stderr, "attempted to pop an empty heap\n");
+	  exit(EXIT_FAILURE);
+     }
+
+     ret = h->items[0];
+     h->items[0] = h->items[--(h->n)];
+     heap_sift_down(h, 0);
 
      {
 	  unsigned i, fdim = h->fdim;
-	  for (i = 0; i < fdim; ++i) {
-	       h->ee[i].val -= ret.ee[i].val;
-	       h->ee[i].err -= ret.ee[i].err;
-	  }
+	  if (ret.cee)
+	       for (i = 0; i < fdim; ++i) {
+		    h->ee[i].val -= ret.cee[2*i];
+		    h->ee[i].err -= ret.cee[2*i+1];
+	       }
+	  else
+	       for (i = 0; i < fdim; ++i) {
+		    h->ee[i].val -= ret.ee[i].val;
+		    h->ee[i].err -= ret.ee[i].err;
+	       }
      }
      return ret;
 }
 
+/* recompute the keys of all of the items, taking only the components j
+   with active[j] != 0 into account, and restore the heap order */
+static void heap_rekey(heap *h, const char *active)
+{
+     int i, n = h->n;
+     for (i = 0; i < n; ++i)
+	  h->items[i].errmax = region_errmax(&h->items[i], active);
+     for (i = n / 2 - 1; i >= 0; --i)
+	  heap_sift_down(h, i);
+}
+
+/***************************************************************************/
+/* Wynn's epsilon algorithm for accelerating the convergence of a
+   sequence of integral estimates, based on qelg.c in GNU GSL (which in
+   turn is based on QUADPACK's dqelg).  See:
+
+         P. Wynn, "On a device for computing the e_m(S_n)
+         transformation," Math. Tables Aids Comput. 10, 91-96 (1956).
+
+   As in QUADPACK's QAGS, the sequence is formed by the estimates of the
+   integral after each successive bisection of the smallest subintervals,
+   which typically converges (slowly) to the integral for integrable
+   endpoint singularities, and the epsilon algorithm extrapolates its
+   limit. */
+
+#define EPSILON_LIMEXP 50 /* max. number of elements in the table */
+
+typedef struct {
+     size_t n; /* number of elements currently in rlist2 */
+     double rlist2[EPSILON_LIMEXP + 2]; /* the epsilon table */
+     size_t nres; /* number of calls to epsilon_extrapolate */
+     double res3la[3]; /* the last three results */
+} epsilon_table;
+
+static void epsilon_init(epsilon_table *t)
+{
+     t->n = 0;
+     t->nres = 0;
+}
+
+static void epsilon_append(epsilon_table *t, double y)
+{
+     t->rlist2[t->n++] = y;
+}
+
+/* compute the extrapolated limit *result of the sequence in the table,
+   along with an estimate *abserr of its error, and update the table */
+static void epsilon_extrapolate(epsilon_table *t,
+				double *result, double *abserr)
+{
+     double *epstab = t->rlist2;
+     double *res3la = t->res3la;
+     const size_t n = t->n - 1;
+     const double current = epstab[n];
+     double absolute = DBL_MAX;
+     double relative = 5 * DBL_EPSILON * fabs(current);
+     const size_t newelm = n / 2;
+     const size_t n_orig = n;
+     size_t n_final = n;
+     size_t i;
+     const size_t nres_orig = t->nres;
+
+     *result = current;
+     *abserr = DBL_MAX;
+
+     if (n < 2) {
+	  *abserr = absolute > relative ? absolute : relative;
+	  return;
+     }
+
+     epstab[n + 2] = epstab[n];
+     epstab[n] = DBL_MAX;
+
+     for (i = 0; i < newelm; ++i) {
+	  double res = epstab[n - 2 * i + 2];
+	  double e0 = epstab[n - 2 * i - 2];
+	  double e1 = epstab[n - 2 * i - 1];
+	  double e2 = res;
+
+	  double e1abs = fabs(e1);
+	  double delta2 = e2 - e1;
+	  double err2 = fabs(delta2);
+	  double tol2 = (fabs(e2) > e1abs ? fabs(e2) : e1abs) * DBL_EPSILON;
+	  double delta3 = e1 - e0;
+	  double err3 = fabs(delta3);
+	  double tol3 = (e1abs > fabs(e0) ? e1abs : fabs(e0)) * DBL_EPSILON;
+
+	  double e3, delta1, err1, tol1, ss;
+
+	  if (err2 <= tol2 && err3 <= tol3) {
+	       /* e0, e1 and e2 are equal to within machine accuracy,
+		  so convergence is assumed */
+	       *result = res;
+	       absolute = err2 + err3;
+	       relative = 5 * DBL_EPSILON * fabs(res);
+	       *abserr = absolute > relative ? absolute : relative;
+	       return;
+	  }
+
+	  e3 = epstab[n - 2 * i];
+	  epstab[n - 2 * i] = e1;
+	  delta1 = e1 - e3;
+	  err1 = fabs(delta1);
+	  tol1 = (e1abs > fabs(e3) ? e1abs : fabs(e3)) * DBL_EPSILON;
+
+	  /* if two elements are very close to each other, omit a part of
+	     the table by adjusting the value of n */
+	  if (err1 <= tol1 || err2 <= tol2 || err3 <= tol3) {
+	       n_final = 2 * i;
+	       break;
+	  }
+
+	  ss = (1 / delta1 + 1 / delta2) - 1 / delta3;
+
+	  /* test to detect irregular behaviour in the table, and
+	     eventually omit a part of the table by adjusting n */
+	  if (fabs(ss * e1) <= 0.0001) {
+	       n_final = 2 * i;
+	       break;
+	  }
+
+	  /* compute a new element and eventually adjust the result */
+	  res = e1 + 1 / ss;
+	  epstab[n - 2 * i] = res;
+	  {
+	       const double error = err2 + fabs(res - e2) + err3;
+	       if (error <= *abserr) {
+		    *abserr = error;
+		    *result = res;
+	       }
+	  }
+     }
+
+     /* shift the table */
+     if (n_final == EPSILON_LIMEXP - 1)
+	  n_final = 2 * ((EPSILON_LIMEXP - 1) / 2);
+     if (n_orig % 2 == 1) {
+	  for (i = 0; i <= newelm; ++i)
+	       epstab[1 + i * 2] = epstab[i * 2 + 3];
+     }
+     else {
+	  for (i = 0; i <= newelm; ++i)
+	       epstab[i * 2] = epstab[i * 2 + 2];
+     }
+     if (n_orig != n_final)
+	  for (i = 0; i <= n_final; ++i)
+	       epstab[i] = epstab[n_orig - n_final + i];
+     t->n = n_final + 1;
+
+     if (nres_orig < 3) {
+	  res3la[nres_orig] = *result;
+	  *abserr = DBL_MAX;
+     }
+     else { /* compute error estimate */
+	  *abserr = (fabs(*result - res3la[2]) + fabs(*result - res3la[1])
+		     + fabs(*result - res3la[0]));
+	  res3la[0] = res3la[1];
+	  res3la[1] = res3la[2];
+	  res3la[2] = *result;
+     }
+     t->nres = nres_orig + 1;
+
+     if (*abserr < 5 * DBL_EPSILON * fabs(*result))
+	  *abserr = 5 * DBL_EPSILON * fabs(*result);
+}
+
 /***************************************************************************/
 
+CUBATURE_KERNEL
 static int converged(unsigned fdim, const esterr *ee,
 		     double reqAbsError, double reqRelError, error_norm norm)
 #define ERR(j) ee[j].err
 #define VAL(j) ee[j].val
 #include "converged.h"
 
-/***************************************************************************/
+/* record the current # regions and memory usage of rulecubature */
+static void region_stats(cubature_stats *s, const rule *r,
+			 const heap *regions, const heap *small,
+			 size_t nR_alloc, int compact)
+{
+     size_t n = regions->n + small->n;
+     stats_peak(s, n,
+		(regions->nalloc + small->nalloc + nR_alloc)
+		* sizeof(heap_item)
+		+ n * (sizeof(double) * 2 * r->dim
+		       + (compact ? sizeof(float) * 2 : sizeof(esterr))
+		       * r->fdim)
+		+ sizeof(double) * r->num_regions * r->num_points
+		* (r->dim + r->fdim));
+}
+
+#include "infwrapper.h"
+#include "procwrapper.h"
 
-/* adaptive integration, analogous to adaptintegrator.cpp in HIntLib */
+/* the inverse of the change of variables for infinite limits in
+   dimension i (see infwrapper.h), clamped to the t interval */
+static double infwrap_inverse(const infwrap_data *d, unsigned i, double x)
+{
+     double t, y, tmin, tmax;
+     if (!d->kind) return x; /* no change of variables */
+     switch (d->kind[i]) {
+	 case INF_UPPER:
+	 case INF_LOWER:
+	      y = d->kind[i] == INF_UPPER ? x - d->x0[i] : d->x0[i] - x;
+	      t = y == HUGE_VAL ? 1 : y / (1 + y);
+	      break;
+	 case INF_BOTH: /* solve x = t / (1 - t^2) */
+	      y = fabs(2 * x);
+	      y = y > 1 ? y * sqrt(1 + 1 / (y * y)) : sqrt(1 + y * y);
+	      t = y == HUGE_VAL ? (x > 0 ? 1 : -1) : 2 * x / (1 + y);
+	      break;
+	 default:
+	      t = x;
+     }
+     tmin = d->tmin[i] < d->tmax[i] ? d->tmin[i] : d->tmax[i];
+     tmax = d->tmin[i] < d->tmax[i] ? d->tmax[i] : d->tmin[i];
+     return t < tmin ? tmin : (t > tmax ? tmax : t);
+}
 
-static int rulecubature(rule *r, unsigned fdim,
-			integrand_v f, void *fdata,
-			const hypercube *h,
-			size_t maxEval,
-			double reqAbsError, double reqRelError,
-			error_norm norm,
-			double *val, double *err, int parallel)
+/* Construct the array of initial hypercubes, returning its length in
+   *nh (or NULL if out of memory, or if the options are invalid or give
+   too many boxes to allocate): the
+   domain [xmin, xmax], or the boxes of opt (if any), subdivided at
+   the breakpoints of opt (if any).  The boxes and breakpoints are
+   mapped to the transformed variables of inf, if any. */
+static hypercube *make_initial_hypercubes(unsigned dim,
+					  const double *xmin,
+					  const double *xmax,
+					  const cubature_options *opt,
+					  const infwrap_data *inf,
+					  size_t *nh)
 {
-     size_t numEval = 0;
-     heap regions;
+     size_t nb = 1, nb_alloc = 1, k, kmax;
+     /* the most boxes whose size in bytes fits in a size_t */
+     size_t nb_max = ((size_t) -1) / (sizeof(double) * 2 * dim);
      unsigned i, j;
-     region *R = NULL; /* array of regions to evaluate */
-     size_t nR_alloc = 0;
-     esterr *ee = NULL;
-
-     if (fdim <= 1) norm = ERROR_INDIVIDUAL; /* norm is irrelevant */
-     if (norm < 0 || norm > ERROR_LINF) return FAILURE; /* invalid norm */
-
-     regions = heap_alloc(1, fdim);
-     if (!regions.ee || !regions.items) goto bad;
-
-     ee = (esterr *) malloc(sizeof(esterr) * fdim);
-     if (!ee) goto bad;
-
-     nR_alloc = 2;
-     R = (region *) malloc(sizeof(region) * nR_alloc);
-     if (!R) goto bad;
-     R[0] = make_region(h, fdim);
-     if (!R[0].ee
-	 || eval_regions(1, R, f, fdata, r)
-	 || heap_push(&regions, R[0]))
-	       goto bad;
-     numEval += r->num_points;
-
-     while (numEval < maxEval || !maxEval) {
-	  if (converged(fdim, regions.ee, reqAbsError, reqRelError, norm))
-	       break;
+     double *b; /* nb boxes: dim lower limits followed by dim upper */
+     hypercube *h = NULL;
 
-	  if (parallel) { /* maximize potential parallelism */
-	       /* adapted from I. Gladwell, "Vectorization of one
-		  dimensional quadrature codes," pp. 230--238 in
-		  _Numerical Integration. Recent Developments,
-		  Software and Applications_, G. Fairweather and
-		  P. M. Keast, eds., NATO ASI Series C203, Dordrecht
-		  (1987), as described in J. M. Bull and
-		  T. L. Freeman, "Parallel Globally Adaptive
-		  Algorithms for Multi-dimensional Integration,"
-		  http://citeseerx.ist.psu.edu/viewdoc/summary?doi=10.1.1.42.6638
-		  (1994).
-
-		  Basically, this evaluates in one shot all regions
-		  that *must* be evaluated in order to reduce the
-		  error to the requested bound: the minimum set of
-		  largest-error regions whose errors push the total
-		  error over the bound.
-
-		  [Note: Bull and Freeman claim that the Gladwell
-		  approach is intrinsically inefficent because it
-		  "requires sorting", and propose an alternative
-		  algorithm that "only" requires three passes over the
-		  entire set of regions.  Apparently, they didn't
-		  realize that one could use a heap data structure, in
-		  which case the time to pop K biggest-error regions
-		  out of N is only O(K log N), much better than the
-		  O(N) cost of the Bull and Freeman algorithm if K <<
-		  N, and it is also much simpler.] */
-	       size_t nR = 0;
-	       for (j = 0; j < fdim; ++j) ee[j] = regions.ee[j];
-	       do {
-		    if (nR + 2 > nR_alloc) {
-			 nR_alloc = (nR + 2) * 2;
-			 R = (region *) realloc(R, nR_alloc * sizeof(region));
-			 if (!R) goto bad;
-		    }
-		    R[nR] = heap_pop(&regions);
-		    for (j = 0; j < fdim; ++j) ee[j].err -= R[nR].ee[j].err;
-		    if (cut_region(R+nR, R+nR+1)) goto bad;
-		    numEval += r->num_points * 2;
-		    nR += 2;
-		    if (converged(fdim, ee, reqAbsError, reqRelError, norm))
-			 break; /* other regions have small errs */
-	       } while (regions.n > 0 && (numEval < maxEval || !maxEval));
-	       if (eval_regions(nR, R, f, fdata, r)
-		   || heap_push_many(&regions, nR, R))
-		    goto bad;
-	  }
-	  else { /* minimize number of function evaluations */
-	       R[0] = heap_pop(&regions); /* get worst region */
-	       if (cut_region(R, R+1)
-		   || eval_regions(2, R, f, fdata, r)
-		   || heap_push_many(&regions, 2, R))
-		    goto bad;
-	       numEval += r->num_points * 2;
+     if (opt && opt->nboxes > 0) {
+	  if (!opt->boxes || opt->nboxes > nb_max) return NULL;
+	  nb = nb_alloc = opt->nboxes;
+     }
+     if (opt && opt->nbreak) {
+	  if (!opt->breakpoints) return NULL;
+	  for (i = 0; i < dim; ++i) {
+	       size_t n = (size_t) opt->nbreak[i] + 1;
+	       if (n == 0 || nb_alloc > nb_max / n) return NULL;
+	       nb_alloc *= n;
 	  }
      }
+     b = (double *) malloc(sizeof(double) * nb_alloc * 2 * dim);
+     if (!b) return NULL;
+     if (opt && opt->nboxes > 0)
+	  for (k = 0; k < nb; ++k)
+	       for (i = 0; i < dim; ++i) {
+		    double t1 = infwrap_inverse(inf, i,
+						opt->boxes[2*dim*k + i]);
+		    double t2 = infwrap_inverse(inf, i,
+						opt->boxes[2*dim*k + dim + i]);
+		    b[2*dim*k + i] = t1 < t2 ? t1 : t2;
+		    b[2*dim*k + dim + i] = t1 < t2 ? t2 : t1;
+	       }
+     else
+	  for (i = 0; i < dim; ++i) {
+	       b[i] = xmin[i];
+	       b[dim + i] = xmax[i];
+	  }
 
-     /* re-sum integral and errors */
-     for (j = 0; j < fdim; ++j) val[j] = err[j] = 0;
-     for (i = 0; i < regions.n; ++i) {
-	  for (j = 0; j < fdim; ++j) {
-	       val[j] += regions.items[i].ee[j].val;
-	       err[j] += regions.items[i].ee[j].err;
+     /* split every box that contains a breakpoint */
+     if (opt && opt->nbreak)
+	  for (i = 0; i < dim; ++i)
+	       for (j = 0; j < opt->nbreak[i]; ++j) {
+		    double t = infwrap_inverse(inf, i,
+					       opt->breakpoints[i][j]);
+		    for (k = 0, kmax = nb; k < kmax; ++k) {
+			 double *bk = b + 2*dim*k;
+			 /* xmin[i] > xmax[i] is allowed (if there are
+			    no boxes), giving boxes with reversed limits */
+			 double lo = bk[i] < bk[dim + i] ? bk[i] : bk[dim + i];
+			 double hi = bk[i] < bk[dim + i] ? bk[dim + i] : bk[i];
+			 if (t > lo && t < hi) {
+			      double *bn = b + 2*dim*nb++;
+			      memcpy(bn, bk, sizeof(double) * 2 * dim);
+			      bk[dim + i] = bn[i] = t;
+			 }
+		    }
+	       }
+
+     h = (hypercube *) malloc(sizeof(hypercube) * nb);
+     if (h)
+	  for (k = 0; k < nb; ++k) {
+	       h[k] = make_hypercube_range(dim, b + 2*dim*k, b + 2*dim*k + dim);
+	       if (!h[k].data) {
+		    while (k > 0) destroy_hypercube(&h[--k]);
+		    free(h);
+		    h = NULL;
+		    break;
+	       }
 	  }
-	  destroy_region(&regions.items[i]);
+     free(b);
+     *nh = nb;
+     return h;
+}
+
+/***************************************************************************/
+
+/* Refinement trace (see cubature_options.trace).  Each record is a type
+   character followed by numeric fields: a line "T,x,y,..." in
+   CUBATURE_TRACE_CSV format, or the type byte followed by the fields
+   as native doubles in CUBATURE_TRACE_BINARY format.  The records of an
+   integration over a box of dimension dim with fdim components are:
+
+   I dim fdim num_points                      the start of the integration
+   R k center[dim] halfwidth[dim] err[fdim]   the k-th initial region
+   C batch level splitDim center[dim] halfwidth[dim]
+	errbefore[fdim] errafter[fdim]        a bisection of a region
+   B batch nregions numEval                   a batch of regions evaluated
+   E numEval status                           the end of the integration
+
+   where a C record gives the box and the error estimates of the parent
+   region, and the sums of the error estimates of its two halves.  (With
+   infinite limits, the boxes are in the transformed coordinates.)  The
+   bisections of a batch are recorded after its evaluation, just before
+   its B record; with nthreads > 1, there are no B records, and batch
+   counts the bisections.  The records are collected in buf, which is
+   written out whenever the next field might not fit, so the memory and
+   the number of writes are bounded whatever the size of the records. */
+
+#define TRACE_BUFSIZE 65536
+#define TRACE_FIELDMAX 32 /* space for one field in CSV format */
+
+typedef struct {
+     FILE *f; /* NULL if not tracing (or if a write failed) */
+     int binary;
+     unsigned dim, fdim;
+     char *buf;
+     size_t n; /* # bytes in buf */
+     double *cuts; /* the pending bisections of the current batch */
+     size_t ncuts, ncuts_alloc;
+     size_t batch;
+} trace_data;
+
+/* # doubles stored per bisection: level, splitDim, box, errbefore */
+#define TRACE_CUTLEN(t) (2 + 2 * (t)->dim + (t)->fdim)
+
+static void trace_flush(trace_data *t)
+{
+     if (t->f && t->n > 0 && fwrite(t->buf, 1, t->n, t->f) < t->n)
+	  t->f = NULL; /* give up */
+     t->n = 0;
+}
+
+static void trace_begin(trace_data *t, char type)
+{
+     if (t->n + TRACE_FIELDMAX > TRACE_BUFSIZE) trace_flush(t);
+     t->buf[t->n++] = type;
+}
+
+static void trace_field(trace_data *t, double x)
+{
+     if (t->n + TRACE_FIELDMAX > TRACE_BUFSIZE) trace_flush(t);
+     if (t->binary) {
+	  memcpy(t->buf + t->n, &x, sizeof(double));
+	  t->n += sizeof(double);
      }
+     else
+	  t->n += (size_t) sprintf(t->buf + t->n, ",%.17g", x);
+}
 
-     /* printf("regions.nalloc = %d\n", regions.nalloc); */
-     free(ee);
-     heap_free(&regions);
-     free(R);
-     return SUCCESS;
+static void trace_end(trace_data *t)
+{
+     if (!t->binary) t->buf[t->n++] = '\n'; /* fits after a field */
+}
 
-bad:
-     free(ee);
-     heap_free(&regions);
-     free(R);
-     return FAILURE;
+/* start tracing to f (if it is non-NULL) with the given rule */
+static void trace_init(trace_data *t, FILE *f, cubature_trace_format format,
+		       const rule *r)
+{
+     memset(t, 0, sizeof(trace_data));
+     if (!f) return;
+     t->buf = (char *) malloc(TRACE_BUFSIZE);
+     if (!t->buf) return; /* no trace */
+     t->f = f;
+     t->binary = format == CUBATURE_TRACE_BINARY;
+     t->dim = r->dim;
+     t->fdim = r->fdim;
+     trace_begin(t, 'I');
+     trace_field(t, r->dim);
+     trace_field(t, r->fdim);
+     trace_field(t, r->num_points);
+     trace_end(t);
 }
 
-static int cubature(unsigned fdim, integrand_v f, void *fdata,
-		    unsigned dim, const double *xmin, const double *xmax,
-		    size_t maxEval, double reqAbsError, double reqRelError,
-		    error_norm norm,
-		    double *val, double *err, int parallel)
+/* store the level, split dimension, box and errors of the region R
+   (with uncompacted estimates), which is about to be bisected, in
+   cut[0..TRACE_CUTLEN(t)-1] */
+static void trace_save(const trace_data *t, const region *R, double *cut)
 {
-     rule *r;
-     hypercube h;
-     int status;
      unsigned i;
+     *cut++ = R->level;
+     *cut++ = R->splitDim;
+     for (i = 0; i < 2 * t->dim; ++i) *cut++ = R->h.data[i];
+     for (i = 0; i < t->fdim; ++i) *cut++ = R->ee[i].err;
+}
 
-     if (fdim == 0) /* nothing to do */ return SUCCESS;
-     if (dim == 0) { /* trivial integration */
-	  if (f(0, 1, xmin, fdata, fdim, val)) return FAILURE;
-	  for (i = 0; i < fdim; ++i) err[i] = 0;
-	  return SUCCESS;
+/* append the region R, about to be bisected, to the pending bisections
+   of the current batch */
+static void trace_cut(trace_data *t, const region *R)
+{
+     size_t len = TRACE_CUTLEN(t);
+     if (!t->f) return;
+     if (t->ncuts == t->ncuts_alloc) {
+	  size_t nalloc = t->ncuts_alloc * 2 + 16;
+	  double *cuts = (double *) realloc(t->cuts,
+					    sizeof(double) * len * nalloc);
+	  if (!cuts) { /* out of memory: give up */
+	       trace_flush(t);
+	       t->f = NULL;
+	       return;
+	  }
+	  t->cuts = cuts;
+	  t->ncuts_alloc = nalloc;
      }
-     r = dim == 1 ? make_rule15gauss(dim, fdim)
- 	          : make_rule75genzmalik(dim, fdim);
-     if (!r) {
-	  for (i = 0; i < fdim; ++i) {
-	       val[i] = 0;
-	       err[i] = HUGE_VAL;
+     trace_save(t, R, t->cuts + len * t->ncuts++);
+}
+
+/* write a C record for the bisection cut (see trace_save) whose halves,
+   now evaluated (with uncompacted estimates), are R[0] and R[1] */
+static void trace_write_cut(trace_data *t, const double *cut, const region *R)
+{
+     unsigned i;
+     trace_begin(t, 'C');
+     trace_field(t, t->batch);
+     for (i = 0; i < 2 + 2 * t->dim + t->fdim; ++i)
+	  trace_field(t, cut[i]);
+     for (i = 0; i < t->fdim; ++i)
+	  trace_field(t, R[0].ee[i].err + R[1].ee[i].err);
+     trace_end(t);
+}
+
+/* the batch of regions R[0..nR-1] was evaluated (with uncompacted
+   estimates): they are the initial regions if this is the first batch,
+   and otherwise the halves of the pending bisections, in order */
+static void trace_batch(trace_data *t, const region *R, size_t nR,
+			size_t numEval)
+{
+     size_t k;
+     unsigned i;
+     if (!t->f || nR == 0) return;
+     if (t->batch == 0)
+	  for (k = 0; k < nR; ++k) {
+	       trace_begin(t, 'R');
+	       trace_field(t, k);
+	       for (i = 0; i < 2 * t->dim; ++i)
+		    trace_field(t, R[k].h.data[i]);
+	       for (i = 0; i < t->fdim; ++i)
+		    trace_field(t, R[k].ee[i].err);
+	       trace_end(t);
 	  }
-	  return FAILURE;
+     else
+	  for (k = 0; k < t->ncuts; ++k)
+	       trace_write_cut(t, t->cuts + TRACE_CUTLEN(t) * k, R + 2*k);
+     t->ncuts = 0;
+     trace_begin(t, 'B');
+     trace_field(t, t->batch);
+     trace_field(t, nR);
+     trace_field(t, numEval);
+     trace_end(t);
+     ++t->batch;
+}
+
+/* write the E record, flush and free t */
+static void trace_free(trace_data *t, size_t numEval, int status)
+{
+     if (t->f) {
+	  trace_begin(t, 'E');
+	  trace_field(t, numEval);
+	  trace_field(t, status);
+	  trace_end(t);
+	  trace_flush(t);
+	  if (t->f) fflush(t->f);
      }
-     h = make_hypercube_range(dim, xmin, xmax);
-     status = !h.data ? FAILURE
-	  : rulecubature(r, fdim, f, fdata, &h,
-				maxEval, reqAbsError, reqRelError, norm,
-				val, err, parallel);
-     destroy_hypercube(&h);
-     destroy_rule(r);
-     return status;
+     free(t->cuts);
+     free(t->buf);
+     memset(t, 0, sizeof(trace_data));
 }
 
-int hcubature_v(unsigned fdim, integrand_v f, void *fdata,
-                unsigned dim, const double *xmin, const double *xmax,
-                size_t maxEval, double reqAbsError, double reqRelError,
-                error_norm norm,
-                double *val, double *err)
+/***************************************************************************/
+
+/* adaptive integration, analogous to adaptintegrator.cpp in HIntLib,
+   written as a state machine that returns to the caller whenever it
+   needs the integrand at a batch of points (see hcubature_rc_next in
+   cubature.h, and cubature below for the usual driver).
+
+   If extrapolate is nonzero, we proceed as in QUADPACK's QAGS: regions
+   that have been bisected maxlevel times are "small" and are set aside
+   (in the small heap) until the error in the remaining "large" regions
+   is below the tolerance.  At that point, the integral estimate is
+   added to the epsilon table, maxlevel is incremented, and the small
+   regions are returned to the pool.
+
+   The following fields of opt are used:
+
+   If stats is non-NULL, the termination reason, the number of steps,
+   and the peak number of regions and memory usage are recorded.
+
+   If progress is non-NULL, it is called with progress_data at the start
+   of each iteration that follows the evaluation of a new batch of
+   regions, and if it returns nonzero we stop and return the current
+   estimates (as if maxEval were reached).
+
+   If maxTime > 0, we likewise stop when maxTime seconds have elapsed,
+   but return CUBATURE_TIMEOUT, and in parallel mode we limit the size
+   of each batch to the number of evaluations that we expect to fit in
+   the remaining time (judging by the time per evaluation so far).
+
+   In parallel mode, each batch is padded with the next-worst regions
+   to at least min_batch points (if possible), and the rule is applied
+   to at most max_batch points at a time (see r->max_regions).
+
+   With a masked integrand (see hcubature_vm) and ERROR_INDIVIDUAL, each
+   component is retired as soon as its total error satisfies the
+   tolerance (see rc_retire). */
+
+#define RC_EVAL 0 /* evaluating the rule on the regions R[iR..nR-1] */
+#define RC_WAIT 1 /* waiting for the integrand at the regions R[iR..] */
+#define RC_SELECT 2 /* checking for convergence & choosing new regions */
+#define RC_DONE 3 /* finished, with the return value status */
+
+struct hcubature_rc_s {
+     unsigned fdim, dim;
+     size_t maxEval;
+     double reqAbsError, reqRelError;
+     error_norm norm;
+     int parallel, extrapolate;
+     int handoff; /* stop at RC_SELECT (for hcubature_threads) */
+     cubature_options opt; /* a copy of the options (all 0 if none) */
+
+     rule *r;
+     infwrap_data inf; /* change of variables for infinite limits */
+     stats_data sd;
+     cubature_stats *stats;
+     PROFILE_FIELD(c)
+
+     int stage, status;
+     const double *x; /* the points of the pending batch (RC_WAIT) */
+     size_t npt; /* # points in the pending batch */
+     double *fval; /* where the integrand values of the batch go */
+     double *val0; /* the integrand value for dim == 0 */
+     char *active; /* components still to be computed (NULL if unmasked) */
+
+     size_t numEval;
+     heap regions, small;
+     region *R; /* array of regions to evaluate */
+     size_t nR_alloc, nR, iR; /* R[0..nR-1] are not in the heaps */
+     unsigned nchunk; /* the pending batch is R[iR..iR+nchunk-1] */
+     esterr *ee;
+     double *pval, *perr; /* current estimates, for progress */
+     size_t progressEval; /* numEval at the last call of progress */
+     int stopped, timedout;
+     double t0;
+     epsilon_table *tab; /* fdim epsilon tables, if extrapolate */
+     esterr *ext; /* best extrapolated result so far */
+     unsigned maxlevel;
+     trace_data trace;
+};
+
+static rule *rc_make_rule(const hcubature_rc *s)
 {
-     return cubature(fdim, f, fdata, dim, xmin, xmax,
-		     maxEval, reqAbsError, reqRelError, norm, val, err, 1);
+     return s->dim == 1 ? make_rulegauss(s->dim, s->fdim, s->opt.rule1d)
+	  : make_rule75genzmalik(s->dim, s->fdim);
 }
 
+/* set up s to integrate over [xmin, xmax], starting with the
+   evaluation of all of the initial regions in a single batch; if this
+   fails, s->stage is RC_DONE with s->status == FAILURE */
+static void rc_init(hcubature_rc *s, unsigned fdim, unsigned dim,
+		    const double *xmin, const double *xmax,
+		    size_t maxEval, double reqAbsError, double reqRelError,
+		    error_norm norm, const cubature_options *opt,
+		    int parallel, int masked)
+{
+     hypercube *h;
+     size_t nh = 0, k;
+     unsigned j;
+
+     memset(s, 0, sizeof(hcubature_rc));
+     if (opt) s->opt = *opt;
+     s->fdim = fdim;
+     s->dim = dim;
+     s->maxEval = maxEval;
+     s->reqAbsError = reqAbsError;
+     s->reqRelError = reqRelError;
+     s->norm = fdim <= 1 ? ERROR_INDIVIDUAL : norm; /* norm is irrelevant */
+     s->parallel = parallel;
+     s->extrapolate = dim == 1 && s->opt.extrapolate;
+     s->stats = stats_begin(opt, &s->sd);
+     s->stage = RC_DONE;
+     s->status = FAILURE;
+
+     if (fdim == 0) { /* nothing to do */
+	  s->status = SUCCESS;
+	  return;
+     }
+     if (masked) {
+	  s->active = (char *) malloc(fdim);
+	  if (!s->active) return;
+	  memset(s->active, 1, fdim);
+     }
+     if (dim == 0) { /* trivial integration: a single point */
+	  s->val0 = (double *) malloc(sizeof(double) * fdim);
+	  if (!s->val0) return;
+	  s->x = s->fval = s->val0; /* x has no coordinates */
+	  s->npt = 1;
+	  s->stage = RC_WAIT;
+	  stats_batch_begin(&s->sd);
+	  return;
+     }
+     if (s->norm < 0 || s->norm > ERROR_LINF) return; /* invalid norm */
+
+     if (infwrap_init(&s->inf, dim, xmin, xmax)) return;
+     if (s->inf.kind) { /* transform infinite limits */
+	  xmin = s->inf.tmin;
+	  xmax = s->inf.tmax;
+     }
+     s->r = rc_make_rule(s);
+     if (!s->r) return;
+     if (s->opt.max_batch)
+	  s->r->max_regions = s->opt.max_batch > s->r->num_points
+	       ? (unsigned) (s->opt.max_batch / s->r->num_points) : 1;
+
+     s->regions = heap_alloc(1, fdim);
+     s->small = heap_alloc(0, fdim);
+     if (!s->regions.ee || !s->regions.items || !s->small.ee) return;
+
+     s->ee = (esterr *) malloc(sizeof(esterr) * fdim);
+     if (!s->ee) return;
+
+     if (s->opt.progress) {
+	  s->pval = (double *) malloc(sizeof(double) * fdim * 2);
+	  if (!s->pval) return;
+	  s->perr = s->pval + fdim;
+     }
+
+     if (s->extrapolate) {
+	  s->tab = (epsilon_table *) malloc(sizeof(epsilon_table) * fdim);
+	  s->ext = (esterr *) malloc(sizeof(esterr) * fdim);
+	  if (!s->tab || !s->ext) return;
+	  for (j = 0; j < fdim; ++j) {
+	       epsilon_init(s->tab + j);
+	       s->ext[j].val = 0;
+	       s->ext[j].err = HUGE_VAL;
+	  }
+     }
+
+     h = make_initial_hypercubes(dim, xmin, xmax, opt, &s->inf, &nh);
+     if (!h) return;
+     s->nR_alloc = nh < 2 ? 2 : nh;
+     s->R = (region *) malloc(sizeof(region) * s->nR_alloc);
+     for (k = 0; s->R && k < nh; ++k) {
+	  s->R[k] = make_region(h + k, fdim);
+	  if (!s->R[k].ee) break;
+	  s->nR = k + 1;
+     }
+     for (k = 0; k < nh; ++k) destroy_hypercube(&h[k]);
+     free(h);
+     if (s->nR < nh) return;
+
+     s->numEval = s->r->num_points * nh;
+     s->maxlevel = 1;
+     s->t0 = s->opt.maxTime > 0 ? stats_time() : 0;
+     trace_init(&s->trace, s->opt.trace, s->opt.trace_format, s->r);
+     PROFILE_START(s->stats, s->c);
+     s->stage = RC_EVAL;
+}
+
+/* With a masked integrand and ERROR_INDIVIDUAL, retire the active
+   components whose total errors satisfy the tolerance: from now on,
+   they are not computed by the integrand or the rule, and their
+   estimates are frozen (when a region is cut, its children inherit half
+   of its estimates, see rc_inherit), so they remain converged. */
+static void rc_retire(hcubature_rc *s)
+{
+     unsigned j;
+     int changed = 0;
+     if (!s->active || s->norm != ERROR_INDIVIDUAL) return;
+     for (j = 0; j < s->fdim; ++j)
+	  if (s->active[j]) {
+	       double val = s->regions.ee[j].val + s->small.ee[j].val;
+	       double err = s->regions.ee[j].err + s->small.ee[j].err;
+	       if (err <= s->reqAbsError || err <= fabs(val) * s->reqRelError) {
+		    s->active[j] = 0;
+		    changed = 1;
+	       }
+	  }
+     if (changed) { /* the retired errors no longer count */
+	  heap_rekey(&s->regions, s->active);
+	  heap_rekey(&s->small, s->active);
+     }
+}
+
+/* the children R[0] and R[1] of a region that was just cut inherit half
+   of its estimates for the retired components */
+static void rc_inherit(const hcubature_rc *s, region *R)
+{
+     unsigned j;
+     if (s->active)
+	  for (j = 0; j < s->fdim; ++j)
+	       if (!s->active[j]) {
+		    R[0].ee[j].val *= 0.5;
+		    R[0].ee[j].err *= 0.5;
+		    R[1].ee[j] = R[0].ee[j];
+	       }
+}
+
+/* whether the estimates ee satisfy the tolerance (only checking the
+   active components, since the retired ones already do) */
+static int rc_converged(const hcubature_rc *s, const esterr *ee)
+{
+     unsigned j;
+     if (s->active && s->norm == ERROR_INDIVIDUAL) {
+	  for (j = 0; j < s->fdim; ++j)
+	       if (s->active[j] && ee[j].err > s->reqAbsError
+		   && ee[j].err > fabs(ee[j].val) * s->reqRelError)
+		    return 0;
+	  return 1;
+     }
+     return converged(s->fdim, ee, s->reqAbsError, s->reqRelError, s->norm);
+}
+
+/* one iteration of the adaptive loop: unless we are done, choose the
+   next regions R[0..nR-1] to evaluate (stage RC_EVAL), or (if
+   extrapolating) just rearrange the heaps (stage RC_SELECT) */
+static int rc_select(hcubature_rc *s)
+{
+     rule *r = s->r;
+     unsigned fdim = s->fdim, j;
+     cubature_stats *stats = s->stats;
+     const cubature_options *opt = &s->opt;
+     heap *regions = &s->regions, *small = &s->small;
+     esterr *ee = s->ee, *ext = s->ext;
+     size_t maxEval = s->maxEval;
+     double t = 0; /* the elapsed time, if maxTime > 0 (< maxTime) */
+
+     if (maxEval && s->numEval >= maxEval) goto done;
+     if (stats)
+	  region_stats(stats, r, regions, small, s->nR_alloc, opt->compact);
+     PROFILE_LAP(stats, CUBATURE_PHASE_HEAP, s->c);
+     if (opt->maxTime > 0 && (t = stats_time() - s->t0) >= opt->maxTime) {
+	  s->timedout = 1;
+	  goto done;
+     }
+     if (opt->progress && s->numEval > s->progressEval) {
+	  s->progressEval = s->numEval;
+	  for (j = 0; j < fdim; ++j) {
+	       s->pval[j] = regions->ee[j].val + small->ee[j].val;
+	       s->perr[j] = regions->ee[j].err + small->ee[j].err;
+	       if (s->extrapolate && ext[j].err < s->perr[j]) {
+		    s->pval[j] = ext[j].val;
+		    s->perr[j] = ext[j].err;
+	       }
+	  }
+	  if (opt->progress(opt->progress_data, fdim, s->pval, s->perr,
+			    s->numEval, regions->n + small->n)) {
+	       s->stopped = 1;
+	       goto done;
+	  }
+     }
+     rc_retire(s);
+     if (s->extrapolate) {
+	  for (j = 0; j < fdim; ++j) {
+	       ee[j].val = regions->ee[j].val + small->ee[j].val;
+	       ee[j].err = regions->ee[j].err + small->ee[j].err;
+	  }
+	  if (rc_converged(s, ee))
+	       goto done;
+	  for (j = 0; j < fdim; ++j) ee[j].err = regions->ee[j].err;
+	  if (regions->n == 0 || rc_converged(s, ee)) {
+	       /* only the small regions have significant errors */
+	       for (j = 0; j < fdim; ++j) {
+		    double res, abserr;
+		    epsilon_append(s->tab + j, ee[j].val);
+		    epsilon_extrapolate(s->tab + j, &res, &abserr);
+		    if (abserr < ext[j].err) {
+			 ext[j].val = res;
+			 ext[j].err = abserr;
+		    }
+	       }
+	       if (rc_converged(s, ext))
+		    goto done;
+	       ++s->maxlevel; /* allow the small regions to be bisected */
+	       PROFILE_LAP(stats, CUBATURE_PHASE_CONVERGED, s->c);
+	       if (heap_push_many(regions, small->n, small->items))
+		    return FAILURE;
+	       small->n = 0;
+	       for (j = 0; j < fdim; ++j)
+		    small->ee[j].val = small->ee[j].err = 0;
+	       return SUCCESS;
+	  }
+     }
+     else if (rc_converged(s, regions->ee))
+	  goto done;
+     PROFILE_LAP(stats, CUBATURE_PHASE_CONVERGED, s->c);
+
+     if (s->parallel) { /* maximize potential parallelism */
+	  /* adapted from I. Gladwell, "Vectorization of one
+	     dimensional quadrature codes," pp. 230--238 in
+	     _Numerical Integration. Recent Developments,
+	     Software and Applications_, G. Fairweather and
+	     P. M. Keast, eds., NATO ASI Series C203, Dordrecht
+	     (1987), as described in J. M. Bull and
+	     T. L. Freeman, "Parallel Globally Adaptive
+	     Algorithms for Multi-dimensional Integration,"
+	     http://citeseerx.ist.psu.edu/viewdoc/summary?doi=10.1.1.42.6638
+	     (1994).
+
+	     Basically, this evaluates in one shot all regions
+	     that *must* be evaluated in order to reduce the
+	     error to the requested bound: the minimum set of
+	     largest-error regions whose errors push the total
+	     error over the bound.
+
+	     [Note: Bull and Freeman claim that the Gladwell
+	     approach is intrinsically inefficent because it
+	     "requires sorting", and propose an alternative
+	     algorithm that "only" requires three passes over the
+	     entire set of regions.  Apparently, they didn't
+	     realize that one could use a heap data structure, in
+	     which case the time to pop K biggest-error regions
+	     out of N is only O(K log N), much better than the
+	     O(N) cost of the Bull and Freeman algorithm if K <<
+	     N, and it is also much simpler.] */
+	  size_t maxBatch = 0; /* max numEval after this batch (0: none) */
+	  if (!s->extrapolate) /* else ee was computed above */
+	       for (j = 0; j < fdim; ++j) ee[j] = regions->ee[j];
+	  if (opt->maxTime > 0 && t > 0) /* the time left is > 0 */
+	       maxBatch = s->numEval + (size_t)
+		    ((opt->maxTime - t) / t * s->numEval) + 1;
+	  do {
+	       region *R;
+	       if (s->nR + 2 > s->nR_alloc) {
+		    R = (region *) realloc(s->R, (s->nR + 2) * 2
+					   * sizeof(region));
+		    if (!R) return FAILURE;
+		    s->R = R;
+		    s->nR_alloc = (s->nR + 2) * 2;
+	       }
+	       R = s->R + s->nR;
+	       R[0] = heap_pop(regions);
+	       for (j = 0; j < fdim; ++j) ee[j].err -= REGION_ERR(R, j);
+	       if (s->extrapolate && R[0].level >= s->maxlevel) {
+		    if (heap_push(small, R[0])) return FAILURE;
+	       }
+	       else {
+		    if (region_expand(R)) return FAILURE;
+		    trace_cut(&s->trace, R);
+		    if (cut_region(R, R+1)) return FAILURE;
+		    rc_inherit(s, R);
+		    s->numEval += r->num_points * 2;
+		    s->nR += 2;
+	       }
+	       if (rc_converged(s, ee)
+		   && s->nR * r->num_points >= opt->min_batch)
+		    break; /* other regions have small errs */
+	  } while (regions->n > 0 && (s->numEval < maxEval || !maxEval)
+		   && (s->numEval < maxBatch || !maxBatch));
+     }
+     else { /* minimize number of function evaluations */
+	  s->R[0] = heap_pop(regions); /* get worst region */
+	  if (s->extrapolate && s->R[0].level >= s->maxlevel)
+	       return heap_push(small, s->R[0]);
+	  if (region_expand(s->R)) return FAILURE;
+	  trace_cut(&s->trace, s->R);
+	  if (cut_region(s->R, s->R+1)) return FAILURE;
+	  rc_inherit(s, s->R);
+	  s->numEval += r->num_points * 2;
+	  s->nR = 2;
+     }
+     if (stats && s->nR > 0) stats->numSteps += 1; /* a batch of bisections */
+     s->iR = 0;
+     s->stage = RC_EVAL;
+     return SUCCESS;
+
+done:
+     PROFILE_LAP(stats, CUBATURE_PHASE_CONVERGED, s->c);
+     if (stats) {
+	  region_stats(stats, r, regions, small, s->nR_alloc, opt->compact);
+	  if (s->stopped)
+	       stats->reason = CUBATURE_STOPPED;
+	  else if (s->timedout)
+	       stats->reason = CUBATURE_MAXTIME;
+	  else if (maxEval && s->numEval >= maxEval)
+	       stats->reason = CUBATURE_MAXEVAL;
+     }
+     s->status = s->timedout ? CUBATURE_TIMEOUT : SUCCESS;
+     s->stage = RC_DONE;
+     return SUCCESS;
+}
+
+/* run the integration until the integrand is needed (stage RC_WAIT)
+   or we are done (stage RC_DONE) */
+static void rc_advance(hcubature_rc *s)
+{
+     rule *r = s->r;
+     size_t i, n;
+
+     while (s->stage == RC_EVAL || s->stage == RC_SELECT) {
+	  if (s->stage == RC_SELECT) {
+	       if (s->handoff) return;
+	       if (rc_select(s)) goto bad;
+	       continue;
+	  }
+	  if (s->iR < s->nR) { /* points of the next max_regions regions */
+	       n = s->nR - s->iR;
+	       if (r->max_regions && n > r->max_regions)
+		    n = r->max_regions;
+	       PROFILE_LAP(s->stats, CUBATURE_PHASE_HEAP, s->c);
+	       if (r->evalPoints(r, (unsigned) n, s->R + s->iR)) goto bad;
+	       s->nchunk = (unsigned) n;
+	       s->npt = n * r->num_points;
+	       s->x = r->pts;
+	       s->fval = r->vals;
+	       if (s->inf.kind
+		   && !(s->x = infwrap_points(&s->inf, s->npt, r->pts)))
+		    goto bad;
+	       PROFILE_LAP(s->stats, CUBATURE_PHASE_POINTS, s->c);
+	       s->stage = RC_WAIT;
+	       stats_batch_begin(&s->sd);
+	       return;
+	  }
+	  trace_batch(&s->trace, s->R, s->nR, s->numEval);
+	  for (i = 0; i < s->nR; ++i) {
+	       if (s->opt.compact) region_compact(&s->R[i]);
+	       s->R[i].errmax = region_errmax(&s->R[i], s->active);
+	  }
+	  n = s->nR;
+	  s->nR = 0; /* the regions now belong to the heap */
+	  if (heap_push_many(&s->regions, n, s->R)) goto bad;
+	  s->stage = RC_SELECT;
+     }
+     return;
+
+bad:
+     s->status = FAILURE;
+     s->stage = RC_DONE;
+}
+
+static int rc_submit(hcubature_rc *s, const double *fval)
+{
+     if (s->stage != RC_WAIT) return FAILURE;
+     stats_batch_end(&s->sd, s->npt);
+     if (fval != s->fval)
+	  memcpy(s->fval, fval, sizeof(double) * s->npt * s->fdim);
+     if (s->dim == 0) {
+	  s->status = SUCCESS;
+	  s->stage = RC_DONE;
+	  return SUCCESS;
+     }
+     if (s->inf.kind)
+	  infwrap_values(&s->inf, s->npt, s->fdim, s->fval);
+     s->r->evalValues(s->r, s->fdim, s->active, s->nchunk, s->R + s->iR);
+     s->iR += s->nchunk;
+     PROFILE_LAP(s->stats, CUBATURE_PHASE_RULE, s->c);
+     s->stage = RC_EVAL;
+     return SUCCESS;
+}
+
+/* Exact summation (for cubature_options.deterministic): an xsum keeps
+   the exact sum of the values added to it as a list of nonoverlapping
+   partial sums in increasing order of magnitude (Shewchuk's algorithm,
+   as in Python's math.fsum), and xsum_result rounds it correctly, so
+   that the result does not depend on the order of the terms.  (The
+   partials have distinct exponents, so there are at most about 40 of
+   them.)  Infinities and NaNs are summed separately. */
+
+#define XSUM_MAXP 64
+
+typedef struct {
+     unsigned n;
+     double p[XSUM_MAXP];
+     double special; /* sum of the non-finite terms */
+} xsum;
+
+#define NONFINITE(x) ((x) - (x) != 0)
+
+static void xsum_init(xsum *s)
+{
+     s->n = 0;
+     s->special = 0;
+}
+
+static void xsum_add(xsum *s, double x)
+{
+     unsigned i = 0, j;
+     if (NONFINITE(x)) {
+	  s->special += x;
+	  return;
+     }
+     for (j = 0; j < s->n; ++j) {
+	  double y = s->p[j], hi, lo;
+	  if (fabs(x) < fabs(y)) { double t = x; x = y; y = t; }
+	  hi = x + y;
+	  if (NONFINITE(hi)) { /* overflow: the result is infinite */
+	       s->special += hi;
+	       return;
+	  }
+	  lo = y - (hi - x);
+	  if (lo != 0) s->p[i++] = lo;
+	  x = hi;
+     }
+     s->p[i++] = x;
+     s->n = i;
+}
+
+static double xsum_result(const xsum *s)
+{
+     unsigned n = s->n;
+     double hi = 0, lo = 0;
+     if (s->special != 0 || NONFINITE(s->special)) return s->special;
+     if (n > 0) {
+	  hi = s->p[--n];
+	  while (n > 0) { /* sum from the top until the sum is inexact */
+	       double x = hi, y = s->p[--n];
+	       hi = x + y;
+	       lo = y - (hi - x);
+	       if (lo != 0) break;
+	  }
+	  /* round half-way cases correctly, from the sign of the rest */
+	  if (n > 0 && ((lo < 0 && s->p[n-1] < 0)
+			|| (lo > 0 && s->p[n-1] > 0))) {
+	       double y = lo * 2, x = hi + y;
+	       if (y == x - hi) hi = x;
+	  }
+     }
+     return hi;
+}
+
+/* store the results of s in val and err, free everything, and return
+   the status (FAILURE if the integration was not finished) */
+static int rc_finish(hcubature_rc *s, double *val, double *err)
+{
+     unsigned fdim = s->fdim, j;
+     size_t i;
+     int ret = s->stage == RC_DONE ? s->status : FAILURE;
+
+     if (ret != FAILURE) {
+	  if (s->dim == 0)
+	       for (j = 0; j < fdim; ++j) {
+		    val[j] = s->val0[j];
+		    err[j] = 0;
+	       }
+	  else { /* re-sum integral and errors */
+	       if (s->opt.deterministic) { /* exactly, in any order */
+		    xsum sv, se;
+		    for (j = 0; j < fdim; ++j) {
+			 xsum_init(&sv);
+			 xsum_init(&se);
+			 for (i = 0; i < s->regions.n; ++i) {
+			      region *R = &s->regions.items[i];
+			      xsum_add(&sv, REGION_VAL(R, j));
+			      xsum_add(&se, REGION_ERR(R, j));
+			 }
+			 for (i = 0; i < s->small.n; ++i) {
+			      region *R = &s->small.items[i];
+			      xsum_add(&sv, REGION_VAL(R, j));
+			      xsum_add(&se, REGION_ERR(R, j));
+			 }
+			 val[j] = xsum_result(&sv);
+			 err[j] = xsum_result(&se);
+		    }
+	       }
+	       else {
+		    for (j = 0; j < fdim; ++j) val[j] = err[j] = 0;
+		    for (i = 0; i < s->regions.n; ++i)
+			 for (j = 0; j < fdim; ++j) {
+			      val[j] += REGION_VAL(&s->regions.items[i], j);
+			      err[j] += REGION_ERR(&s->regions.items[i], j);
+			 }
+		    for (i = 0; i < s->small.n; ++i)
+			 for (j = 0; j < fdim; ++j) {
+			      val[j] += REGION_VAL(&s->small.items[i], j);
+			      err[j] += REGION_ERR(&s->small.items[i], j);
+			 }
+	       }
+	       if (s->extrapolate) /* use extrapolated results if better */
+		    for (j = 0; j < fdim; ++j)
+			 if (s->ext[j].err < err[j]) {
+			      val[j] = s->ext[j].val;
+			      err[j] = s->ext[j].err;
+			 }
+	  }
+     }
+     else if (s->dim > 0 && !s->r)
+	  for (j = 0; j < fdim; ++j) { /* could not create the rule */
+	       val[j] = 0;
+	       err[j] = HUGE_VAL;
+	  }
+
+     for (i = 0; i < s->regions.n; ++i) destroy_region(&s->regions.items[i]);
+     for (i = 0; i < s->small.n; ++i) destroy_region(&s->small.items[i]);
+     for (i = 0; i < s->nR; ++i) destroy_region(&s->R[i]);
+     /* printf("regions.nalloc = %d\n", regions.nalloc); */
+     free(s->pval);
+     free(s->ext);
+     free(s->tab);
+     free(s->ee);
+     heap_free(&s->small);
+     heap_free(&s->regions);
+     free(s->R);
+     free(s->val0);
+     free(s->active);
+     destroy_rule(s->r);
+     infwrap_free(&s->inf);
+     trace_free(&s->trace, s->numEval, ret);
+     stats_end(&s->sd, ret);
+     return ret;
+}
+
+hcubature_rc *hcubature_rc_begin(unsigned fdim, unsigned dim,
+				 const double *xmin, const double *xmax,
+				 size_t maxEval,
+				 double reqAbsError, double reqRelError,
+				 error_norm norm, const cubature_options *opt)
+{
+     hcubature_rc *s = (hcubature_rc *) malloc(sizeof(hcubature_rc));
+     if (s)
+	  rc_init(s, fdim, dim, xmin, xmax, maxEval,
+		  reqAbsError, reqRelError, norm, opt, 1, 0);
+     return s;
+}
+
+int hcubature_rc_next(hcubature_rc *s, const double **x, size_t *npt)
+{
+     rc_advance(s);
+     if (s->stage != RC_WAIT) return 0;
+     *x = s->x;
+     *npt = s->npt;
+     return 1;
+}
+
+int hcubature_rc_submit(hcubature_rc *s, const double *fval)
+{
+     return rc_submit(s, fval);
+}
+
+int hcubature_rc_end(hcubature_rc *s, double *val, double *err)
+{
+     int ret = rc_finish(s, val, err);
+     free(s);
+     return ret;
+}
+
+/***************************************************************************/
+/* Multithreaded refinement (see cubature_options.nthreads): once the
+   initial regions have been evaluated, they are dealt out to nthreads
+   workers, each of which owns a heap of regions and repeatedly bisects
+   the worst region that it can get, evaluating the integrand (which
+   must be thread-safe) on the two halves by itself.  There is no global
+   heap: a worker takes the top region of a randomly chosen victim
+   instead of its own if that region's error is more than twice as large
+   (or the top region of any other heap if its own is empty), which
+   spreads the work and keeps the workers refining regions that are
+   among the worst overall.  The regions created by a worker are
+   allocated by its thread, and thus (on first-touch NUMA systems) in
+   its local memory.
+
+   Nor is there a global lock that is taken by every step.  Each worker
+   accumulates the changes of the integral and error estimates made by
+   its steps (the two new regions minus their parent), and its
+   statistics, by itself, and folds them into the global totals only
+   every nw steps, under a lock that is held for this O(fdim) update and
+   the convergence test.  The test thus sees totals that lag behind by
+   up to about nw^2 steps, but since the errors of the regions almost
+   always decrease when they are bisected, this only makes us refine a
+   little more than necessary.  The evaluation count (for maxEval) and
+   the done flag are updated by every step, atomically where the
+   compiler supports it (see MT_ADD).  A worker that finds all of the
+   heaps empty sleeps until regions are pushed or we are done.  The
+   trace records, if any, are written under a lock of their own.  No
+   other lock is taken while a worker's lock or count_lock is held, and
+   idle_lock and lock are never held at the same time, so there is no
+   possibility of deadlock. */
+
+#if !defined(_WIN32)
+#  include <pthread.h>
+#  define HCUBATURE_THREADS 1
+#endif
+
+#ifdef HCUBATURE_THREADS
+
+/* MT_ADD(sh, p, n) atomically adds n to the size_t *p (in the mt_shared
+   *sh) and returns the new value, and MT_GET(sh, p) atomically returns
+   *p, with the GCC (>= 4.7) and clang builtins, or else under the
+   sh->count_lock mutex. */
+#if defined(__ATOMIC_SEQ_CST)
+#  define MT_ADD(sh, p, n) __atomic_add_fetch(p, n, __ATOMIC_SEQ_CST)
+#  define MT_GET(sh, p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#else
+#  define MT_ADD(sh, p, n) mt_add(sh, p, n)
+#  define MT_GET(sh, p) mt_add(sh, p, 0)
+#endif
+
+typedef struct mt_shared_s mt_shared;
+
+typedef struct {
+     mt_shared *sh;
+     pthread_t thread;
+     pthread_mutex_t lock; /* protects h */
+     heap h;
+     rule *r;
+     infwrap_data inf; /* copy of s->inf with private buffers */
+     stats_data sd; /* copy of s->sd, recording into st */
+     cubature_stats st; /* the statistics of our integrand calls */
+     esterr *parent; /* estimates of the region being bisected */
+     esterr *delta; /* changes of the totals since we last folded them */
+     size_t nsteps; /* # steps since then */
+     double *cut; /* its trace (see trace_save), if tracing */
+     unsigned long seed; /* for choosing victims */
+} mt_worker;
+
+struct mt_shared_s {
+     hcubature_rc *s; /* read-only, except under lock */
+     integrand_v f;
+     void *fdata;
+     mt_worker *w;
+     unsigned nw;
+     size_t numEval, nidle, done; /* only accessed via MT_ADD/MT_GET */
+     pthread_mutex_t count_lock; /* for MT_ADD without atomics */
+     pthread_mutex_t idle_lock; /* for waiting on wake */
+     pthread_cond_t wake; /* signalled when regions are pushed or done */
+     pthread_mutex_t trace_lock; /* protects s->trace */
+     pthread_mutex_t lock; /* protects everything below and s->stats */
+     esterr *ee; /* total integral and error estimates (as folded) */
+     size_t nregions;
+     int status;
+};
+
+#if !defined(__ATOMIC_SEQ_CST)
+static size_t mt_add(mt_shared *sh, size_t *p, size_t n)
+{
+     size_t v;
+     pthread_mutex_lock(&sh->count_lock);
+     v = *p += n;
+     pthread_mutex_unlock(&sh->count_lock);
+     return v;
+}
+#endif
+
+/* wake up the workers waiting in mt_wait */
+static void mt_wake(mt_shared *sh)
+{
+     pthread_mutex_lock(&sh->idle_lock);
+     pthread_cond_broadcast(&sh->wake);
+     pthread_mutex_unlock(&sh->idle_lock);
+}
+
+/* stop the integration with the given status and reason (unless it
+   was already stopped, but a FAILURE status always overrides) */
+static void mt_stop(mt_shared *sh, int status, cubature_reason reason)
+{
+     hcubature_rc *s = sh->s;
+     pthread_mutex_lock(&sh->lock);
+     if (!MT_GET(sh, &sh->done)) {
+	  sh->status = status;
+	  if (s->stats && reason != CUBATURE_CONVERGED)
+	       s->stats->reason = reason;
+	  MT_ADD(sh, &sh->done, 1);
+     }
+     else if (status == FAILURE)
+	  sh->status = FAILURE;
+     pthread_mutex_unlock(&sh->lock);
+     mt_wake(sh);
+}
+
+/* add the statistics b of a worker's integrand calls to a */
+static void mt_add_stats(cubature_stats *a, const cubature_stats *b)
+{
+     unsigned k;
+     a->numEval += b->numEval;
+     a->numCalls += b->numCalls;
+     for (k = 0; k < CUBATURE_STATS_NBATCH; ++k)
+	  a->batch_hist[k] += b->batch_hist[k];
+     if (b->max_batch > a->max_batch) a->max_batch = b->max_batch;
+     a->time_integrand += b->time_integrand;
+     for (k = 0; k < CUBATURE_NPHASES; ++k)
+	  a->phase_cycles[k] += b->phase_cycles[k];
+}
+
+/* fold the changes made by w into the totals, and check whether we
+   have converged (or are told to stop by the progress callback) */
+static void mt_fold(mt_worker *w)
+{
+     mt_shared *sh = w->sh;
+     hcubature_rc *s = sh->s;
+     const cubature_options *opt = &s->opt;
+     unsigned fdim = s->fdim, j;
+     cubature_reason reason = CUBATURE_CONVERGED;
+     int stop = 0;
+
+     pthread_mutex_lock(&sh->lock);
+     for (j = 0; j < fdim; ++j) {
+	  sh->ee[j].val += w->delta[j].val;
+	  sh->ee[j].err += w->delta[j].err;
+	  w->delta[j].val = w->delta[j].err = 0;
+     }
+     sh->nregions += w->nsteps;
+     if (s->stats) {
+	  s->stats->numSteps += w->nsteps;
+	  mt_add_stats(s->stats, &w->st);
+	  memset(&w->st, 0, sizeof(cubature_stats));
+     }
+     w->nsteps = 0;
+     if (MT_GET(sh, &sh->done))
+	  ;
+     else if (converged(fdim, sh->ee, s->reqAbsError, s->reqRelError,
+			s->norm))
+	  stop = 1;
+     else if (opt->progress) {
+	  for (j = 0; j < fdim; ++j) {
+	       s->pval[j] = sh->ee[j].val;
+	       s->perr[j] = sh->ee[j].err;
+	  }
+	  if (opt->progress(opt->progress_data, fdim, s->pval, s->perr,
+			    MT_GET(sh, &sh->numEval), sh->nregions)) {
+	       reason = CUBATURE_STOPPED;
+	       stop = 1;
+	  }
+     }
+     pthread_mutex_unlock(&sh->lock);
+     if (stop) mt_stop(sh, SUCCESS, reason);
+}
+
+/* the error of the worst region in w's heap, or -1 if it is empty */
+static double mt_top(mt_worker *w)
+{
+     double top;
+     pthread_mutex_lock(&w->lock);
+     top = w->h.n ? KEY(w->h.items[0]) : -1;
+     pthread_mutex_unlock(&w->lock);
+     return top;
+}
+
+/* pop the top region of w's heap into R, if its error is > errmin;
+   returns whether it did */
+static int mt_pop(mt_worker *w, double errmin, region *R)
+{
+     int ok;
+     pthread_mutex_lock(&w->lock);
+     ok = w->h.n && KEY(w->h.items[0]) > errmin;
+     if (ok) *R = heap_pop(&w->h);
+     pthread_mutex_unlock(&w->lock);
+     return ok;
+}
+
+/* get the next region to bisect into R, stealing if appropriate;
+   returns whether there was one */
+static int mt_take(mt_worker *w, region *R)
+{
+     mt_shared *sh = w->sh;
+     double top = mt_top(w);
+     unsigned i, k;
+     w->seed = (w->seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+     k = (w->seed >> 8) % sh->nw;
+     if (top >= 0)
+	  return (sh->w + k != w && mt_pop(sh->w + k, 2 * top, R))
+	       || mt_pop(w, -1, R);
+     for (i = 0; i < sh->nw; ++i, k = (k + 1) % sh->nw)
+	  if (mt_pop(sh->w + k, -1, R))
+	       return 1;
+     return 0;
+}
+
+/* wait until some heap is nonempty or we are done */
+static void mt_wait(mt_worker *w)
+{
+     mt_shared *sh = w->sh;
+     unsigned i;
+     pthread_mutex_lock(&sh->idle_lock);
+     MT_ADD(sh, &sh->nidle, 1);
+     while (!MT_GET(sh, &sh->done)) {
+	  for (i = 0; i < sh->nw && mt_top(sh->w + i) < 0; ++i)
+	       ;
+	  if (i < sh->nw) break;
+	  pthread_cond_wait(&sh->wake, &sh->idle_lock);
+     }
+     MT_ADD(sh, &sh->nidle, (size_t) -1);
+     pthread_mutex_unlock(&sh->idle_lock);
+}
+
+/* bisect R, evaluating both halves R[0..1] and pushing them into w's
+   heap, and update the counts and our changes of the totals */
+static int mt_step(mt_worker *w, region *R)
+{
+     mt_shared *sh = w->sh;
+     hcubature_rc *s = sh->s;
+     rule *r = w->r;
+     unsigned fdim = s->fdim, j;
+     size_t npt = 2 * r->num_points, numEval;
+     const double *x;
+     int i, ok;
+
+     for (j = 0; j < fdim; ++j) {
+	  w->parent[j].val = REGION_VAL(R, j);
+	  w->parent[j].err = REGION_ERR(R, j);
+     }
+     if (region_expand(R)) {
+	  destroy_region(R);
+	  return FAILURE;
+     }
+     if (w->cut) trace_save(&s->trace, R, w->cut);
+     if (cut_region(R, R+1)) {
+	  destroy_region(R);
+	  return FAILURE;
+     }
+     ok = !r->evalPoints(r, 2, R);
+     x = r->pts;
+     if (ok && w->inf.kind && !(x = infwrap_points(&w->inf, npt, r->pts)))
+	  ok = 0;
+     stats_batch_begin(&w->sd);
+     if (ok && sh->f(s->dim, npt, x, sh->fdata, fdim, r->vals))
+	  ok = 0;
+     if (!ok) {
+	  destroy_region(R);
+	  destroy_region(R+1);
+	  return FAILURE;
+     }
+     stats_batch_end(&w->sd, npt);
+     if (w->inf.kind) infwrap_values(&w->inf, npt, fdim, r->vals);
+     r->evalValues(r, fdim, NULL, 2, R);
+     if (w->cut) {
+	  pthread_mutex_lock(&sh->trace_lock);
+	  if (s->trace.f) {
+	       trace_write_cut(&s->trace, w->cut, R);
+	       ++s->trace.batch;
+	  }
+	  pthread_mutex_unlock(&sh->trace_lock);
+     }
+     for (i = 0; i < 2; ++i) {
+	  if (s->opt.compact) region_compact(&R[i]);
+	  R[i].errmax = region_errmax(&R[i], NULL);
+	  for (j = 0; j < fdim; ++j) {
+	       w->parent[j].val -= REGION_VAL(&R[i], j);
+	       w->parent[j].err -= REGION_ERR(&R[i], j);
+	  }
+     }
+     for (j = 0; j < fdim; ++j) {
+	  w->delta[j].val -= w->parent[j].val;
+	  w->delta[j].err -= w->parent[j].err;
+     }
+     pthread_mutex_lock(&w->lock);
+     for (i = 0; i < 2 && !heap_push(&w->h, R[i]); ++i)
+	  ;
+     pthread_mutex_unlock(&w->lock);
+     if (i < 2) { /* out of memory */
+	  for (; i < 2; ++i) destroy_region(&R[i]);
+	  return FAILURE;
+     }
+     /* (an atomic add rather than a load, which orders it after the
+	pushes for a worker that increments nidle before it checks the
+	heaps in mt_wait) */
+     if (MT_ADD(sh, &sh->nidle, 0)) mt_wake(sh);
+
+     w->nsteps += 1;
+     numEval = MT_ADD(sh, &sh->numEval, npt);
+     if (s->maxEval && numEval >= s->maxEval)
+	  mt_stop(sh, SUCCESS, CUBATURE_MAXEVAL);
+     else if (s->opt.maxTime > 0 && stats_time() - s->t0 >= s->opt.maxTime)
+	  mt_stop(sh, CUBATURE_TIMEOUT, CUBATURE_MAXTIME);
+     else if (w->nsteps >= sh->nw)
+	  mt_fold(w);
+     return SUCCESS;
+}
+
+static void *mt_work(void *w_)
+{
+     mt_worker *w = (mt_worker *) w_;
+     mt_shared *sh = w->sh;
+     region R[2];
+
+     while (!MT_GET(sh, &sh->done)) {
+	  if (!mt_take(w, R))
+	       mt_wait(w); /* for regions to steal */
+	  else if (mt_step(w, R))
+	       mt_stop(sh, FAILURE, CUBATURE_ERROR);
+     }
+     mt_fold(w); /* our last statistics */
+     return NULL;
+}
+
+/* Continue the integration s (at its first RC_SELECT stage) on nw
+   threads, calling f(fdata, ...) concurrently, until we are done.  All
+   of the regions are then back in s->regions, and s is RC_DONE. */
+static void hcubature_threads(hcubature_rc *s, unsigned nw,
+			      integrand_v f, void *fdata)
+{
+     mt_shared sh;
+     unsigned fdim = s->fdim, i, nstarted = 0;
+     size_t k, n;
+     heap_item *items;
+
+     sh.s = s; sh.f = f; sh.fdata = fdata;
+     sh.nw = nw;
+     sh.numEval = s->numEval;
+     sh.nidle = 0;
+     sh.nregions = s->regions.n;
+     sh.done = 0;
+     sh.status = FAILURE;
+     sh.ee = (esterr *) malloc(sizeof(esterr) * fdim);
+     sh.w = (mt_worker *) calloc(nw, sizeof(mt_worker));
+     if (!sh.ee || !sh.w) goto done;
+     memcpy(sh.ee, s->regions.ee, sizeof(esterr) * fdim);
+     for (i = 0; i < nw; ++i) {
+	  mt_worker *w = sh.w + i;
+	  w->sh = &sh;
+	  w->seed = i + 1;
+	  w->sd = s->sd;
+	  w->sd.stats = s->stats ? &w->st : NULL;
+	  w->inf = s->inf;
+	  w->inf.x = w->inf.jac = NULL; /* private buffers */
+	  w->inf.nx = 0;
+	  w->h = heap_alloc(s->regions.n / nw + 1, fdim);
+	  w->r = rc_make_rule(s);
+	  w->parent = (esterr *) malloc(sizeof(esterr) * fdim);
+	  w->delta = (esterr *) calloc(fdim, sizeof(esterr));
+	  if (!w->h.ee || !w->h.items || !w->r || !w->parent || !w->delta)
+	       goto done;
+	  if (s->trace.f) {
+	       w->cut = (double *) malloc(sizeof(double)
+					  * TRACE_CUTLEN(&s->trace));
+	       if (!w->cut) goto done;
+	  }
+     }
+     for (k = 0; s->regions.n > 0; ++k) /* deal out the initial regions */
+	  heap_push(&sh.w[k % nw].h, heap_pop(&s->regions)); /* can't fail */
+
+     sh.status = SUCCESS;
+     if (converged(fdim, sh.ee, s->reqAbsError, s->reqRelError, s->norm))
+	  sh.done = 1;
+     else if (s->maxEval && s->numEval >= s->maxEval) {
+	  if (s->stats) s->stats->reason = CUBATURE_MAXEVAL;
+	  sh.done = 1;
+     }
+     pthread_mutex_init(&sh.count_lock, NULL);
+     pthread_mutex_init(&sh.idle_lock, NULL);
+     pthread_cond_init(&sh.wake, NULL);
+     pthread_mutex_init(&sh.trace_lock, NULL);
+     pthread_mutex_init(&sh.lock, NULL);
+     for (i = 0; i < nw; ++i) pthread_mutex_init(&sh.w[i].lock, NULL);
+     for (i = 0; i < nw; ++i, ++nstarted)
+	  if (pthread_create(&sh.w[i].thread, NULL, mt_work, sh.w + i))
+	       break;
+     if (nstarted == 0) /* no threads: do all of the work ourselves */
+	  mt_work(sh.w);
+     for (i = 0; i < nstarted; ++i) pthread_join(sh.w[i].thread, NULL);
+     for (i = 0; i < nw; ++i) pthread_mutex_destroy(&sh.w[i].lock);
+     pthread_mutex_destroy(&sh.lock);
+     pthread_mutex_destroy(&sh.trace_lock);
+     pthread_cond_destroy(&sh.wake);
+     pthread_mutex_destroy(&sh.idle_lock);
+     pthread_mutex_destroy(&sh.count_lock);
+     s->numEval = sh.numEval;
+
+done:
+     if (sh.w) { /* give all of the regions back to s */
+	  for (i = 0, n = s->regions.n; i < nw; ++i) n += sh.w[i].h.n;
+	  items = (heap_item *) realloc(s->regions.items,
+					sizeof(heap_item) * (n ? n : 1));
+	  if (items) {
+	       s->regions.items = items;
+	       s->regions.nalloc = n ? n : 1;
+	  }
+	  for (i = 0; i < nw; ++i) {
+	       mt_worker *w = sh.w + i;
+	       while (w->h.n > 0) {
+		    region R = heap_pop(&w->h);
+		    if (items)
+			 heap_push(&s->regions, R); /* can't fail */
+		    else
+			 destroy_region(&R);
+	       }
+	       heap_free(&w->h);
+	       destroy_rule(w->r);
+	       free(w->inf.jac);
+	       free(w->parent);
+	       free(w->delta);
+	       free(w->cut);
+	  }
+	  if (!items) sh.status = FAILURE;
+     }
+     free(sh.w);
+     free(sh.ee);
+     if (s->stats)
+	  region_stats(s->stats, s->r, &s->regions, &s->small, s->nR_alloc,
+		       s->opt.compact);
+     s->status = sh.status;
+     s->stage = RC_DONE;
+}
+
+/* In deterministic mode (see cubature_options.deterministic), the
+   nthreads threads instead only share the integrand evaluations of
+   each batch of the usual (serial) algorithm: the batch is split into
+   one contiguous chunk of points per thread, so that the results do
+   not depend on the number of threads.  The pool of nthreads-1 helper
+   threads (the calling thread evaluates the first chunk) is started
+   once per integration, and pool_f is an integrand_v that wraps f. */
+
+typedef struct pool_thread_s pool_thread;
+
+typedef struct {
+     integrand_v f;
+     void *fdata;
+     unsigned n; /* # threads, including the caller (1 if no pool) */
+     pool_thread *threads; /* threads[1..n-1] are the helpers */
+     pthread_mutex_t lock;
+     pthread_cond_t go, done;
+     unsigned long gen; /* incremented for each new batch */
+     unsigned pending; /* # helpers still working on the batch */
+     int quit, failed;
+     unsigned ndim, fdim; /* the current batch: */
+     size_t npt, chunk;
+     const double *x;
+     double *fval;
+} pool_data;
+
+/* evaluate the i-th chunk of the current batch of d */
+static int pool_chunk(pool_data *d, unsigned i)
+{
+     size_t offset = d->chunk * i;
+     if (offset >= d->npt) return SUCCESS;
+     return d->f(d->ndim, d->npt - offset < d->chunk ? d->npt - offset
+		 : d->chunk, d->x + offset * d->ndim, d->fdata,
+		 d->fdim, d->fval + offset * d->fdim);
+}
+
+struct pool_thread_s {
+     pthread_t thread;
+     pool_data *d;
+     unsigned i; /* which chunk this thread evaluates */
+};
+
+static void *pool_work(void *a_)
+{
+     pool_thread *a = (pool_thread *) a_;
+     pool_data *d = a->d;
+     unsigned long gen = 0;
+     pthread_mutex_lock(&d->lock);
+     for (;;) {
+	  while (d->gen == gen && !d->quit)
+	       pthread_cond_wait(&d->go, &d->lock);
+	  if (d->quit) break;
+	  gen = d->gen;
+	  pthread_mutex_unlock(&d->lock);
+	  if (pool_chunk(d, a->i)) {
+	       pthread_mutex_lock(&d->lock);
+	       d->failed = 1;
+	  }
+	  else
+	       pthread_mutex_lock(&d->lock);
+	  if (--d->pending == 0)
+	       pthread_cond_signal(&d->done);
+     }
+     pthread_mutex_unlock(&d->lock);
+     return NULL;
+}
+
+static int pool_f(unsigned ndim, size_t npt, const double *x, void *d_,
+		  unsigned fdim, double *fval)
+{
+     pool_data *d = (pool_data *) d_;
+     int failed;
+     if (d->n < 2 || npt < 2 * d->n) /* not worth it */
+	  return d->f(ndim, npt, x, d->fdata, fdim, fval);
+     pthread_mutex_lock(&d->lock);
+     d->ndim = ndim; d->fdim = fdim;
+     d->npt = npt;
+     d->chunk = (npt + d->n - 1) / d->n;
+     d->x = x;
+     d->fval = fval;
+     d->failed = 0;
+     d->pending = d->n - 1;
+     d->gen += 1;
+     pthread_cond_broadcast(&d->go);
+     pthread_mutex_unlock(&d->lock);
+     failed = pool_chunk(d, 0);
+     pthread_mutex_lock(&d->lock);
+     while (d->pending > 0)
+	  pthread_cond_wait(&d->done, &d->lock);
+     failed = failed || d->failed;
+     pthread_mutex_unlock(&d->lock);
+     return failed ? FAILURE : SUCCESS;
+}
+
+/* start n-1 helper threads for pool_f(d, ...) to call f(fdata, ...);
+   if this fails, pool_f just calls f */
+static void pool_init(pool_data *d, unsigned n, integrand_v f, void *fdata)
+{
+     pool_thread *a;
+     unsigned i;
+     d->f = f;
+     d->fdata = fdata;
+     d->n = 1;
+     d->gen = 0;
+     d->quit = 0;
+     d->threads = a = (pool_thread *) malloc(sizeof(pool_thread) * n);
+     if (!a) return;
+     pthread_mutex_init(&d->lock, NULL);
+     pthread_cond_init(&d->go, NULL);
+     pthread_cond_init(&d->done, NULL);
+     for (i = 1; i < n; ++i) {
+	  a[i].d = d;
+	  a[i].i = i;
+	  if (pthread_create(&a[i].thread, NULL, pool_work, a + i)) break;
+	  d->n = i + 1;
+     }
+}
+
+static void pool_free(pool_data *d)
+{
+     unsigned i;
+     if (!d->threads) return;
+     pthread_mutex_lock(&d->lock);
+     d->quit = 1;
+     pthread_cond_broadcast(&d->go);
+     pthread_mutex_unlock(&d->lock);
+     for (i = 1; i < d->n; ++i) pthread_join(d->threads[i].thread, NULL);
+     pthread_cond_destroy(&d->done);
+     pthread_cond_destroy(&d->go);
+     pthread_mutex_destroy(&d->lock);
+     free(d->threads);
+     d->threads = NULL;
+     d->n = 1;
+}
+
+#endif /* HCUBATURE_THREADS */
+
+/* the usual driver of the state machine, calling f (or the masked
+   integrand fm, if it is non-NULL) for each batch */
+static int cubature(unsigned fdim, integrand_v f, integrand_vm fm,
+		    void *fdata,
+		    unsigned dim, const double *xmin, const double *xmax,
+		    size_t maxEval, double reqAbsError, double reqRelError,
+		    error_norm norm, const cubature_options *opt,
+		    double *val, double *err, int parallel)
+{
+     hcubature_rc s;
+#ifdef HCUBATURE_THREADS
+     pool_data pool;
+     pool.threads = NULL;
+#endif
+     rc_init(&s, fdim, dim, xmin, xmax, maxEval,
+	     reqAbsError, reqRelError, norm, opt, parallel, fm != NULL);
+#ifdef HCUBATURE_THREADS
+     if (s.opt.nthreads > 1 && parallel && !fm) {
+	  if (s.opt.deterministic) {
+	       pool_init(&pool, s.opt.nthreads, f, fdata);
+	       f = pool_f;
+	       fdata = &pool;
+	  }
+	  else
+	       s.handoff = !s.extrapolate;
+     }
+#endif
+     for (rc_advance(&s); s.stage == RC_WAIT; rc_advance(&s)) {
+	  if (fm ? fm(dim, s.npt, s.x, fdata, fdim, s.active, s.fval)
+	      : f(dim, s.npt, s.x, fdata, fdim, s.fval))
+	       break;
+	  rc_submit(&s, s.fval);
+     }
+#ifdef HCUBATURE_THREADS
+     if (s.stage == RC_SELECT) /* handed off after the initial regions */
+	  hcubature_threads(&s, s.opt.nthreads, f, fdata);
+     pool_free(&pool);
+#endif
+     return rc_finish(&s, val, err);
+}
+
+int hcubature_v(unsigned fdim, integrand_v f, void *fdata,
+                unsigned dim, const double *xmin, const double *xmax,
+                size_t maxEval, double reqAbsError, double reqRelError,
+                error_norm norm,
+                double *val, double *err)
+{
+     return cubature(fdim, f, NULL, fdata, dim, xmin, xmax,
+		     maxEval, reqAbsError, reqRelError, norm, NULL,
+		     val, err, 1);
+}
+
+int hcubature_ex(unsigned fdim, integrand_v f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err)
+{
+     if (opt && opt->nprocs > 1 && fdim > 0) {
+	  cubature_options o = *opt;
+	  proc_data d;
+	  int ret;
+	  o.nthreads = 0; /* the workers are not thread-safe */
+	  proc_init(&d, opt->nprocs, f, fdata, dim, fdim, opt->max_batch);
+	  ret = cubature(fdim, proc_f, NULL, &d, dim, xmin, xmax,
+			 maxEval, reqAbsError, reqRelError, norm, &o,
+			 val, err, 1);
+	  proc_free(&d);
+	  return ret;
+     }
+     return cubature(fdim, f, NULL, fdata, dim, xmin, xmax,
+		     maxEval, reqAbsError, reqRelError, norm, opt,
+		     val, err, 1);
+}
+
+int hcubature_vm(unsigned fdim, integrand_vm f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err)
+{
+     return cubature(fdim, NULL, f, fdata, dim, xmin, xmax,
+		     maxEval, reqAbsError, reqRelError, norm, opt,
+		     val, err, 1);
+}
+
+/***************************************************************************/
+/* Shared executor (see hcubature_executor in cubature.h): each
+   integration drives its own state machine, and hands each batch of
+   points to exec_eval as a request.  The requests are queued, and the
+   first waiting thread that finds the queue "full" (all running
+   integrations waiting, or at least min_batch points) while no combined
+   call is in progress becomes the combiner: it takes the whole queue,
+   gathers the points into one buffer, calls f, scatters the values back
+   to the requests, and wakes up their threads.  The combined buffers
+   are only touched by the current combiner.
+
+   This "flat combining" uses one mutex and condition variable rather
+   than a lock-free queue because every request has to block anyway
+   until a combined call (which is usually long) has returned its
+   values, so a thread sleeps on the condition variable, and thus takes
+   its mutex, for every request regardless.  And the test for a "full"
+   queue compares several counters (nwaiting, nactive, npending) that
+   must be consistent with the queue itself.  The lock is held only to
+   queue a request, to take the queue and to mark its requests done,
+   never during the call of f, so that it is taken a few times per
+   request, which is negligible next to the integrand. */
+
+#ifdef HCUBATURE_THREADS
+
+typedef struct exec_req_s {
+     struct exec_req_s *next;
+     const double *x;
+     size_t npt;
+     double *fval;
+     void *fdata;
+     int done, ret;
+} exec_req;
+
+struct hcubature_executor_s {
+     integrand_vs f;
+     unsigned fdim, dim;
+     size_t min_batch;
+     pthread_mutex_t lock; /* protects everything up to busy */
+     pthread_cond_t cond; /* signalled when requests are done, etc. */
+     unsigned nactive; /* # integrations running */
+     unsigned nwaiting; /* # integrations waiting for values */
+     exec_req *head, **tail; /* the queue of requests */
+     size_t npending; /* # points in the queue */
+     int busy; /* whether a combined call is in progress */
+     double *x, *fval; /* combined buffers of nalloc points */
+     size_t nalloc;
+     size_t *npts; /* segments of the combined call */
+     void **fdata;
+     unsigned nseg_alloc;
+};
+
+hcubature_executor *hcubature_executor_new(unsigned fdim, integrand_vs f,
+					   unsigned dim, size_t min_batch)
+{
+     hcubature_executor *e;
+     e = (hcubature_executor *) calloc(1, sizeof(hcubature_executor));
+     if (!e) return NULL;
+     e->f = f;
+     e->fdim = fdim;
+     e->dim = dim;
+     e->min_batch = min_batch;
+     e->tail = &e->head;
+     if (pthread_mutex_init(&e->lock, NULL)) {
+	  free(e);
+	  return NULL;
+     }
+     if (pthread_cond_init(&e->cond, NULL)) {
+	  pthread_mutex_destroy(&e->lock);
+	  free(e);
+	  return NULL;
+     }
+     return e;
+}
+
+void hcubature_executor_destroy(hcubature_executor *e)
+{
+     if (!e) return;
+     pthread_cond_destroy(&e->cond);
+     pthread_mutex_destroy(&e->lock);
+     free(e->x);
+     free(e->npts);
+     free(e->fdata);
+     free(e);
+}
+
+/* evaluate the requests reqs (taken from the queue) in one call of f */
+static int exec_combine(hcubature_executor *e, exec_req *reqs)
+{
+     unsigned dim = e->dim, fdim = e->fdim, nseg = 0;
+     size_t npt = 0, i;
+     exec_req *q;
+
+     for (q = reqs; q; q = q->next) {
+	  npt += q->npt;
+	  ++nseg;
+     }
+     if (npt > e->nalloc) {
+	  free(e->x);
+	  e->nalloc = 0;
+	  e->x = (double *) malloc(sizeof(double) * npt * (dim + fdim));
+	  if (!e->x) return FAILURE;
+	  e->fval = e->x + npt * dim;
+	  e->nalloc = npt;
+     }
+     if (nseg > e->nseg_alloc) {
+	  free(e->npts);
+	  free(e->fdata);
+	  e->nseg_alloc = 0;
+	  e->npts = (size_t *) malloc(sizeof(size_t) * nseg);
+	  e->fdata = (void **) malloc(sizeof(void *) * nseg);
+	  if (!e->npts || !e->fdata) return FAILURE;
+	  e->nseg_alloc = nseg;
+     }
+     for (q = reqs, i = 0, nseg = 0; q; q = q->next) {
+	  memcpy(e->x + i * dim, q->x, sizeof(double) * q->npt * dim);
+	  e->npts[nseg] = q->npt;
+	  e->fdata[nseg++] = q->fdata;
+	  i += q->npt;
+     }
+     if (e->f(dim, npt, e->x, nseg, e->npts, e->fdata, fdim, e->fval))
+	  return FAILURE;
+     for (q = reqs, i = 0; q; q = q->next) {
+	  memcpy(q->fval, e->fval + i * fdim, sizeof(double) * q->npt * fdim);
+	  i += q->npt;
+     }
+     return SUCCESS;
+}
+
+/* evaluate the integrand for the request r, possibly combined with the
+   requests of other integrations; returns its status */
+static int exec_eval(hcubature_executor *e, exec_req *r)
+{
+     r->next = NULL;
+     r->done = 0;
+     pthread_mutex_lock(&e->lock);
+     *e->tail = r;
+     e->tail = &r->next;
+     e->npending += r->npt;
+     e->nwaiting += 1;
+     while (!r->done) {
+	  if (!e->busy && e->head && (e->nwaiting == e->nactive
+				      || (e->min_batch
+					  && e->npending >= e->min_batch))) {
+	       exec_req *reqs = e->head, *q;
+	       unsigned n = 0;
+	       int ret;
+	       e->head = NULL;
+	       e->tail = &e->head;
+	       e->npending = 0;
+	       e->busy = 1;
+	       pthread_mutex_unlock(&e->lock);
+	       ret = exec_combine(e, reqs);
+	       pthread_mutex_lock(&e->lock);
+	       for (q = reqs; q; q = q->next, ++n) {
+		    q->ret = ret;
+		    q->done = 1;
+	       }
+	       e->nwaiting -= n;
+	       e->busy = 0;
+	       pthread_cond_broadcast(&e->cond);
+	  }
+	  else
+	       pthread_cond_wait(&e->cond, &e->lock);
+     }
+     pthread_mutex_unlock(&e->lock);
+     return r->ret;
+}
+
+int hcubature_executor_integrate(hcubature_executor *e, void *fdata,
+				 const double *xmin, const double *xmax,
+				 size_t maxEval,
+				 double reqAbsError, double reqRelError,
+				 error_norm norm, const cubature_options *opt,
+				 double *val, double *err)
+{
+     hcubature_rc s;
+     exec_req r;
+     int ret;
+
+     pthread_mutex_lock(&e->lock);
+     e->nactive += 1;
+     pthread_mutex_unlock(&e->lock);
+
+     rc_init(&s, e->fdim, e->dim, xmin, xmax, maxEval,
+	     reqAbsError, reqRelError, norm, opt, 1, 0);
+     r.fdata = fdata;
+     for (rc_advance(&s); s.stage == RC_WAIT; rc_advance(&s)) {
+	  r.x = s.x;
+	  r.npt = s.npt;
+	  r.fval = s.fval;
+	  if (exec_eval(e, &r)) break;
+	  rc_submit(&s, s.fval);
+     }
+     ret = rc_finish(&s, val, err);
+
+     pthread_mutex_lock(&e->lock);
+     e->nactive -= 1;
+     pthread_cond_broadcast(&e->cond); /* others may now be "full" */
+     pthread_mutex_unlock(&e->lock);
+     return ret;
+}
+
+#else /* !HCUBATURE_THREADS */
+
+hcubature_executor *hcubature_executor_new(unsigned fdim, integrand_vs f,
+					   unsigned dim, size_t min_batch)
+{
+     (void) fdim; (void) f; (void) dim; (void) min_batch;
+     return NULL;
+}
+
+void hcubature_executor_destroy(hcubature_executor *e)
+{
+     (void) e;
+}
+
+int hcubature_executor_integrate(hcubature_executor *e, void *fdata,
+				 const double *xmin, const double *xmax,
+				 size_t maxEval,
+				 double reqAbsError, double reqRelError,
+				 error_norm norm, const cubature_options *opt,
+				 double *val, double *err)
+{
+     (void) e; (void) fdata; (void) xmin; (void) xmax; (void) maxEval;
+     (void) reqAbsError; (void) reqRelError; (void) norm; (void) opt;
+     (void) val; (void) err;
+     return FAILURE;
+}
+
+#endif /* !HCUBATURE_THREADS */
+
 #include "vwrapper.h"
 
 int hcubature(unsigned fdim, integrand f, void *fdata,
@@ -1091,8 +3342,8 @@ int hcubature(unsigned fdim, integrand f, void *fdata,
      if (fdim == 0) return SUCCESS; /* nothing to do */
 
      d.f = f; d.fdata = fdata;
-     ret = cubature(fdim, fv, &d, dim, xmin, xmax,
-		    maxEval, reqAbsError, reqRelError, norm, val, err, 0);
+     ret = cubature(fdim, fv, NULL, &d, dim, xmin, xmax,
+		    maxEval, reqAbsError, reqRelError, norm, NULL, val, err, 0);
      return ret;
 }
 
@@ -0,0 +1,191 @@
+/* change of variables for integrals with infinite limits: each dimension
+   with an infinite limit is mapped onto a finite interval (as described
+   in the README), and the integrand is multiplied by the corresponding
+   Jacobian factor.
+
+     [a, +inf):   x = a + t/(1-t),   dx = dt / (1-t)^2,         0 <= t < 1
+     (-inf, b]:   x = b - t/(1-t),   dx = dt / (1-t)^2,         0 <= t < 1
+     (-inf,+inf): x = t/(1-t^2),     dx = (1+t^2)/(1-t^2)^2 dt, |t| < 1
+
+   Points at the singular endpoints of the t interval (which
+   pcubature evaluates but hcubature does not) are assigned an
+   integrand value of zero, which is the correct limit for any
+   integrand that vanishes faster than 1/x^2.  Limits in the
+   "wrong" order (xmin = +inf or xmax = -inf) flip the sign. */
+
+#define INF_NONE 0 /* finite limits: x = t */
+#define INF_UPPER 1 /* [a, +inf) */
+#define INF_LOWER 2 /* (-inf, b] */
+#define INF_BOTH 3 /* (-inf, +inf) */
+
+typedef struct infwrap_data_s {
+     unsigned dim;
+     int *kind; /* array of length dim of INF_xxx transformations */
+     double *tmin, *tmax; /* arrays of length dim: the new limits */
+     double *x0; /* array of length dim: the finite limit a or b, if any */
+     double sign; /* -1 if an odd number of dimensions are reversed */
+     double *x, *jac; /* buffers of x points and Jacobian factors */
+     size_t nx; /* length of jac (number of points) */
+} infwrap_data;
+
+static int isinf_limit(double x)
+{
+     return x == HUGE_VAL || x == -HUGE_VAL;
+}
+
+static void infwrap_free(infwrap_data *d)
+{
+     free(d->jac);
+     free(d->tmin);
+     free(d->kind);
+     d->tmin = d->x = d->jac = NULL;
+     d->kind = NULL;
+     d->nx = 0;
+}
+
+/* Set up d to integrate from xmin to xmax.  If all of the limits are
+   finite, d->kind is set to NULL and nothing else needs to be done.
+   Otherwise, the integral should be computed from d->tmin to d->tmax
+   instead, transforming each batch of points with infwrap_points and
+   the integrand values at them with infwrap_values, and infwrap_free(d)
+   must be called afterwards.  Returns FAILURE if we run out of memory. */
+static int infwrap_init(infwrap_data *d, unsigned dim,
+			const double *xmin, const double *xmax)
+{
+     unsigned i;
+
+     d->kind = NULL;
+     d->tmin = d->x = d->jac = NULL;
+     d->nx = 0;
+     for (i = 0; i < dim && !isinf_limit(xmin[i])
+		 && !isinf_limit(xmax[i]); ++i) ;
+     if (i == dim) return SUCCESS; /* nothing to transform */
+
+     d->kind = (int *) malloc(sizeof(int) * dim);
+     d->tmin = (double *) malloc(sizeof(double) * dim * 3);
+     if (!d->kind || !d->tmin) {
+	  infwrap_free(d);
+	  return FAILURE;
+     }
+     d->tmax = d->tmin + dim;
+     d->x0 = d->tmin + 2 * dim;
+     d->dim = dim;
+     d->sign = 1;
+     for (i = 0; i < dim; ++i) {
+	  double a = xmin[i], b = xmax[i];
+	  d->x0[i] = 0;
+	  if (!isinf_limit(a) && !isinf_limit(b)) {
+	       d->kind[i] = INF_NONE;
+	       d->tmin[i] = a;
+	       d->tmax[i] = b;
+	       continue;
+	  }
+	  if (a > b) { /* reversed limits */
+	       double c = a; a = b; b = c;
+	       d->sign = -d->sign;
+	  }
+	  if (a == b) { /* empty interval (both limits are +inf or -inf) */
+	       d->kind[i] = INF_NONE;
+	       d->tmin[i] = d->tmax[i] = 0;
+	  }
+	  else if (isinf_limit(a) && isinf_limit(b)) {
+	       d->kind[i] = INF_BOTH;
+	       d->tmin[i] = -1;
+	       d->tmax[i] = 1;
+	  }
+	  else {
+	       d->kind[i] = isinf_limit(b) ? INF_UPPER : INF_LOWER;
+	       d->x0[i] = isinf_limit(b) ? a : b;
+	       d->tmin[i] = 0;
+	       d->tmax[i] = 1;
+	  }
+     }
+     return SUCCESS;
+}
+
+/* Return the npt points t[npt*dim] transformed to the original
+   variables (in a buffer of d, which is overwritten by the next call),
+   and compute their Jacobian factors for infwrap_values, or return NULL
+   if we run out of memory. */
+static const double *infwrap_points(infwrap_data *d, size_t npt,
+				    const double *t)
+{
+     unsigned ndim = d->dim;
+     double *x, *jac;
+     size_t j;
+     unsigned i;
+
+     if (npt > d->nx) {
+	  free(d->jac);
+	  d->jac = (double *) malloc(sizeof(double) * npt * (ndim + 1));
+	  if (!d->jac) {
+	       d->nx = 0;
+	       d->x = NULL;
+	       return NULL;
+	  }
+	  d->x = d->jac + npt;
+	  d->nx = npt;
+     }
+     x = d->x; jac = d->jac;
+
+     /* transform the whole batch one dimension at a time */
+     memcpy(x, t, sizeof(double) * npt * ndim);
+     for (j = 0; j < npt; ++j) jac[j] = d->sign;
+     for (i = 0; i < ndim; ++i) {
+	  double x0 = d->x0[i];
+	  double *xi = x + i;
+	  switch (d->kind[i]) {
+	      case INF_NONE:
+		   break;
+	      case INF_UPPER:
+	      case INF_LOWER: {
+		   double s = d->kind[i] == INF_UPPER ? 1 : -1;
+		   for (j = 0; j < npt; ++j) {
+			double tj = xi[j*ndim], u = 1 - tj;
+			if (u > 0) {
+			     xi[j*ndim] = x0 + s * tj / u;
+			     jac[j] *= 1 / (u * u);
+			}
+			else { /* singular endpoint */
+			     xi[j*ndim] = x0;
+			     jac[j] = 0;
+			}
+		   }
+		   break;
+	      }
+	      case INF_BOTH:
+		   for (j = 0; j < npt; ++j) {
+			double tj = xi[j*ndim], u = (1 - tj) * (1 + tj);
+			if (u > 0) {
+			     xi[j*ndim] = tj / u;
+			     jac[j] *= (1 + tj * tj) / (u * u);
+			}
+			else { /* singular endpoint */
+			     xi[j*ndim] = 0;
+			     jac[j] = 0;
+			}
+		   }
+		   break;
+	  }
+     }
+
+     return x;
+}
+
+/* multiply the integrand values fval[npt*fdim] at the points of the
+   last infwrap_points call by their Jacobian factors */
+static void infwrap_values(const infwrap_data *d, size_t npt,
+			   unsigned fdim, double *fval)
+{
+     const double *jac = d->jac;
+     size_t j;
+     unsigned k;
+
+     for (j = 0; j < npt; ++j) {
+	  double *fv = fval + j * fdim;
+	  if (jac[j] == 0)
+	       for (k = 0; k < fdim; ++k) fv[k] = 0;
+	  else
+	       for (k = 0; k < fdim; ++k) fv[k] *= jac[j];
+     }
+}
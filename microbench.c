@@ -0,0 +1,86 @@
+/* Microbenchmarks of the internal kernels of hcubature and pcubature.
+ *
+ * Copyright (c) 2005-2013 Steven G. Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Usage: ./cubature_microbench [-r samples] [-t mintime] [-N maxexp]
+                                [-k h|p]
+
+   Each kernel is repeated until one sample takes at least mintime
+   seconds (default 0.01), and then sampled (default 11) times.  For
+   each kernel, the minimum and median time are printed in nanoseconds
+   per point and per region, along with the relative spread (median
+   absolute deviation / median) of the samples.  The priority-queue
+   benchmarks use heaps of 10^3 to 10^maxexp (default 10^7) regions. -k
+   restricts the benchmarks to the hcubature or pcubature kernels. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "microbench.h"
+
+static unsigned mb_nsamples = 11;
+static double mb_mintime = 0.01;
+unsigned mb_maxexp = 7;
+
+void mb_report(const char *kernel, const char *params,
+	       bench_kernel k, void *data, double npoints, double nregions)
+{
+     bench_stats s;
+     bench_measure(k, data, mb_nsamples, mb_mintime, &s);
+     printf("%-26s %-22s", kernel, params);
+     if (npoints > 0)
+	  printf(" %10.2f %10.2f", s.min * 1e9 / npoints,
+		 s.median * 1e9 / npoints);
+     else
+	  printf(" %10s %10s", "-", "-");
+     if (nregions > 0)
+	  printf(" %10.2f %10.2f", s.min * 1e9 / nregions,
+		 s.median * 1e9 / nregions);
+     else
+	  printf(" %10s %10s", "-", "-");
+     printf(" %7.2f%%\n", s.spread * 100);
+     fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+     int i, which = 0; /* 0 for both, 'h' or 'p' */
+
+     for (i = 1; i + 1 < argc; i += 2) {
+	  if (!strcmp(argv[i], "-r")) mb_nsamples = (unsigned) atoi(argv[i+1]);
+	  else if (!strcmp(argv[i], "-t")) mb_mintime = atof(argv[i+1]);
+	  else if (!strcmp(argv[i], "-N")) mb_maxexp = (unsigned) atoi(argv[i+1]);
+	  else if (!strcmp(argv[i], "-k")) which = argv[i+1][0];
+	  else break;
+     }
+     if (i < argc) {
+	  fprintf(stderr, "Usage: %s [-r samples] [-t mintime] [-N maxexp] "
+		  "[-k h|p]\n", argv[0]);
+	  return EXIT_FAILURE;
+     }
+
+     printf("%-26s %-22s %10s %10s %10s %10s %8s\n", "kernel", "params",
+	    "min/pt", "med/pt", "min/reg", "med/reg", "spread");
+     printf("%-26s %-22s %10s %10s %10s %10s %8s\n", "", "",
+	    "(ns)", "(ns)", "(ns)", "(ns)", "");
+     if (which != 'p') microbench_hcubature();
+     if (which != 'h') microbench_pcubature();
+     return EXIT_SUCCESS;
+}
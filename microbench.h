@@ -0,0 +1,22 @@
+/* Declarations shared by the microbenchmark program (microbench.c) and
+   its kernels (microbench_h.c and microbench_p.c, which #include the
+   hcubature and pcubature sources, respectively, in order to call
+   their internal static functions). */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include "benchutil.h"
+
+/* time k(data, n) and print a line of results with the time per
+   repetition divided by npoints and by nregions (omitted if zero) */
+void mb_report(const char *kernel, const char *params,
+	       bench_kernel k, void *data, double npoints, double nregions);
+
+/* maximum heap size is 10^mb_maxexp */
+extern unsigned mb_maxexp;
+
+void microbench_hcubature(void);
+void microbench_pcubature(void);
+
+#endif /* MICROBENCH_H */
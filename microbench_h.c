@@ -0,0 +1,211 @@
+/* Microbenchmarks of the internal kernels of hcubature: the priority
+   queue of regions, the generation of the Genz-Malik cubature points,
+   and the evaluation of the cubature rules (with a trivial integrand). */
+
+#include "hcubature.c"
+
+#include <stdio.h>
+
+#include "microbench.h"
+
+/* simple LCG for reproducible pseudo-random keys in [0,1) */
+static double mb_rand(unsigned long *state)
+{
+     *state = (*state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+     return *state / 2147483648.0;
+}
+
+/***************************************************************************/
+/* priority queue: pop the region with the largest error and push it back
+   with a new random error, at a fixed heap size, in batches of nbatch
+   regions as in rulecubature */
+
+typedef struct {
+     heap h;
+     size_t nbatch;
+     heap_item *batch;
+     unsigned long seed;
+} heap_data;
+
+static void heap_kernel(void *d_, size_t n)
+{
+     heap_data *d = (heap_data *) d_;
+     size_t i, j;
+     for (i = 0; i < n; ++i) {
+	  for (j = 0; j < d->nbatch; ++j) {
+	       d->batch[j] = heap_pop(&d->h);
+	       d->batch[j].errmax = mb_rand(&d->seed);
+	  }
+	  heap_push_many(&d->h, d->nbatch, d->batch);
+     }
+}
+
+static void bench_heap(void)
+{
+     static const size_t nbatches[2] = { 1, 64 };
+     esterr ee = { 0, 0 };
+     size_t N, i;
+     unsigned e, ib;
+     char params[64];
+
+     for (e = 3, N = 1000; e <= mb_maxexp; ++e, N *= 10) {
+	  heap_data d;
+	  heap_item hi;
+	  d.h = heap_alloc(1, 1);
+	  d.seed = 12345;
+	  hi.h.dim = 0; hi.h.data = NULL; hi.h.vol = 0;
+	  hi.splitDim = 0; hi.fdim = 1; hi.ee = &ee; hi.cee = NULL;
+	  hi.level = 0;
+	  for (i = 0; i < N; ++i) {
+	       hi.errmax = mb_rand(&d.seed);
+	       if (heap_push(&d.h, hi)) {
+		    fprintf(stderr, "out of memory for 10^%u regions\n", e);
+		    heap_free(&d.h);
+		    return;
+	       }
+	  }
+	  d.batch = (heap_item *) malloc(sizeof(heap_item) * 64);
+	  for (ib = 0; ib < 2; ++ib) {
+	       d.nbatch = nbatches[ib];
+	       sprintf(params, "n=1e%u batch=%u", e, (unsigned) d.nbatch);
+	       mb_report("heap_pop+heap_push", params, heap_kernel, &d,
+			 0, (double) d.nbatch);
+	  }
+	  free(d.batch);
+	  heap_free(&d.h);
+     }
+}
+
+/***************************************************************************/
+/* Genz-Malik point generation for one region */
+
+typedef struct {
+     unsigned dim;
+     double *pts, *p, *c, *r1, *r2;
+     int which;
+} points_data;
+
+static void points_kernel(void *d_, size_t n)
+{
+     points_data *d = (points_data *) d_;
+     size_t i;
+     for (i = 0; i < n; ++i)
+	  switch (d->which) {
+	      case 0: evalR_Rfs(d->pts, d->dim, d->p, d->c, d->r1); break;
+	      case 1: evalRR0_0fs(d->pts, d->dim, d->p, d->c, d->r1); break;
+	      default: evalR0_0fs4d(d->pts, d->dim, d->p, d->c, d->r1, d->r2);
+	  }
+}
+
+static void bench_points(void)
+{
+     static const unsigned dims[4] = { 2, 3, 5, 8 };
+     static const char *names[3] = { "evalR_Rfs", "evalRR0_0fs",
+				     "evalR0_0fs4d" };
+     unsigned id, i;
+     char params[64];
+
+     for (id = 0; id < 4; ++id) {
+	  points_data d;
+	  unsigned dim = dims[id];
+	  d.dim = dim;
+	  d.pts = (double *) malloc(sizeof(double) * dim * (numR_Rfs(dim)
+							    + 4*dim + 1));
+	  d.p = (double *) malloc(sizeof(double) * dim * 4);
+	  d.c = d.p + dim; d.r1 = d.c + dim; d.r2 = d.r1 + dim;
+	  for (i = 0; i < dim; ++i) {
+	       d.p[i] = d.c[i] = 0.5;
+	       d.r1[i] = 0.25; d.r2[i] = 0.125;
+	  }
+	  sprintf(params, "dim=%u", dim);
+	  for (d.which = 0; d.which < 3; ++d.which) {
+	       unsigned npts = d.which == 0 ? numR_Rfs(dim)
+		    : (d.which == 1 ? numRR0_0fs(dim) : 1 + 2*numR0_0fs(dim));
+	       mb_report(names[d.which], params, points_kernel, &d, npts, 1);
+	  }
+	  free(d.p);
+	  free(d.pts);
+     }
+}
+
+/***************************************************************************/
+/* evaluation of the cubature rules on batches of nR regions */
+
+static int trivial_integrand(unsigned ndim, size_t npt, const double *x,
+			     void *fdata, unsigned fdim, double *fval)
+{
+     size_t i;
+     (void) fdata; (void) fdim; /* fdim == 1 */
+     for (i = 0; i < npt; ++i) fval[i] = x[i * ndim];
+     return 0;
+}
+
+typedef struct {
+     rule *r;
+     unsigned nR;
+     region *R;
+} rule_data;
+
+static void rule_kernel(void *d_, size_t n)
+{
+     rule_data *d = (rule_data *) d_;
+     size_t i;
+     for (i = 0; i < n; ++i)
+	  if (!d->r->evalPoints(d->r, d->nR, d->R)) {
+	       trivial_integrand(d->r->dim, (size_t) d->nR * d->r->num_points,
+				 d->r->pts, NULL, 1, d->r->vals);
+	       d->r->evalValues(d->r, 1, NULL, d->nR, d->R);
+	  }
+}
+
+static void bench_rule(const char *name, rule *r, unsigned nR)
+{
+     rule_data d;
+     double xmin[32], xmax[32];
+     hypercube h;
+     unsigned i;
+     char params[64];
+
+     if (!r) return;
+     for (i = 0; i < r->dim; ++i) { xmin[i] = 0; xmax[i] = 1; }
+     h = make_hypercube_range(r->dim, xmin, xmax);
+     d.r = r; d.nR = nR;
+     d.R = (region *) malloc(sizeof(region) * nR);
+     for (i = 0; i < nR; ++i) d.R[i] = make_region(&h, 1);
+     sprintf(params, "dim=%u nR=%u", r->dim, nR);
+     mb_report(name, params, rule_kernel, &d,
+	       (double) nR * r->num_points, nR);
+     for (i = 0; i < nR; ++i) destroy_region(&d.R[i]);
+     free(d.R);
+     destroy_hypercube(&h);
+}
+
+static void bench_rules(void)
+{
+     static const unsigned dims[4] = { 2, 3, 5, 8 };
+     static const unsigned nRs[2] = { 2, 64 };
+     static const char *gknames[4] = {
+	  "rulegauss_evalError(15)", "rulegauss_evalError(21)",
+	  "rulegauss_evalError(31)", "rulegauss_evalError(61)" };
+     unsigned id, iR, which;
+
+     for (id = 0; id < 4; ++id)
+	  for (iR = 0; iR < 2; ++iR) {
+	       rule *r = make_rule75genzmalik(dims[id], 1);
+	       bench_rule("rule75genzmalik_evalError", r, nRs[iR]);
+	       destroy_rule(r);
+	  }
+     for (which = HCUBATURE_GK15; which <= HCUBATURE_GK61; ++which)
+	  for (iR = 0; iR < 2; ++iR) {
+	       rule *r = make_rulegauss(1, 1, (hcubature_rule1d) which);
+	       bench_rule(gknames[which], r, nRs[iR]);
+	       destroy_rule(r);
+	  }
+}
+
+void microbench_hcubature(void)
+{
+     bench_heap();
+     bench_points();
+     bench_rules();
+}
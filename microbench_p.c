@@ -0,0 +1,123 @@
+/* Microbenchmarks of the internal kernels of pcubature: the generation
+   and (trivial) evaluation of the points of a tensor-product grid by
+   grid_points, and the summation of the cached values by eval and
+   eval_integral. */
+
+#include "pcubature.c"
+
+#include <stdio.h>
+
+#include "microbench.h"
+
+static int trivial_integrand(unsigned ndim, size_t npt, const double *x,
+			     void *fdata, unsigned fdim, double *fval)
+{
+     size_t i;
+     (void) fdata; (void) fdim; /* fdim == 1 */
+     for (i = 0; i < npt; ++i) fval[i] = x[i * ndim];
+     return 0;
+}
+
+typedef struct {
+     const nested_rule *r;
+     unsigned dim, m[MAXDIM];
+     double xmin[MAXDIM], xmax[MAXDIM], V;
+     double *val, *buf;
+     size_t nval, nbuf;
+     valcache vc;
+} grid_data;
+
+static void cacheval_kernel(void *d_, size_t n)
+{
+     grid_data *d = (grid_data *) d_;
+     size_t i, npt;
+     for (i = 0; i < n; ++i) {
+	  grid_iter g;
+	  size_t vali = 0;
+	  grid_init(&g, d->r, d->m, d->dim, d->dim, d->xmin, d->xmax);
+	  while ((npt = grid_points(&g, d->buf, d->nbuf)) > 0) {
+	       trivial_integrand(d->dim, npt, d->buf, NULL, 1, d->val + vali);
+	       vali += npt;
+	  }
+     }
+}
+
+static void eval_kernel(void *d_, size_t n)
+{
+     grid_data *d = (grid_data *) d_;
+     double val = 0;
+     size_t i;
+     for (i = 0; i < n; ++i)
+	  eval(d->r, d->m, d->dim, d->val, d->m, d->dim, 1, NULL, 0, d->dim, 0,
+	       d->V, &val);
+     d->V += val * 1e-300; /* don't let the compiler discard val */
+}
+
+static void eval_integral_kernel(void *d_, size_t n)
+{
+     grid_data *d = (grid_data *) d_;
+     double val, err, val1, derr[MAXDIM];
+     unsigned mi;
+     size_t i;
+     for (i = 0; i < n; ++i)
+	  eval_integral(d->vc, d->r, d->m, 1, NULL, 0, d->dim, d->V,
+			&mi, &val, &err, &val1, derr);
+     d->V += val * 1e-300; /* don't let the compiler discard val */
+}
+
+static void bench_grid(const char *rname, const nested_rule *r,
+		       unsigned dim, unsigned m)
+{
+     grid_data d;
+     unsigned i;
+     char params[64];
+
+     if (r->init(m)) return;
+     d.r = r; d.dim = dim; d.V = 1;
+     for (i = 0; i < dim; ++i) {
+	  d.m[i] = m;
+	  d.xmin[i] = 0; d.xmax[i] = 1;
+	  d.V *= 0.5;
+     }
+     d.nval = num_cacheval(r, d.m, dim, dim);
+     /* pcubature_buf grows its buffer to hold all of the new points of
+	a refinement step, so the whole grid is evaluated in one batch */
+     d.nbuf = d.nval;
+     d.val = (double *) malloc(sizeof(double) * d.nval);
+     d.buf = (double *) malloc(sizeof(double) * d.nbuf * dim);
+     d.vc.ncache = 1;
+     d.vc.c = (cacheval *) malloc(sizeof(cacheval));
+     if (!d.val || !d.buf || !d.vc.c) {
+	  fprintf(stderr, "out of memory\n");
+	  exit(EXIT_FAILURE);
+     }
+     memcpy(d.vc.c->m, d.m, sizeof(unsigned) * dim);
+     d.vc.c->mi = dim;
+     d.vc.c->val = d.val;
+     d.vc.c->own_val = 0;
+
+     sprintf(params, "%s dim=%u m=%u", rname, dim, m);
+     mb_report("grid_points", params, cacheval_kernel, &d,
+	       (double) d.nval, 0);
+     mb_report("eval", params, eval_kernel, &d, (double) d.nval, 0);
+     mb_report("eval_integral", params, eval_integral_kernel, &d,
+	       (double) d.nval, 0);
+
+     free(d.vc.c);
+     free(d.buf);
+     free(d.val);
+}
+
+void microbench_pcubature(void)
+{
+     /* grid sizes from about 10 to 10^5 points */
+     static const unsigned dims[4] = { 1, 2, 3, 4 };
+     static const unsigned ms[4][2] = { {3, 7}, {3, 5}, {2, 3}, {1, 2} };
+     unsigned id, im;
+
+     for (id = 0; id < 4; ++id)
+	  for (im = 0; im < 2; ++im) {
+	       bench_grid("cc", &clencurt_rules, dims[id], ms[id][im]);
+	       bench_grid("gp", &patterson_rules, dims[id], ms[id][im]);
+	  }
+}
@@ -24,6 +24,13 @@
    Genz-Malik for smooth integrands lacking strongly-localized
    features, in moderate dimensions. */
 
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#  define _POSIX_C_SOURCE 200112L /* for clock_gettime in statswrapper.h */
+#endif
+#if defined(CUBATURE_PROFILE) && defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE /* for syscall in profile.h */
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -34,19 +41,1098 @@
 #define SUCCESS 0
 #define FAILURE 1
 
-/* pre-generated Clenshaw-Curtis rules and weights */
-#include "clencurt.h"
+#include "cpudispatch.h"
 
 /* no point in supporting very high dimensional integrals here */
 #define MAXDIM (20U)
 
 /***************************************************************************/
-/* For adaptive cubature, thanks to the nesting of the C-C rules, we
+/* Clenshaw-Curtis quadrature rules on [-1,1] with
+
+        3, 5, 9, ..., 2^(m+1)+1, ...
+
+   points, for m = 0, 1, ..., CLENCURT_MAXM.  The rule for a given m is
+   computed the first time that it is needed, and is then cached (and
+   shared by all subsequent integrations) for the lifetime of the program.
+
+   Because the rules are mirror-symmetric, we only need to store the 2^m
+   points x > 0 and 2^m+1 weights for each rule.  Furthermore, the rules
+   are nested, so we store the points in a permuted order P_m
+   corresponding to a usage where we first evaluate m=0, then m=1, etc.
+   until it is converged: the first 2^(m-1) points of the m rule are
+   the points of the m-1 rule.  In particular, for the m rule
+
+       x[j] = cos(pi * P_m(j) / 2^(m+1))
+
+   for j = 0,1,...,2^m-1, where P_m is the permutation
+
+      P_0(j) = j
+      P_m(j) = 2 * P_{m-1}(j)          if j < 2^(m-1)
+               2 * (j - 2^(m-1)) + 1   otherwise
+
+   (the point x=0 is not stored and must be specially handled so that
+   it is not counted twice).  The 2^m+1 weights w are stored in the same
+   order as x, except that w[0] is the weight for x=0 and w[j+1] is the
+   weight for +/- x[j]. */
+
+/* the number of points 2^(m+1)+1 must fit in an int */
+#define CLENCURT_MAXM 29U
+
+/* the default limit of the degree (see cubature_options.maxm) */
+#define PCUBATURE_MAXM 19U
+
+static const double *clencurt_x[CLENCURT_MAXM + 1]; /* length 2^m */
+static const double *clencurt_w[CLENCURT_MAXM + 1]; /* length 2^m + 1 */
+static unsigned clencurt_n = 0; /* rules 0..clencurt_n-1 are computed */
+
+/* the cache is global, so it must be protected by a lock in case
+   pcubature is called from multiple threads; the rules are generated
+   outside of the lock, and then published under it by incrementing
+   clencurt_n.  Where the compiler has atomic builtins (GCC >= 4.7,
+   clang), CLENCURT_READY(M) checks whether the rules 0..M have been
+   published without taking the lock. */
+#if defined(__ATOMIC_ACQUIRE)
+#  define CLENCURT_READY(M) \
+     (__atomic_load_n(&clencurt_n, __ATOMIC_ACQUIRE) > (M))
+#  define CLENCURT_PUBLISH(n) \
+     __atomic_store_n(&clencurt_n, n, __ATOMIC_RELEASE)
+#else
+#  define CLENCURT_READY(M) 0
+#  define CLENCURT_PUBLISH(n) (clencurt_n = (n))
+#endif
+#if defined(_WIN32)
+#  include <windows.h>
+static volatile LONG clencurt_lock = 0;
+#  define CLENCURT_LOCK() \
+     while (InterlockedExchange(&clencurt_lock, 1)) Sleep(0)
+#  define CLENCURT_UNLOCK() InterlockedExchange(&clencurt_lock, 0)
+#else
+#  include <pthread.h>
+static pthread_mutex_t clencurt_lock = PTHREAD_MUTEX_INITIALIZER;
+#  define CLENCURT_LOCK() pthread_mutex_lock(&clencurt_lock)
+#  define CLENCURT_UNLOCK() pthread_mutex_unlock(&clencurt_lock)
+#endif
+
+#define K_PI 3.1415926535897932384626433832795028841971
+
+static size_t clencurt_P(unsigned m, size_t j)
+{
+     size_t shift = 0;
+     if (j == 0) return 0;
+     while (j < ((size_t) 1 << (m - 1))) { /* j is a point of rule m-1 */
+	  --m;
+	  ++shift;
+     }
+     return (2 * (j - ((size_t) 1 << (m - 1))) + 1) << shift;
+}
+
+/* the butterflies of the stage of length L of a radix-2 FFT of z[n],
+   given the stage's twiddle factors t[k] = exp(-2 pi i k / L), k < L/2,
+   for each block of L elements in turn */
+static void fft_stage(double *z, size_t n, size_t L, const double *t)
+{
+     size_t h = L / 2, i, k;
+     for (i = 0; i < n; i += L) {
+	  double *a = z + 2*i, *b = a + 2*h;
+	  for (k = 0; k < h; ++k) {
+	       double tr = t[2*k] * b[2*k] - t[2*k+1] * b[2*k+1];
+	       double ti = t[2*k] * b[2*k+1] + t[2*k+1] * b[2*k];
+	       b[2*k] = a[2*k] - tr; b[2*k+1] = a[2*k+1] - ti;
+	       a[2*k] += tr; a[2*k+1] += ti;
+	  }
+     }
+}
+
+#define FFT_BLOCK 4096 /* # elements (64kB) that stay in cache together */
+
+/* in-place radix-2 (decimation in time) complex FFT of length n (a
+   power of 2) of z, which holds the real and imaginary parts of each
+   element in consecutive entries.  The stages of length <= FFT_BLOCK
+   are done for one block of FFT_BLOCK elements at a time, while it is
+   in the cache.  The twiddle factors exp(-2 pi i k / L), k < L/2, of
+   the stage of length L are contiguous in a table w (at w + L - 2):
+   the last stage's are computed from a quarter period of cos/sin, and
+   each other stage's are every other one of the next stage's. */
+static int fft(double *z, size_t n)
+{
+     size_t i, j, k, L, h, B, q = n / 4;
+     double *w;
+
+     if (n < 2) return SUCCESS;
+     w = (double *) malloc(sizeof(double) * 2 * n);
+     if (!w) return FAILURE;
+     w[n-2] = 1; w[n-1] = 0; /* (in case n == 2) */
+     for (k = 0; k < q; ++k) {
+	  double c = cos((2 * K_PI / n) * k), s = sin((2 * K_PI / n) * k);
+	  double *t = w + n - 2;
+	  t[2*k] = c; t[2*k+1] = -s;
+	  t[2*(k+q)] = -s; t[2*(k+q)+1] = -c; /* times -i */
+     }
+     for (h = n / 4; h >= 1; h /= 2)
+	  for (k = 0; k < h; ++k) {
+	       w[2*(h-1+k)] = w[2*(2*h-1+2*k)];
+	       w[2*(h-1+k)+1] = w[2*(2*h-1+2*k)+1];
+	  }
+
+     for (i = 1, j = 0; i < n; ++i) { /* bit-reversal permutation */
+	  size_t bit = n >> 1;
+	  for (; j & bit; bit >>= 1) j ^= bit;
+	  j ^= bit;
+	  if (i < j) {
+	       double t;
+	       t = z[2*i]; z[2*i] = z[2*j]; z[2*j] = t;
+	       t = z[2*i+1]; z[2*i+1] = z[2*j+1]; z[2*j+1] = t;
+	  }
+     }
+     B = n < FFT_BLOCK ? n : FFT_BLOCK;
+     for (i = 0; i < n; i += B)
+	  for (L = 2; L <= B; L <<= 1)
+	       fft_stage(z + 2*i, B, L, w + L - 2);
+     for (L = 2 * B; L <= n; L <<= 1)
+	  fft_stage(z, n, L, w + L - 2);
+     free(w);
+     return SUCCESS;
+}
+
+/* The general principle is this: in Fejer and Clenshaw-Curtis quadrature,
+   we take our function f(x) evaluated at f(cos(theta)), discretize
+   it in theta to a vector f of points, compute the DCT, then multiply
+   by some coefficients c (the integrals of cos(theta) * sin(theta)).
+   In matrix form, given the DCT matrix D, this is:
+
+             c' * D * f = (D' * c)' * f = w' * f
+
+   where w is the vector of weights for each function value, and since
+   the transpose D' of a DCT-I is another DCT-I, computing w is just
+   another DCT-I.  Because the odd-frequency DCT components of f integrate
+   to zero, every other entry in c is zero, so for 2n+1 points we only
+   need a DCT-I of size n+1, which we compute from the FFT of its even
+   extension (of length 2n).
+
+   This computes the weights w[j] for the points cos(pi * j / 2n),
+   j = 0,1,...,n, where n = 2^m. */
+static int clencurt_weights(unsigned m, double *w)
+{
+     size_t n = (size_t) 1 << m, j;
+     double *z = (double *) malloc(sizeof(double) * 4 * n);
+     if (!z) return FAILURE;
+     for (j = 0; j <= n; ++j) {
+	  z[2*j] = 1.0 / (n * (1.0 - 4.0 * j * j));
+	  z[2*j+1] = 0;
+	  if (j > 0 && j < n) {
+	       z[2*(2*n-j)] = z[2*j];
+	       z[2*(2*n-j)+1] = 0;
+	  }
+     }
+     if (fft(z, 2 * n)) {
+	  free(z);
+	  return FAILURE;
+     }
+     for (j = 0; j <= n; ++j) w[j] = z[2*j];
+     w[0] *= 0.5;
+     free(z);
+     return SUCCESS;
+}
+
+/* compute the points and weights of the rule m, in newly allocated
+   arrays *x and *w */
+static int clencurt_rule(unsigned m, double **x, double **w)
+{
+     size_t n = (size_t) 1 << m, j;
+     *x = (double *) malloc(sizeof(double) * (2*n + 1));
+     *w = (double *) malloc(sizeof(double) * (n + 1));
+     if (!*x || !*w || clencurt_weights(m, *x)) {
+	  free(*x); free(*w);
+	  return FAILURE;
+     }
+     /* (using x as scratch space for the unpermuted weights) */
+     (*w)[0] = (*x)[n];
+     for (j = 0; j < n; ++j)
+	  (*w)[j+1] = (*x)[clencurt_P(m, j)];
+     for (j = 0; j < n; ++j)
+	  (*x)[j] = cos(K_PI * clencurt_P(m, j) / (2.0 * n));
+     return SUCCESS;
+}
+
+/* make sure that the rules for m = 0,1,...,M are available */
+static int clencurt_init(unsigned M)
+{
+     if (M > CLENCURT_MAXM) return FAILURE;
+     if (CLENCURT_READY(M)) return SUCCESS;
+     for (;;) {
+	  unsigned m;
+	  double *x, *w;
+	  CLENCURT_LOCK();
+	  m = clencurt_n;
+	  CLENCURT_UNLOCK();
+	  if (m > M) return SUCCESS;
+	  if (clencurt_rule(m, &x, &w)) return FAILURE;
+	  CLENCURT_LOCK();
+	  if (clencurt_n == m) { /* (else another thread published it) */
+	       clencurt_x[m] = x;
+	       clencurt_w[m] = w;
+	       CLENCURT_PUBLISH(m + 1);
+	       x = w = NULL;
+	  }
+	  CLENCURT_UNLOCK();
+	  free(x); free(w);
+     }
+}
+
+/***************************************************************************/
+/* Gauss-Patterson quadrature rules on [-1,1] with
+
+        3, 7, 15, ..., 2^(m+2)-1, ...
+
+   points, for m = 0, 1, ..., PATTERSON_MAXM: the 3-point Gauss-Legendre
+   rule followed by its successive optimal (Kronrod-Patterson) extensions,
+   each of which adds 2^(m+1) points to the previous rule.  See:
+
+         T. N. L. Patterson, "The optimum addition of points to
+         quadrature formulae," Math. Comp. 22, 847-856 (1968).
+
+   The rule of degree m is exact for polynomials of degree 3 * 2^(m+1) - 1
+   (vs. 2^(m+1) + 1 for Clenshaw-Curtis with almost the same number of
+   points), but the rules only exist up to 511 points.
+
+   The points and weights are stored in the same way as for clencurt_x
+   and clencurt_w above, except that the rule of degree m has 2^(m+1)-1
+   points x > 0 (the first 2^m-1 of which are the points of the m-1 rule),
+   and so all of the rules can share the same array of points.  They
+   were computed in 140-digit arithmetic. */
+
+#define PATTERSON_MAXM 7U
+
+static const double patterson_xs[255] = {
+     0.774596669241483377035853079956480,
+     0.960491268708020283423507092629080,
+     0.434243749346802558002071502844628,
+     0.993831963212755022208512841307951,
+     0.888459232872256998890420167258503,
+     0.621102946737226402940687443816595,
+     0.223386686428966881628203986843998,
+     0.999098124967667597662226062412998,
+     0.981531149553740106867361888547026,
+     0.929654857429740056670125725933374,
+     0.836725938168868735502753818110222,
+     0.702496206491527078609800156008001,
+     0.531319743644375623972103438052469,
+     0.331135393257976833092640782248747,
+     0.112488943133186625745843327560319,
+     0.999872888120357611937956782213944,
+     0.997206259372221959076452532976228,
+     0.988684757547429479938528919613635,
+     0.972182874748581796578058835234688,
+     0.946342858373402905148496208230196,
+     0.910371156957004292497790670606628,
+     0.863907938193690477146415857372834,
+     0.806940531950217611856307980888498,
+     0.739756044352694758677217797247848,
+     0.662909660024780595461015255689389,
+     0.577195710052045814843690955654189,
+     0.483618026945841027562153280531750,
+     0.383359324198730346916485193850313,
+     0.277749822021824315065356412191446,
+     0.168235251552207464982313275440102,
+     0.056344313046592789971967860789447,
+     0.999982430354891598580012135905110,
+     0.999598799671910683251967529211802,
+     0.998316635318407392530634580111075,
+     0.995724104698407188509439459018460,
+     0.991495721178106132398500079082520,
+     0.985371499598520371113758241326514,
+     0.977141514639705714156395810916629,
+     0.966637851558416567092279836370847,
+     0.953730006425761136414748643963112,
+     0.938320397779592883654822310657872,
+     0.920340025470012420729821382965612,
+     0.899744899776940036638633212194468,
+     0.876513414484705269741626645388424,
+     0.850644494768350279757827407542049,
+     0.822156254364980407372527142399376,
+     0.791084933799848361434638057884175,
+     0.757483966380513637926269606413039,
+     0.721423085370098915484976184424530,
+     0.682987431091079228087077605443638,
+     0.642276642509759513774113624213729,
+     0.599403930242242892974251049643553,
+     0.554495132631932548866381362001869,
+     0.507687757533716602154783137518048,
+     0.459130011989832332873501971840247,
+     0.408979821229888672409031653482170,
+     0.357403837831532152376214925551057,
+     0.304576441556714043335324049984831,
+     0.250678730303483176612957105310757,
+     0.195897502711100153915460230694341,
+     0.140424233152560174593819634863430,
+     0.084454040083710883710182167279385,
+     0.028184648949745694339397327870361,
+     0.999997596379748464620231592559094,
+     0.999943996207054375763853646470051,
+     0.999760490924432047330447933438138,
+     0.999380338025023581928079338774323,
+     0.998745614468095114703528542397792,
+     0.997805354495957274561833338685736,
+     0.996514145914890273848684083613154,
+     0.994831502800621000519130529785414,
+     0.992721344282788615328202203758497,
+     0.990151370400770159180535140748087,
+     0.987092527954034067189898792468859,
+     0.983518657578632728761664630770796,
+     0.979406281670862683806133521363753,
+     0.974734459752402667760726712997610,
+     0.969484659502459231770908123207442,
+     0.963640621569812132520974048832142,
+     0.957188216109860962736208621751375,
+     0.950115297521294876557842262038304,
+     0.942411565191083059812560025758972,
+     0.934068436157725787999477771530264,
+     0.925078932907075652364132996222673,
+     0.915437587155765040643953616154537,
+     0.905140358813261595189303779754262,
+     0.894184568335559022859352159222674,
+     0.882568840247341906841695404228947,
+     0.870293055548113905851151444154923,
+     0.857358310886232156525126596087164,
+     0.843766882672708601038314138625718,
+     0.829522194637401400178105088351228,
+     0.814628787655137413435816577891367,
+     0.799092290960841401799803164024282,
+     0.782919394118283016385180478369806,
+     0.766117819303760090716674093891475,
+     0.748696293616936602822828737479369,
+     0.730664521242181261329306715350070,
+     0.712033155362252034586679081013994,
+     0.692813769779114702894651485928487,
+     0.673018830230418479198879472689545,
+     0.652661665410017496100770934689235,
+     0.631756437711194230413584623172537,
+     0.610318113715186400155578672320162,
+     0.588362434447662541434367386275547,
+     0.565905885423654422622970392231344,
+     0.542965666498311490492303133422203,
+     0.519559661537457021992914143047305,
+     0.495706407918761460170111534008668,
+     0.471425065871658876934088018252224,
+     0.446735387662028473742222281592908,
+     0.421657686626163300056304726883311,
+     0.396212806057615939182521394284925,
+     0.370422087950078230137537383958156,
+     0.344307341599438022776622416041385,
+     0.317890812068476683181739338725981,
+     0.291195148518246681963691099017627,
+     0.264243372410926761944948292977629,
+     0.237058845589829727212668030348624,
+     0.209665238243181194766342717964440,
+     0.182086496759252198246399488588060,
+     0.154346811481378108692446779987579,
+     0.126470584372301966850663538758563,
+     0.098482396598119202090275757897139,
+     0.070406976042855179063296876055597,
+     0.042269164765363603212404898844477,
+     0.014093886410782462614188488235526,
+     0.999999672956734384381255159219504,
+     0.999992298136257588027755643653278,
+     0.999966730098486276882830885249830,
+     0.999913081144678282800060235069511,
+     0.999822363679787739195887250384589,
+     0.999686286448317731776164145356439,
+     0.999497112467187190535254233642143,
+     0.999247618943342473598956442663599,
+     0.998931050830810562235800876396739,
+     0.998541055697167906026535840998703,
+     0.998071634524930323301862258025675,
+     0.997517116063472399965248778013341,
+     0.996872143485260161299488943893740,
+     0.996131662079315037786103069427033,
+     0.995290903148810302261441221134548,
+     0.994345364356723405931051404638823,
+     0.993290788851684966210630567482643,
+     0.992123145530863117682577626420875,
+     0.990838611958294243677056285821971,
+     0.989433560520240838716432580021829,
+     0.987904547695124280466641905020268,
+     0.986248305913007552681500984782933,
+     0.984461737328814534596391771473417,
+     0.982541908851080604250588677831771,
+     0.980486047876721339415983624301005,
+     0.978291538324758539526086160038420,
+     0.975955916702011753128799181439485,
+     0.973476868052506926773292287987566,
+     0.970852221732792443255952442569278,
+     0.968079947017759947963519321888740,
+     0.965158148579915665978748255831442,
+     0.962085061904651475740672658554329,
+     0.958859048710200221355841044142830,
+     0.955478592438183697573539743995601,
+     0.951942293872573589498252097644763,
+     0.948248866934137357062665220126395,
+     0.944397134685866648590658080707628,
+     0.940386025573669721370327188912127,
+     0.936214569916450806624944479090248,
+     0.931881896650953639345354400511520,
+     0.927387230329536696843211690624689,
+     0.922729888363349241522733951313045,
+     0.917909278499077501636477106031358,
+     0.912924896514370590079612985970193,
+     0.907776324115058903624408454321067,
+     0.902463227016165675048288297479834,
+     0.896985353188316590375563852478289,
+     0.891342531251319871666073517860397,
+     0.885534668997285008926065810947063,
+     0.879561752026556262567558918969831,
+     0.873423842480859310192448475755955,
+     0.867121077859315215614411686442294,
+     0.860653669904299969802344431679809,
+     0.854021903545468625813403671748430,
+     0.847226135891580884380537849403620,
+     0.840266795261030442350241206926867,
+     0.833144380243172624727943660481356,
+     0.825859458783650001087663767660628,
+     0.818412667287925807395404043191145,
+     0.810804709738146594361162662676158,
+     0.803036356819268687781707006870766,
+     0.795108445051100526779765742947620,
+     0.787021875923539422169923323741905,
+     0.778777615032822744702101629520361,
+     0.770376691217076824277500017133351,
+     0.761820195689839149173437924653648,
+     0.753109281170558142522517669810314,
+     0.744245161011347082309441398540227,
+     0.735229108319491547663437293814242,
+     0.726062455075389632685181784549148,
+     0.716746591245747095766955882802978,
+     0.707282963891961103411571396443421,
+     0.697673076273711232906268432444666,
+     0.687918486947839325755671239892120,
+     0.678020808862644517838207978295913,
+     0.667981708447749702165342767010661,
+     0.657802904699713735421940270137992,
+     0.647486168263572388781752384318535,
+     0.637033320510492495071297969207218,
+     0.626446232611719746541612603839723,
+     0.615726824608992638013732647929278,
+     0.604877064481584353319269553424672,
+     0.593898967210121954392748735781505,
+     0.582794593837318850839487067630704,
+     0.571566050525742833992171441191291,
+     0.560215487612728441817628214650371,
+     0.548745098662529448607596354508062,
+     0.537157119515795115981789701208283,
+     0.525453827336442687395072298705711,
+     0.513637539655988578507410663073248,
+     0.501710613415391878250546194647680,
+     0.489675444004456155436369884522791,
+     0.477534464298829155283575455463144,
+     0.465290143694634735858169562264939,
+     0.452944987140767283783874859373183,
+     0.440501534168875795782875930034670,
+     0.427962357921062742583273213352667,
+     0.415330064175321663764338828068255,
+     0.402607290368737092671111178854681,
+     0.389796704618470795479342632852728,
+     0.376901004740559344801845755742271,
+     0.363922917266549655269424134645356,
+     0.350865196458001209010794870666661,
+     0.337730623318886219620576667938435,
+     0.324522004605921855206648873895050,
+     0.311242171836871800300193771589407,
+     0.297893980296857823436564947771060,
+     0.284480308042725577495999284613194,
+     0.271004054905512543536209666476221,
+     0.257468141491069790481253043302449,
+     0.243875508178893021592923490555893,
+     0.230229114119222177155704589842475,
+     0.216531936228472628081382342675027,
+     0.202786968183064697556528857524341,
+     0.188997219411721861059196031656370,
+     0.175165714086311475707446070019755,
+     0.161295490111305257360594492010282,
+     0.147389598111939940054076867489505,
+     0.133451100421161601344115164152418,
+     0.119483070065440005133381524270646,
+     0.105488589749541988532652675372783,
+     0.091470750840355390909456726411040,
+     0.077432652349857282567521070875497,
+     0.063377399917322289879668363898950,
+     0.049308104790868626715648458572092,
+     0.035227882808441023260312770951945,
+     0.021139853378331088334963087669280,
+     0.007047138459336746485137933366153
+};
+
+static const double patterson_ws[510] = {
+     /* m = 0: */ 0.888888888888888888888888888888889,
+     0.555555555555555555555555555555556,
+     /* m = 1: */ 0.450916538658474142345110087045571,
+     0.268488089868333440728569280666710,
+     0.104656226026467265193823857192073,
+     0.401397414775962222905051818618432,
+     /* m = 2: */ 0.225510499798206687386422549155950,
+     0.134415255243784220359968764802492,
+     0.051603282997079739696920120567861,
+     0.200628529376989021033931873331359,
+     0.017001719629940260339027417402654,
+     0.092927195315124537685894222654169,
+     0.171511909136391380787353165019717,
+     0.219156858401587496403693161643774,
+     /* m = 3: */ 0.112755256720768691607149869983805,
+     0.067207754295990703540401063581343,
+     0.025807598096176653564646118765233,
+     0.100314278611795578771293642695006,
+     0.008434565739321106246314929644160,
+     0.046462893261757986541404642963942,
+     0.085755920049990351154186520436798,
+     0.109578421055924638236688360572517,
+     0.002544780791561874415402782329831,
+     0.016446049854387810933788388068980,
+     0.035957103307129322096777826220970,
+     0.056979509494123357412197366545720,
+     0.076879620499003531042705190080946,
+     0.093627109981264473616658780339260,
+     0.105669893580234809743815890442169,
+     0.111956873020953456880143562321224,
+     /* m = 4: */ 0.056377628360384717387662557165235,
+     0.033603877148207730541733988473174,
+     0.012903800100351265625976653218633,
+     0.050157139305899537413679547423951,
+     0.004217630441558854839084226823574,
+     0.023231446639910269443256488936585,
+     0.042877960025007734492912303781982,
+     0.054789210527962865032217530994156,
+     0.001265156556230068011372609099982,
+     0.008223007957235929669257784415468,
+     0.017978551568128270332896046670861,
+     0.028489754745833548612506094772398,
+     0.038439810249455532038640346777879,
+     0.046813554990628012402648082334349,
+     0.052834946790116519862076656396531,
+     0.055978436510476319407553378587227,
+     0.000363221481845530659693580600241,
+     0.002579049794685688272427795558562,
+     0.006115506822117246339678283833261,
+     0.010498246909621321898272844583636,
+     0.015406750466559497802130826331548,
+     0.020594233915912711149188561950320,
+     0.025869679327214746910758266244848,
+     0.031073551111687964879884387824542,
+     0.036064432780782572640107160589607,
+     0.040715510116944318933894095600512,
+     0.044914531653632197414254248261831,
+     0.048564330406673198715947118166752,
+     0.051583253952048458776809100857526,
+     0.053905499335266063926876954886363,
+     0.055481404356559363987838407995547,
+     0.056277699831254301272595349425542,
+     /* m = 5: */ 0.028188814180192358693831278588210,
+     0.016801938574103865270869417737338,
+     0.006451900050175736922805097768239,
+     0.025078569652949768706839773844284,
+     0.002108815245726632879332553259080,
+     0.011615723319955134726984953886806,
+     0.021438980012503867246456159334062,
+     0.027394605263981432516108765509351,
+     0.000632607319362633544219014096676,
+     0.004111503978654693047170267993895,
+     0.008989275784064135723280603741188,
+     0.014244877372916774306341566243644,
+     0.019219905124727766019320280331422,
+     0.023406777495314006201324041970026,
+     0.026417473395058259931038328231199,
+     0.027989218255238159703776689300418,
+     0.000180739564445388357820333919515,
+     0.001289524082610417392098508697787,
+     0.003057753410175531136131383953541,
+     0.005249123454808859125133846126353,
+     0.007703375233279741848165978196893,
+     0.010297116957956355523686464107025,
+     0.012934839663607373454733955874237,
+     0.015536775555843982439928417016298,
+     0.018032216390391286320053099985727,
+     0.020357755058472159466947021117774,
+     0.022457265826816098707127121814444,
+     0.024282165203336599357973558774032,
+     0.025791626976024229388404550366031,
+     0.026952749667633031963438477424058,
+     0.027740702178279681993919203989075,
+     0.028138849915627150636297674706897,
+     0.000050536095207862517624665600634,
+     0.000377746646326984660274364525158,
+     0.000938369848542381500794044394682,
+     0.001681142865421469906313730234915,
+     0.002568764943794020373127715985638,
+     0.003572892783517299649384487698646,
+     0.004671050372114321747405433408267,
+     0.005843449875835639507559511964506,
+     0.007072489995433555468046316268413,
+     0.008342838753968157705584124241679,
+     0.009641177729702536695298303002848,
+     0.010955733387837901648032725736307,
+     0.012275830560082770086966330741367,
+     0.013591571009765546789572916181496,
+     0.014893641664815182034810395926764,
+     0.016173218729577719941947962798034,
+     0.017421930159464173747152263139728,
+     0.018631848256138790186314039533278,
+     0.019795495048097499488027722938915,
+     0.020905851445812023852221850587877,
+     0.021956366305317824939260500420781,
+     0.022940964229387748760800531919597,
+     0.023854052106038540080446032668747,
+     0.024690524744487676909060835352849,
+     0.025445769965464765812574396344574,
+     0.026115673376706097680498809377127,
+     0.026696622927450359906154699288196,
+     0.027185513229624791819208602732033,
+     0.027579749566481873034868712618911,
+     0.027877251476613701608523796690300,
+     0.028076455793817246606847848533683,
+     0.028176319033016602130653580532631,
+     /* m = 6: */ 0.014094407090096179346915639294105,
+     0.008400969287051932635434708868669,
+     0.003225950025087868461402548886647,
+     0.012539284826474884353419886922142,
+     0.001054407622863316772249566812567,
+     0.005807861659977567363492476943403,
+     0.010719490006251933623228079667031,
+     0.013697302631990716258054382754675,
+     0.000316303660822264476886001542320,
+     0.002055751989327346523585571798920,
+     0.004494637892032067861640301870594,
+     0.007122438686458387153170783121822,
+     0.009609952562363883009660140165711,
+     0.011703388747657003100662020985013,
+     0.013208736697529129965519164115599,
+     0.013994609127619079851888344650209,
+     0.000090372734658751149261204829280,
+     0.000644762041305724779327197260133,
+     0.001528876705087765568381057897982,
+     0.002624561727404429562566923943037,
+     0.003851687616639870924082989098457,
+     0.005148558478978177761843232053513,
+     0.006467419831803686727366977937118,
+     0.007768387777921991219964208508149,
+     0.009016108195195643160026549992863,
+     0.010178877529236079733473510558887,
+     0.011228632913408049353563560907222,
+     0.012141082601668299678986779387016,
+     0.012895813488012114694202275183015,
+     0.013476374833816515981719238712029,
+     0.013870351089139840996959601994538,
+     0.014069424957813575318148837353449,
+     0.000025157870384280661488602990187,
+     0.000188873264506504913660930569063,
+     0.000469184924247850409754566477203,
+     0.000840571432710722463646844648205,
+     0.001284382471897010176805112263689,
+     0.001786446391758649824681032870434,
+     0.002335525186057160873702697950351,
+     0.002921724937917819753779755937115,
+     0.003536244997716777734023158134052,
+     0.004171419376984078852792062120839,
+     0.004820588864851268347649151501424,
+     0.005477866693918950824016362868154,
+     0.006137915280041385043483165370683,
+     0.006795785504882773394786458090748,
+     0.007446820832407591017405197963382,
+     0.008086609364788859970973981399017,
+     0.008710965079732086873576131569864,
+     0.009315924128069395093157019766639,
+     0.009897747524048749744013861469458,
+     0.010452925722906011926110925293939,
+     0.010978183152658912469630250210390,
+     0.011470482114693874380400265959799,
+     0.011927026053019270040223016334374,
+     0.012345262372243838454530417676424,
+     0.012722884982732382906287198172287,
+     0.013057836688353048840249404688564,
+     0.013348311463725179953077349644098,
+     0.013592756614812395909604301366016,
+     0.013789874783240936517434356309456,
+     0.013938625738306850804261898345150,
+     0.014038227896908623303423924266842,
+     0.014088159516508301065326790266316,
+     0.000006937936432410826716953822972,
+     0.000053275293669780613125352439390,
+     0.000135754910949228719729842895656,
+     0.000249212400482997294024537662868,
+     0.000389745284473282293215563879846,
+     0.000554295314930374714917732120267,
+     0.000740282804244503330463160177700,
+     0.000945361516858525382463015198607,
+     0.001167484117429959407693331578729,
+     0.001404907995655144642715211232969,
+     0.001656112728154452605216827864511,
+     0.001919712971013872412522717344670,
+     0.002194406925363838838802918408686,
+     0.002478958226657567930678215357455,
+     0.002772195764593450993995214249611,
+     0.003073018434702578323407837652266,
+     0.003380397991086920382349930390389,
+     0.003693377917025650818257299987645,
+     0.004011068724075023398889936149040,
+     0.004332640968092982854537699833247,
+     0.004657317299756854777277944848496,
+     0.004984364564765538601200010221621,
+     0.005313086605187056566288043403729,
+     0.005642818101384444158454605873117,
+     0.005972919565508165804947298569359,
+     0.006302773449085758717163987634189,
+     0.006631781242901887894122007341804,
+     0.006959361409390422939445075444791,
+     0.007284947980553807063879811475350,
+     0.007607989665719056583217396942234,
+     0.007927949334294849110252542351157,
+     0.008244303763032868030550597065354,
+     0.008556543561307689619172932750049,
+     0.008864173209482494264114294530918,
+     0.009166711163560788406705196484729,
+     0.009463689993830065294272431139432,
+     0.009754656536317411461082934527355,
+     0.010039172044056840798181029043838,
+     0.010316812330947621681920700024418,
+     0.010587167904885197930942818993240,
+     0.010849844089337314099024526331808,
+     0.011104461134006926536999418845457,
+     0.011350654315980596601734484080497,
+     0.011588074033043952568423977601239,
+     0.011816385890830235763224790008497,
+     0.012035270785279562630449869430610,
+     0.012244424981611985898629206332463,
+     0.012443560190714035263149503108712,
+     0.012632403643542078764540544108520,
+     0.012810698163877361966841703921806,
+     0.012978202239537399285842180334825,
+     0.013134690091960152836381326038178,
+     0.013279951743930530650377508971028,
+     0.013413793085110098512966377608572,
+     0.013536035934956213613665309189052,
+     0.013646518102571291428399891215869,
+     0.013745093443001896632252054002555,
+     0.013831631909506428676495968853511,
+     0.013906019601325461263531221525361,
+     0.013968158806516938515727779767433,
+     0.014017968039456608809872224968850,
+     0.014055382072649964277167925331102,
+     0.014080351962553661324845841110454,
+     0.014092845069160408354959273538676,
+     /* m = 7: */ 0.007047203545048089673457819647052,
+     0.004200484643525966317717354434334,
+     0.001612975012543934230701274443323,
+     0.006269642413237442176709943461071,
+     0.000527203811431658386124783406284,
+     0.002903930829988783681746238471702,
+     0.005359745003125966811614039833516,
+     0.006848651315995358129027191377338,
+     0.000158151830411132242923686600983,
+     0.001027875994663673261792785899460,
+     0.002247318946016033930820150935297,
+     0.003561219343229193576585391560911,
+     0.004804976281181941504830070082855,
+     0.005851694373828501550331010492506,
+     0.006604368348764564982759582057800,
+     0.006997304563809539925944172325105,
+     0.000045186367412629614310544685946,
+     0.000322381020652862389663599131393,
+     0.000764438352543882784190528948991,
+     0.001312280863702214781283461971519,
+     0.001925843808319935462041494549228,
+     0.002574279239489088880921616026756,
+     0.003233709915901843363683488968559,
+     0.003884193888960995609982104254074,
+     0.004508054097597821580013274996432,
+     0.005089438764618039866736755279443,
+     0.005614316456704024676781780453611,
+     0.006070541300834149839493389693508,
+     0.006447906744006057347101137591508,
+     0.006738187416908257990859619356014,
+     0.006935175544569920498479800997269,
+     0.007034712478906787659074418676724,
+     0.000012579278188959274352540764749,
+     0.000094436632253270552706590130637,
+     0.000234592462123925204878630350067,
+     0.000420285716355361231823422324335,
+     0.000642191235948505088402556131844,
+     0.000893223195879324912340516435217,
+     0.001167762593028580436851348975175,
+     0.001460862468958909876889877968558,
+     0.001768122498858388867011579067026,
+     0.002085709688492039426396031060419,
+     0.002410294432425634173824575750712,
+     0.002738933346959475412008181434077,
+     0.003068957640020692521741582685342,
+     0.003397892752441386697393229045374,
+     0.003723410416203795508702598981691,
+     0.004043304682394429985486990699509,
+     0.004355482539866043436788065784932,
+     0.004657962064034697546578509883320,
+     0.004948873762024374872006930734729,
+     0.005226462861453005963055462646969,
+     0.005489091576329456234815125105195,
+     0.005735241057346937190200132979899,
+     0.005963513026509635020111508167187,
+     0.006172631186121919227265208838212,
+     0.006361442491366191453143599086144,
+     0.006528918344176524420124702344282,
+     0.006674155731862589976538674822049,
+     0.006796378307406197954802150683008,
+     0.006894937391620468258717178154728,
+     0.006969312869153425402130949172575,
+     0.007019113948454311651711962133421,
+     0.007044079758254150532663395133158,
+     0.000003454565071691491348978551253,
+     0.000026637641233900090135791339027,
+     0.000067877455473397241622670990179,
+     0.000124606200241498368482044006805,
+     0.000194872642236641146532075535169,
+     0.000277147657465187357458840773251,
+     0.000370141402122251665231580078345,
+     0.000472680758429262691231507599298,
+     0.000583742058714979703846665789365,
+     0.000702453997827572321357605616485,
+     0.000828056364077226302608413932256,
+     0.000959856485506936206261358672335,
+     0.001097203462681919419401459204343,
+     0.001239479113328783965339107678727,
+     0.001386097882296725496997607124805,
+     0.001536509217351289161703918826133,
+     0.001690198995543460191174965195194,
+     0.001846688958512825409128649993822,
+     0.002005534362037511699444968074520,
+     0.002166320484046491427268849916623,
+     0.002328658649878427388638972424248,
+     0.002492182282382769300600005110810,
+     0.002656543302593528283144021701865,
+     0.002821409050692222079227302936558,
+     0.002986459782754082902473649284680,
+     0.003151386724542879358581993817095,
+     0.003315890621450943947061003670902,
+     0.003479680704695211469722537722396,
+     0.003642473990276903531939905737675,
+     0.003803994832859528291608698471117,
+     0.003963974667147424555126271175579,
+     0.004122151881516434015275298532677,
+     0.004278271780653844809586466375025,
+     0.004432086604741247132057147265459,
+     0.004583355581780394203352598242364,
+     0.004731844996915032647136215569716,
+     0.004877328268158705730541467263677,
+     0.005019586022028420399090514521919,
+     0.005158406165473810840960350012209,
+     0.005293583952442598965471409496620,
+     0.005424922044668657049512263165904,
+     0.005552230567003463268499709422729,
+     0.005675327157990298300867242040248,
+     0.005794037016521976284211988800619,
+     0.005908192945415117881612395004248,
+     0.006017635392639781315224934715305,
+     0.006122212490805992949314603166231,
+     0.006221780095357017631574751554356,
+     0.006316201821771039382270272054260,
+     0.006405349081938680983420851960903,
+     0.006489101119768699642921090167412,
+     0.006567345045980076418190663019089,
+     0.006639975871965265325188754485514,
+     0.006706896542555049256483188804286,
+     0.006768017967478106806832654594526,
+     0.006823259051285645714199945607935,
+     0.006872546721500948316126027001278,
+     0.006915815954753214338247984426756,
+     0.006953009800662730631765610762680,
+     0.006984079403258469257863889883716,
+     0.007008984019728304404936112484425,
+     0.007027691036324982138583962665551,
+     0.007040175981276830662422920555227,
+     0.007046422534580204177479636769338,
+     0.000000945715933950007048827209918,
+     0.000007366240691023216688567789447,
+     0.000019021368190587581667932112578,
+     0.000035375137205518958862767839882,
+     0.000056031950785616425214047454956,
+     0.000080689922801403529385105281604,
+     0.000109085545645741522050960918372,
+     0.000140970302204104791413162531989,
+     0.000176126765545083195474390201780,
+     0.000214368090034216937148954042481,
+     0.000255525589595236862013521246283,
+     0.000299439176850911730874203213593,
+     0.000345954492129903871350135326859,
+     0.000394924138246873704433900272995,
+     0.000446209810101403247488086716228,
+     0.000499683553312800484518551256456,
+     0.000555227733977307579714721408922,
+     0.000612734008012225209294127810945,
+     0.000672101776960108194645948734332,
+     0.000733236554224767912055344149741,
+     0.000796048517297550871506079476050,
+     0.000860451377808527848128003518965,
+     0.000926361595613111283368229421298,
+     0.000993697899638760857944700919042,
+     0.001062381048853400713750675753403,
+     0.001132333760515976649166612455231,
+     0.001203480740012659648807128132976,
+     0.001275748759773469473445174909634,
+     0.001349066749283531131272004534384,
+     0.001423365871417205199003014151053,
+     0.001498579571064566362143137297627,
+     0.001574643590032121661885542737471,
+     0.001651495947719145706551482830492,
+     0.001729076890544616071676115869136,
+     0.001807328815018089300790104457726,
+     0.001886196170158084753935809221788,
+     0.001965625345031505477319863433414,
+     0.002045564546799582934463364932669,
+     0.002125963674014725330445621655948,
+     0.002206774189160033291935512107262,
+     0.002287948993651959723782584661521,
+     0.002369442307793804951457886626830,
+     0.002451209557505564839230764479342,
+     0.002533207269079253257496822568666,
+     0.002615392972722361092252703825776,
+     0.002697725115252945866665130366536,
+     0.002780162981991394350446511388062,
+     0.002862666627647578682528622075706,
+     0.002945196815818575822839190941521,
+     0.003027714966581985444797317888221,
+     0.003110183111584275461578145956738,
+     0.003192563855974347367902482251935,
+     0.003274820346512339695644765032641,
+     0.003356916245186167613416010370768,
+     0.003438815707687905918762164703826,
+     0.003520483366134179226820381131306,
+     0.003601884315455324318686596669253,
+     0.003682984102924039119667012677899,
+     0.003763748720342963382405069270977,
+     0.003844144598460131589167386494498,
+     0.003924138603229957746601745280575,
+     0.004003698033584216885615542948307,
+     0.004082790620421578383501539251520,
+     0.004161384526565097457638877356301,
+     0.004239448347474381844343106474626,
+     0.004316951112532794799277995646575,
+     0.004393862286760041952604764077563,
+     0.004470151772826927269004349507099,
+     0.004545789913272132854875543566455,
+     0.004620747492840806874816488251658,
+     0.004694995740881790465320074654484,
+     0.004768506333754749252632007359711,
+     0.004841251397210571352138037387937,
+     0.004913203508718418973667814368995,
+     0.004984335699721030299139881108820,
+     0.005054621457806501250582808965810,
+     0.005124034728790053518309267101797,
+     0.005192549918703416148626546621326,
+     0.005260141895692593112049568295313,
+     0.005326785991827118579741222428315,
+     0.005392458004825555936063869635661,
+     0.005457134199703098639954120683300,
+     0.005520791310347787064573862611677,
+     0.005583406541032156376099665466316,
+     0.005644957567867153688851040909673,
+     0.005705422540204973323119534149612,
+     0.005764780081997111429543180855557,
+     0.005823009293113480577021125312229,
+     0.005880089750627888032045560367306,
+     0.005936001510074598276141296193726,
+     0.005990725106680094714715791595039,
+     0.006044241556573546345888426681350,
+     0.006096532357978886929232101591027,
+     0.006147579492390837902142095897074,
+     0.006197365425736659963419841773511,
+     0.006245873109524907485412873374107,
+     0.006293085981981988366877291804971,
+     0.006338987969176901659116499649339,
+     0.006383563486134137097953197866102,
+     0.006426797437934374389218365612711,
+     0.006468675220802314816882664587826,
+     0.006509182723180712008269367552135,
+     0.006548306326789440640540462870566,
+     0.006586032907668249377944798889940,
+     0.006622349837201685094575125827800,
+     0.006657244983124547082172288616239,
+     0.006690706710506130065835754864571,
+     0.006722723882711441080361792774165,
+     0.006753285862337525290783806739712,
+     0.006782382512123007460824620716048,
+     0.006810004195828946883737400197268,
+     0.006836141779089112218406345586039,
+     0.006860786630227806979514037253834,
+     0.006883930621043414709947343434910,
+     0.006905566127555883548029751022550,
+     0.006925686030716431556212957083753,
+     0.006944283717077825494380298424812,
+     0.006961353079423665514931340239817,
+     0.006976888517355195458447296755317,
+     0.006990884937834252075446842671184,
+     0.007003337755681065728196766373380,
+     0.007014242894025729164251784978471,
+     0.007023596784712259110307302780324,
+     0.007031396368654287095082315437612,
+     0.007037639096141530523187353876284,
+     0.007042322927096312095966347043517,
+     0.007045446331279514767796553755909,
+     0.007047008288445480137299624641003
+};
+
+static const double *const patterson_x[PATTERSON_MAXM + 1] = {
+     patterson_xs, patterson_xs, patterson_xs, patterson_xs,
+     patterson_xs, patterson_xs, patterson_xs, patterson_xs
+};
+
+static const double *const patterson_w[PATTERSON_MAXM + 1] = {
+     patterson_ws + 0, patterson_ws + 2, patterson_ws + 6, patterson_ws + 14,
+     patterson_ws + 30, patterson_ws + 62, patterson_ws + 126, patterson_ws + 254
+};
+
+static int patterson_init(unsigned M)
+{
+     return M > PATTERSON_MAXM ? FAILURE : SUCCESS;
+}
+
+/***************************************************************************/
+/* A family of nested 1d rules: the rule of degree m (for m = 0, 1, ...,
+   maxm) consists of the center point and npairs(r, m) pairs of points
+   +/- x[m][j], with weights w[m][0] and w[m][j+1], respectively.  (The
+   first npairs(r, m-1) points are those of the m-1 rule.)  init(M) must
+   be called to make sure that the rules for m <= M are available. */
+typedef struct {
+     unsigned maxm;
+     int gauss; /* 1 for Gauss-Patterson, 0 for Clenshaw-Curtis */
+     const double *const *x;
+     const double *const *w;
+     int (*init)(unsigned M);
+} nested_rule;
+
+static const nested_rule clencurt_rules = {
+     CLENCURT_MAXM, 0, clencurt_x, clencurt_w, clencurt_init
+};
+
+static const nested_rule patterson_rules = {
+     PATTERSON_MAXM, 1, patterson_x, patterson_w, patterson_init
+};
+
+/* number of points x > 0 in the rule of degree m */
+static size_t npairs(const nested_rule *r, unsigned m)
+{
+     return r->gauss ? ((size_t) 2 << m) - 1 : (size_t) 1 << m;
+}
+
+/* number of points x > 0 in the rule of degree m that are not in
+   the rule of degree m-1 (where m == -1 is the trivial rule consisting
+   only of the center point) */
+static size_t nnew(const nested_rule *r, unsigned m)
+{
+     return m ? npairs(r, m) - npairs(r, m - 1) : npairs(r, 0);
+}
+
+/***************************************************************************/
+/* For adaptive cubature, thanks to the nesting of the 1d rules, we
    can re-use the values from coarser grids for finer grids, and the
    coarser grids are also used for error estimation. 
 
    A grid is determined by an m[dim] array, where m[i] denotes
-   2^(m[i]+1)+1 points in the i-th dimension.
+   2*npairs(m[i])+1 points in the i-th dimension, i.e. 2^(m[i]+1)+1
+   points for Clenshaw-Curtis or 2^(m[i]+2)-1 for Gauss-Patterson.
 */
 
 /* cache of the values for the m[dim] grid.  If mi < dim, then we only
@@ -57,6 +1143,9 @@ typedef struct cacheval_s {
      unsigned m[MAXDIM];
      unsigned mi;
      double *val;
+     int own_val; /* whether val was malloc'ed for this entry, rather than
+		     pointing into the block of an earlier entry that was
+		     evaluated in the same batch */
 } cacheval;
 
 /* array of ncache cachevals c[i] */
@@ -71,7 +1160,8 @@ static void free_cachevals(valcache *v)
      if (v->c) {
 	  size_t i;
 	  for (i = 0; i < v->ncache; ++i)
-	       free(v->c[i].val);
+	       if (v->c[i].own_val)
+		    free(v->c[i].val);
 	  free(v->c);
 	  v->c = NULL;
      }
@@ -80,97 +1170,122 @@ static void free_cachevals(valcache *v)
 
 /***************************************************************************/
 
-/* recursive loop over all cubature points for the given (m,mi) cache entry:
-   add each point to the buffer buf, evaluating all at once whenever the
-   buffer is full or when we are done */
-static int compute_cacheval(const unsigned *m, unsigned mi, 
-			    double *val, size_t *vali,
-			    unsigned fdim, integrand_v f, void *fdata,
-			    unsigned dim, unsigned id, double *p,
-			    const double *xmin, const double *xmax,
-			    double *buf, size_t nbuf, size_t *ibuf)
-{
-     if (id == dim) { /* add point to buffer of points */
-	  memcpy(buf + (*ibuf)++ * dim, p, sizeof(double) * dim);
-	  if (*ibuf == nbuf) { /* flush buffer */
-	       if (f(dim, nbuf, buf, fdata, fdim, val + *vali))
-		    return FAILURE;
-	       *vali += *ibuf * fdim;
-	       *ibuf = 0;
-	  }
+/* iterator over the points of the cache entry (m, mi) on [xmin, xmax],
+   in the order in which their values are stored: an "odometer" of dim
+   digits d[i] (the last dimension varying fastest), where the digits
+   in dimension i index the center point (unless i == mi) followed by
+   the points c + h*x[j] and c - h*x[j] for each j in turn */
+typedef struct {
+     unsigned dim;
+     int done; /* whether all of the points have been returned */
+     size_t d[MAXDIM], nd[MAXDIM]; /* the digits and their ranges */
+     int center[MAXDIM]; /* whether digit 0 is the center point */
+     const double *x[MAXDIM]; /* the 1d points x[j] of each dimension */
+     double c[MAXDIM], h[MAXDIM]; /* center and half-width of each dim. */
+     double p[MAXDIM]; /* the current point */
+} grid_iter;
+
+static double grid_coord(const grid_iter *g, unsigned i)
+{
+     size_t k = g->d[i];
+     if (g->center[i]) {
+	  if (k == 0) return g->c[i];
+	  --k;
      }
-     else {
-	  double c = (xmin[id] + xmax[id]) * 0.5;
-	  double r = (xmax[id] - xmin[id]) * 0.5;
-	  const double *x = clencurt_x 
-	       + ((id == mi) ? (m[id] ? (1 << (m[id] - 1)) : 0) : 0);
-	  unsigned i, nx = (id == mi ? (m[id] ? (1 << (m[id] - 1)) : 1)
-			    : (1 << (m[id])));
-	  if (id != mi) {
-	       p[id] = c;
-	       if (compute_cacheval(m, mi, val, vali, fdim, f, fdata,
-				    dim, id + 1, p,
-				    xmin, xmax, buf, nbuf, ibuf))
-		    return FAILURE;
-	  }
-	  for (i = 0; i < nx; ++i) {
-	       p[id] = c + r * x[i];
-	       if (compute_cacheval(m, mi, val, vali, fdim, f, fdata,
-				    dim, id + 1, p,
-				    xmin, xmax, buf, nbuf, ibuf))
-		    return FAILURE;
-	       p[id] = c - r * x[i];
-	       if (compute_cacheval(m, mi, val, vali, fdim, f, fdata,
-				    dim, id + 1, p,
-				    xmin, xmax, buf, nbuf, ibuf))
-		    return FAILURE;
+     return (k & 1) ? g->c[i] - g->h[i] * g->x[i][k >> 1]
+	  : g->c[i] + g->h[i] * g->x[i][k >> 1];
+}
+
+static void grid_init(grid_iter *g, const nested_rule *r,
+		      const unsigned *m, unsigned mi, unsigned dim,
+		      const double *xmin, const double *xmax)
+{
+     unsigned i;
+     g->dim = dim;
+     g->done = 0;
+     for (i = 0; i < dim; ++i) {
+	  g->c[i] = (xmin[i] + xmax[i]) * 0.5;
+	  g->h[i] = (xmax[i] - xmin[i]) * 0.5;
+	  g->center[i] = i != mi;
+	  g->x[i] = r->x[m[i]] + ((i == mi && m[i]) ? npairs(r, m[i] - 1) : 0);
+	  g->nd[i] = i == mi ? 2 * nnew(r, m[i]) : 2 * npairs(r, m[i]) + 1;
+	  g->d[i] = 0;
+	  g->p[i] = grid_coord(g, i);
+     }
+}
+
+/* store up to n of the remaining points of g in x, returning how many */
+CUBATURE_KERNEL
+static size_t grid_points(grid_iter *g, double *x, size_t n)
+{
+     unsigned dim = g->dim, i;
+     size_t k;
+     for (k = 0; k < n && !g->done; ++k) {
+	  memcpy(x + k * dim, g->p, sizeof(double) * dim);
+	  for (i = dim; i > 0 && ++g->d[i-1] == g->nd[i-1]; --i) {
+	       g->d[i-1] = 0;
+	       g->p[i-1] = grid_coord(g, i-1);
 	  }
+	  if (i == 0)
+	       g->done = 1;
+	  else
+	       g->p[i-1] = grid_coord(g, i-1);
      }
-     return SUCCESS;
+     return k;
 }
 
-static size_t num_cacheval(const unsigned *m, unsigned mi, unsigned dim)
+static size_t num_cacheval(const nested_rule *r,
+			   const unsigned *m, unsigned mi, unsigned dim)
 {
      unsigned i;
      size_t nval = 1;
      for (i = 0; i < dim; ++i) {
 	  if (i == mi)
-	       nval *= m[i] == 0 ? 2 : (1 << (m[i]));
+	       nval *= 2 * nnew(r, m[i]);
 	  else
-	       nval *= (1 << (m[i] + 1)) + 1;
+	       nval *= 2 * npairs(r, m[i]) + 1;
      }
      return nval;
 }
 
-static int add_cacheval(valcache *vc,
-			const unsigned *m, unsigned mi,
-			unsigned fdim, integrand_v f, void *fdata,
-			unsigned dim, const double *xmin, const double *xmax,
-			double *buf, size_t nbuf)
+/* add the cache entries for refining the dimensions mi[0..nmi-1] in turn,
+   incrementing m[mi[k]] for each one, or for the whole m grid if nmi == 1
+   and mi[0] == dim.  The values for all of the new entries are stored
+   in a single block, which is returned (or NULL if we run out of
+   memory), so that all of the new points can be evaluated together
+   in batches of nbuf points. */
+static double *add_cachevals(valcache *vc, const nested_rule *r,
+			     unsigned *m, const unsigned *mi, unsigned nmi,
+			     unsigned fdim, unsigned dim)
 {
      size_t ic = vc->ncache;
-     size_t nval, vali = 0, ibuf = 0;
-     double p[MAXDIM];
-
-     vc->c = (cacheval *) realloc(vc->c, sizeof(cacheval) * ++(vc->ncache));
-     if (!vc->c) return -1;
-
-     vc->c[ic].mi = mi;
-     memcpy(vc->c[ic].m, m, sizeof(unsigned) * dim);
-     nval = fdim * num_cacheval(m, mi, dim);
-     vc->c[ic].val = (double *) malloc(sizeof(double) * nval);
-     if (!vc->c[ic].val) return FAILURE;
-
-     if (compute_cacheval(m, mi, vc->c[ic].val, &vali,
-			  fdim, f, fdata,
-			  dim, 0, p, xmin, xmax,
-			  buf, nbuf, &ibuf))
-	  return FAILURE;
+     size_t nval = 0, vali = 0;
+     double *val;
+     cacheval *c;
+     unsigned k, maxm = 0;
 
-     if (ibuf > 0) /* flush remaining buffer */
-	  return f(dim, ibuf, buf, fdata, fdim, vc->c[ic].val + vali);
+     c = (cacheval *) realloc(vc->c, sizeof(cacheval) * (ic + nmi));
+     if (!c) return NULL;
+     vc->c = c;
 
-     return SUCCESS;
+     for (k = 0; k < nmi; ++k) {
+	  if (mi[k] < dim) m[mi[k]] += 1;
+	  c[ic+k].mi = mi[k];
+	  memcpy(c[ic+k].m, m, sizeof(unsigned) * dim);
+	  nval += fdim * num_cacheval(r, m, mi[k], dim);
+     }
+     for (k = 0; k < dim; ++k)
+	  if (m[k] > maxm) maxm = m[k];
+     if (r->init(maxm)) return NULL;
+     val = (double *) malloc(sizeof(double) * nval);
+     if (!val) return NULL;
+     for (k = 0; k < nmi; ++k) {
+	  c[ic+k].val = val + vali;
+	  c[ic+k].own_val = k == 0;
+	  vali += fdim * num_cacheval(r, c[ic+k].m, mi[k], dim);
+     }
+     vc->ncache += nmi;
+     return val;
 }
 
 /***************************************************************************/
@@ -178,92 +1293,114 @@ static int add_cacheval(valcache *vc,
 /* recursive loop to evaluate the integral contribution from the cache
    entry c, accumulating in val, for the given m[] except with m[md]
    -> m[md] - 1 if md < dim, using the cached values (cm,cmi,cval).  id is the
-   current loop dimension (from 0 to dim-1). */
-static unsigned eval(const unsigned *cm, unsigned cmi, double *cval,
+   current loop dimension (from 0 to dim-1).  If iact is non-NULL, only
+   the nact components iact[0..nact-1] are accumulated. */
+CUBATURE_KERNEL
+static unsigned eval(const nested_rule *r,
+		     const unsigned *cm, unsigned cmi, double *cval,
 		 const unsigned *m, unsigned md,
-		 unsigned fdim, unsigned dim, unsigned id,
+		 unsigned fdim, const unsigned *iact, unsigned nact,
+		 unsigned dim, unsigned id,
 		 double weight, double *val)
 {
      size_t voff = 0; /* amount caller should offset cval array afterwards */
      if (id == dim) {
 	  unsigned i;
-	  for (i = 0; i < fdim; ++i) val[i] += cval[i] * weight;
+	  if (iact)
+	       for (i = 0; i < nact; ++i)
+		    val[iact[i]] += cval[iact[i]] * weight;
+	  else
+	       for (i = 0; i < fdim; ++i) val[i] += cval[i] * weight;
 	  voff = fdim;
      }
      else if (m[id] == 0 && id == md) /* using trivial rule for this dim */ {
-	  voff = eval(cm, cmi, cval, m, md, fdim, dim, id+1, weight*2, val);
-	  voff += fdim * (1 << cm[id]) * 2
-	       * num_cacheval(cm + id+1, cmi - (id+1), dim - (id+1));
+	  voff = eval(r, cm, cmi, cval, m, md, fdim, iact, nact, dim, id+1,
+		      weight*2, val);
+	  voff += fdim * npairs(r, cm[id]) * 2
+	       * num_cacheval(r, cm + id+1, cmi - (id+1), dim - (id+1));
      }
      else {
-	  unsigned i;
-	  unsigned mid = m[id] - (id == md); /* order of C-C rule */
-	  const double *w = clencurt_w + mid + (1 << mid) - 1
-	       + (id == cmi ? (cm[id] ? 1 + (1 << (cm[id]-1)) : 1) : 0);
-	  unsigned cnx = (id == cmi ? (cm[id] ? (1 << (cm[id]-1)) : 1)
-			  : (1 << (cm[id])));
-	  unsigned nx = cm[id] <= mid ? cnx : (1 << mid);
+	  size_t i;
+	  unsigned mid = m[id] - (id == md); /* degree of 1d rule */
+	  const double *w = r->w[mid]
+	       + (id == cmi ? 1 + (cm[id] ? npairs(r, cm[id]-1) : 0) : 0);
+	  size_t cnx = id == cmi ? nnew(r, cm[id]) : npairs(r, cm[id]);
+	  size_t nx = cm[id] <= mid ? cnx : npairs(r, mid);
 
 	  if (id != cmi) {
-	       voff = eval(cm, cmi, cval, m, md, fdim, dim, id + 1,
-			   weight * w[0], val);
+	       voff = eval(r, cm, cmi, cval, m, md, fdim, iact, nact,
+			   dim, id + 1, weight * w[0], val);
 	       ++w;
 	  }
 	  for (i = 0; i < nx; ++i) {
-	       voff += eval(cm, cmi, cval + voff, m, md, fdim, dim, id + 1,
-			    weight * w[i], val);
-	       voff += eval(cm, cmi, cval + voff, m, md, fdim, dim, id + 1,
-			    weight * w[i], val);
+	       voff += eval(r, cm, cmi, cval + voff, m, md, fdim, iact, nact,
+			    dim, id + 1, weight * w[i], val);
+	       voff += eval(r, cm, cmi, cval + voff, m, md, fdim, iact, nact,
+			    dim, id + 1, weight * w[i], val);
 	  }
 
 	  voff += (cnx - nx) * fdim * 2
-	       * num_cacheval(cm + id+1, cmi - (id+1), dim - (id+1));
+	       * num_cacheval(r, cm + id+1, cmi - (id+1), dim - (id+1));
      }
      return voff;
 }
 
 /* loop over all cache entries that contribute to the integral,
    (with m[md] decremented by 1) */
-static void evals(valcache vc, const unsigned *m, unsigned md,
-		  unsigned fdim, unsigned dim, 
-		  double V, double *val)
+static void evals(valcache vc, const nested_rule *r,
+		  const unsigned *m, unsigned md,
+		  unsigned fdim, const unsigned *iact, unsigned nact,
+		  unsigned dim, double V, double *val)
 {
      size_t i;
 
-     memset(val, 0, sizeof(double) * fdim);
+     if (iact)
+	  for (i = 0; i < nact; ++i) val[iact[i]] = 0;
+     else
+	  memset(val, 0, sizeof(double) * fdim);
      for (i = 0; i < vc.ncache; ++i) {
 	  if (vc.c[i].mi >= dim ||
 	      vc.c[i].m[vc.c[i].mi] + (vc.c[i].mi == md) <= m[vc.c[i].mi])
-	       eval(vc.c[i].m, vc.c[i].mi, vc.c[i].val,
-		    m, md, fdim, dim, 0, V, val);
+	       eval(r, vc.c[i].m, vc.c[i].mi, vc.c[i].val,
+		    m, md, fdim, iact, nact, dim, 0, V, val);
      }
 }
 
 /* evaluate the integrals for the given m[] using the cached values in vc,
-   storing the integrals in val[], the error estimate in err[], and the
-   dimension to subdivide next (the largest error contribution) in *mi */
-static void eval_integral(valcache vc, const unsigned *m, 
-			  unsigned fdim, unsigned dim, double V,
-			  unsigned *mi, double *val, double *err, double *val1)
+   storing the integrals in val[], the error estimate in err[], the
+   error contribution of each dimension in derr[], and the
+   dimension to subdivide next (the largest error contribution) in *mi.
+   If iact is non-NULL, only the components iact[0..nact-1] are
+   evaluated (and the others are left unchanged). */
+CUBATURE_KERNEL
+static void eval_integral(valcache vc, const nested_rule *r,
+			  const unsigned *m, 
+			  unsigned fdim, const unsigned *iact, unsigned nact,
+			  unsigned dim, double V,
+			  unsigned *mi, double *val, double *err, double *val1,
+			  double *derr)
 {
      double maxerr = 0;
-     unsigned i, j;
+     unsigned i, j, k, nk = iact ? nact : fdim;
      
-     evals(vc, m, dim, fdim, dim, V, val);
+     evals(vc, r, m, dim, fdim, iact, nact, dim, V, val);
 
      /* error estimates along each dimension by comparing val with
 	lower-order rule in that dimension; overall (conservative)
 	error estimate from maximum error of lower-order rules. */
-     memset(err, 0, sizeof(double) * fdim);
+     for (k = 0; k < nk; ++k) err[iact ? iact[k] : k] = 0;
      *mi = 0;
      for (i = 0; i < dim; ++i) {
 	  double emax = 0;
-	  evals(vc, m, i, fdim, dim, V, val1);
-	  for (j = 0; j < fdim; ++j) {
-	       double e = fabs(val[j] - val1[j]);
+	  evals(vc, r, m, i, fdim, iact, nact, dim, V, val1);
+	  for (k = 0; k < nk; ++k) {
+	       double e;
+	       j = iact ? iact[k] : k;
+	       e = fabs(val[j] - val1[j]);
 	       if (e > emax) emax = e;
 	       if (e > err[j]) err[j] = e;
 	  }
+	  derr[i] = emax;
 	  if (emax > maxerr) {
 	       maxerr = emax;
 	       *mi = i;
@@ -272,113 +1409,614 @@ static void eval_integral(valcache vc, const unsigned *m,
      /* printf("eval: %g +/- %g (dim %u)\n", val[0], err[0], *mi); */
 }
 
+/* choose the dimensions to refine in the next step, storing them in
+   mis[] and returning how many there are.  The first is always mi, the
+   dimension with the largest error contribution.  If opt->refine_frac > 0,
+   it is followed by every other dimension whose degree is below maxm and
+   whose error contribution derr[] is at least refine_frac times that of
+   mi, in order of decreasing error, as long as the total number of new
+   points (refining each dimension in turn) stays within
+   opt->refine_overshoot times the number for mi alone, and within maxNew
+   (if nonzero).  The total number of new points is returned in *newpts. */
+static unsigned refine_dims(const nested_rule *r, unsigned maxm,
+			    const unsigned *m, unsigned mi, const double *derr,
+			    unsigned dim, const cubature_options *opt,
+			    size_t maxNew, unsigned *mis, size_t *newpts)
+{
+     unsigned mt[MAXDIM], nmi = 0, i;
+     double thresh;
+     size_t npts, maxpts;
+     int cand[MAXDIM];
+
+     memcpy(mt, m, sizeof(unsigned) * dim);
+     mt[mi] += 1;
+     npts = num_cacheval(r, mt, mi, dim);
+     mis[nmi++] = mi;
+     *newpts = npts;
+     if (!opt || opt->refine_frac <= 0)
+	  return nmi;
+
+     maxpts = opt->refine_overshoot > 0
+	  ? (size_t) (opt->refine_overshoot * npts) : 0;
+     if (maxNew && (!maxpts || maxNew < maxpts)) maxpts = maxNew;
+
+     thresh = opt->refine_frac * derr[mi];
+     for (i = 0; i < dim; ++i)
+	  cand[i] = i != mi && derr[i] >= thresh && m[i] < maxm;
+
+     while (1) {
+	  size_t n;
+	  unsigned best = dim;
+	  for (i = 0; i < dim; ++i)
+	       if (cand[i] && (best == dim || derr[i] > derr[best]))
+		    best = i;
+	  if (best == dim) break;
+	  cand[best] = 0;
+	  mt[best] += 1;
+	  n = num_cacheval(r, mt, best, dim);
+	  if (maxpts && npts + n > maxpts) {
+	       mt[best] -= 1; /* skip it, but a cheaper one may still fit */
+	       continue;
+	  }
+	  npts += n;
+	  mis[nmi++] = best;
+     }
+     *newpts = npts;
+     return nmi;
+}
+
 /***************************************************************************/
 
+CUBATURE_KERNEL
 static int converged(unsigned fdim, const double *vals, const double *errs,
 		     double reqAbsError, double reqRelError, error_norm norm)
 #define ERR(j) errs[j]
 #define VAL(j) vals[j]
 #include "converged.h"
 
+#include "statswrapper.h"
+
+/* record the current # cache entries and memory usage of pcubature_buf */
+static void cache_stats(cubature_stats *s, valcache vc, const nested_rule *r,
+			unsigned fdim, unsigned dim, size_t nbuf)
+{
+     size_t i, bytes = sizeof(double) * nbuf * dim
+	  + sizeof(cacheval) * vc.ncache;
+     for (i = 0; i < vc.ncache; ++i)
+	  bytes += sizeof(double) * fdim
+	       * num_cacheval(r, vc.c[i].m, vc.c[i].mi, dim);
+     stats_peak(s, vc.ncache, bytes);
+}
+
 /***************************************************************************/
-/* Vectorized version with user-supplied buffer to store points and values.
-   The buffer *buf should be of length *nbuf * dim on entry (these parameters
-   are changed upon return to the final buffer and length that was used).
-   The buffer length will be kept <= max(max_nbuf, 1) * dim.
+/* The integration is written as a state machine that returns to the
+   caller whenever it needs the integrand at a batch of points (see
+   pcubature_rc_next in cubature.h, and pcubature_buf below for the
+   usual driver).  Each step evaluates the integral with the current m
+   grid and, unless we are done, refines it and evaluates the
+   integrand at the new points in batches of at most *nbuf points
+   (where the buffer *buf is grown as needed up to max_nbuf points). */
 
-   Also allows the caller to specify an array m[dim] of starting degrees
-   for the rule, which upon return will hold the final degrees.  The
-   number of points in each dimension i is 2^(m[i]+1) + 1. */
-   
-int pcubature_v_buf(unsigned fdim, integrand_v f, void *fdata,
-		    unsigned dim, const double *xmin, const double *xmax,
-		    size_t maxEval,
-		    double reqAbsError, double reqRelError,
-		    error_norm norm,
-		    unsigned *m,
-		    double **buf, size_t *nbuf, size_t max_nbuf,
-		    double *val, double *err)
+#include "infwrapper.h"
+#include "procwrapper.h"
+
+#define DEFAULT_MAX_NBUF (1U << 20)
+
+#define RC_EVAL 0 /* evaluating the new cache entries */
+#define RC_WAIT 1 /* waiting for the integrand at a batch of points */
+#define RC_SELECT 2 /* checking for convergence & refining the grid */
+#define RC_DONE 3 /* finished, with the return value status */
+
+struct pcubature_rc_s {
+     unsigned fdim, dim;
+     size_t maxEval;
+     double reqAbsError, reqRelError;
+     error_norm norm;
+     cubature_options opt; /* a copy of the options (all 0 if none) */
+     const nested_rule *r;
+     unsigned maxm; /* the highest degree to use */
+     double xmin[MAXDIM], xmax[MAXDIM]; /* the (transformed) limits */
+     double V;
+
+     infwrap_data inf; /* change of variables for infinite limits */
+     stats_data sd;
+     cubature_stats *stats;
+     PROFILE_FIELD(c)
+
+     int stage, status;
+     unsigned *m; /* the current degrees (m_, or the caller's array) */
+     double **buf; /* the point buffer (buf_, or the caller's) */
+     size_t *nbuf, max_nbuf;
+     unsigned m_[MAXDIM];
+     double *buf_;
+     size_t nbuf_;
+
+     valcache vc;
+     /* the entries vc.c[0..ngrid-1] make up the current m grid; any
+	later ones are left from a previous call (see rc_reuse) */
+     size_t ngrid;
+     double *val, *err, *val1; /* the current estimates */
+     char *active; /* components still to be computed (NULL if unmasked), */
+     unsigned *iact, nact; /* and the list of their indices */
+     size_t numEval, numEval0;
+
+     size_t ic; /* entries vc.c[ic..] are being evaluated, */
+     grid_iter g; /* and the iterator g is over the points of vc.c[ic] */
+     double *fval; /* where the integrand values of the next batch go */
+     const double *x; /* the points of the pending batch (RC_WAIT) */
+     size_t npt; /* # points in the pending batch */
+     int initial; /* whether we are evaluating the initial grid */
+     int valid; /* whether vc holds all of the values for the m grid */
+     double t0;
+};
+
+/* set up s to integrate over [xmin, xmax], starting with the
+   evaluation of the m grid, unless vc is non-NULL and holds the values
+   from a previous integration (which are then taken over by s, which
+   starts again from their initial grid and reuses them as far as its
+   refinements follow the same path); if this fails, s->stage is
+   RC_DONE with s->status == FAILURE */
+static void rc_init(pcubature_rc *s, unsigned fdim, unsigned dim,
+		    const double *xmin, const double *xmax,
+		    size_t maxEval, double reqAbsError, double reqRelError,
+		    error_norm norm, const cubature_options *opt,
+		    unsigned *m, double **buf, size_t *nbuf, size_t max_nbuf,
+		    valcache *vc, int masked)
 {
-     int ret = FAILURE;
-     double V = 1;
-     size_t numEval = 0, new_nbuf;
+     size_t new_nbuf;
      unsigned i;
-     valcache vc = {0, NULL};
-     double *val1 = NULL;
 
-     if (fdim <= 1) norm = ERROR_INDIVIDUAL; /* norm is irrelevant */
-     if (norm < 0 || norm > ERROR_LINF) return FAILURE; /* invalid norm */
+     memset(s, 0, sizeof(pcubature_rc));
+     if (opt) s->opt = *opt;
+     s->fdim = fdim;
+     s->dim = dim;
+     s->maxEval = maxEval;
+     s->reqAbsError = reqAbsError;
+     s->reqRelError = reqRelError;
+     s->norm = fdim <= 1 ? ERROR_INDIVIDUAL : norm; /* norm is irrelevant */
+     s->m = m;
+     s->buf = buf;
+     s->nbuf = nbuf;
+     s->max_nbuf = max_nbuf < 1 ? 1 : max_nbuf;
+     s->stats = stats_begin(opt, &s->sd);
+     s->stage = RC_DONE;
+     s->status = FAILURE;
 
-     if (fdim == 0) return SUCCESS; /* nothing to do */
-     if (dim > MAXDIM) return FAILURE; /* unsupported */
-     if (dim == 0) { /* trivial case */
-	  if (f(0, 1, xmin, fdata, fdim, val)) return FAILURE;
-          for (i = 0; i < fdim; ++i) err[i] = 0;
-          return SUCCESS;
+     if (s->norm < 0 || s->norm > ERROR_LINF) return; /* invalid norm */
+
+     if (s->opt.rule == PCUBATURE_GAUSS_PATTERSON)
+	  s->r = &patterson_rules;
+     else if (s->opt.rule == PCUBATURE_CLENSHAW_CURTIS)
+	  s->r = &clencurt_rules;
+     else
+	  return; /* invalid rule */
+     s->maxm = s->opt.maxm ? s->opt.maxm : PCUBATURE_MAXM;
+     if (s->maxm > s->r->maxm) s->maxm = s->r->maxm;
+
+     if (fdim == 0) { /* nothing to do */
+	  s->status = SUCCESS;
+	  return;
+     }
+     if (dim > MAXDIM) return; /* unsupported */
+
+     s->val = (double *) malloc(sizeof(double) * fdim * 3);
+     if (!s->val) return;
+     s->err = s->val + fdim;
+     s->val1 = s->err + fdim;
+
+     if (masked) {
+	  s->active = (char *) malloc(fdim);
+	  s->iact = (unsigned *) malloc(sizeof(unsigned) * fdim);
+	  if (!s->active || !s->iact) return;
+	  memset(s->active, 1, fdim);
+	  for (i = 0; i < fdim; ++i) s->iact[i] = i;
+	  s->nact = fdim;
+     }
+
+     if (dim == 0) { /* trivial case: a single point */
+	  for (i = 0; i < fdim; ++i) s->err[i] = 0;
+	  s->x = s->fval = s->val; /* x has no coordinates */
+	  s->npt = 1;
+	  s->stage = RC_WAIT;
+	  stats_batch_begin(&s->sd);
+	  return;
      }
 
      for (i = 0; i < fdim; ++i) {
-	  val[i] = 0;
-	  err[i] = HUGE_VAL;
+	  s->val[i] = 0;
+	  s->err[i] = HUGE_VAL;
      }
 
+     if (infwrap_init(&s->inf, dim, xmin, xmax)) return;
+     if (s->inf.kind) { /* transform infinite limits */
+	  xmin = s->inf.tmin;
+	  xmax = s->inf.tmax;
+     }
+     memcpy(s->xmin, xmin, sizeof(double) * dim);
+     memcpy(s->xmax, xmax, sizeof(double) * dim);
+
+     s->V = 1;
      for (i = 0; i < dim; ++i)
-	  V *= (xmax[i] - xmin[i]) * 0.5; /* scale factor for C-C volume */
+	  s->V *= (xmax[i] - xmin[i]) * 0.5; /* scale factor for C-C volume */
 
-     new_nbuf = num_cacheval(m, dim, dim);
+     s->t0 = s->opt.maxTime > 0 ? stats_time() : 0;
+     PROFILE_START(s->stats, s->c);
+     if (vc && vc->ncache > 0) { /* warm start */
+	  s->vc = *vc;
+	  vc->ncache = 0;
+	  vc->c = NULL;
+	  memcpy(m, s->vc.c[0].m, sizeof(unsigned) * dim);
+	  s->ngrid = 1;
+	  s->valid = 1;
+	  if (s->stats) cache_stats(s->stats, s->vc, s->r, fdim, dim, *nbuf);
+	  s->stage = RC_SELECT;
+	  return;
+     }
+     s->numEval0 = new_nbuf = num_cacheval(s->r, m, dim, dim);
 
-     if (max_nbuf < 1) max_nbuf = 1;
-     if (new_nbuf > max_nbuf) new_nbuf = max_nbuf;
+     if (new_nbuf > s->max_nbuf) new_nbuf = s->max_nbuf;
      if (*nbuf < new_nbuf) {
 	  free(*buf);
-	  *buf = (double *) malloc(sizeof(double) 
+	  *buf = (double *) malloc(sizeof(double)
 				   * (*nbuf = new_nbuf) * dim);
-	  if (!*buf) goto done;
+	  if (!*buf) goto bad;
      }
 
      /* start by evaluating the m=0 cubature rule */
-     if (add_cacheval(&vc, m, dim, fdim, f, fdata, dim, xmin, xmax, 
-		       *buf, *nbuf) != SUCCESS)
-	  goto done;
+     if (!(s->fval = add_cachevals(&s->vc, s->r, m, &dim, 1, fdim, dim)))
+	  goto bad;
+     s->ngrid = 1;
+     grid_init(&s->g, s->r, s->vc.c[0].m, dim, dim, s->xmin, s->xmax);
+     s->initial = 1;
+     s->stage = RC_EVAL;
+     return;
 
-     val1 = (double *) malloc(sizeof(double) * fdim);
+bad:
+     PROFILE_LAP(s->stats, CUBATURE_PHASE_CONVERGED, s->c);
+     if (s->stats)
+	  for (i = 0; i < dim && i < CUBATURE_STATS_MAXDIM; ++i)
+	       s->stats->m[i] = m[i];
+}
 
-     while (1) {
-	  unsigned mi;
+/* With a masked integrand and ERROR_INDIVIDUAL, retire the active
+   components whose errors satisfy the tolerance: from now on, they are
+   not computed by the integrand or by eval_integral, so that their
+   estimates are frozen.  (Their cached values on finer grids are
+   garbage, but they are never used.) */
+static void rc_retire(pcubature_rc *s)
+{
+     unsigned j, k, n = 0;
+     if (!s->active || s->norm != ERROR_INDIVIDUAL) return;
+     for (k = 0; k < s->nact; ++k) {
+	  j = s->iact[k];
+	  if (s->err[j] <= s->reqAbsError
+	      || s->err[j] <= fabs(s->val[j]) * s->reqRelError)
+	       s->active[j] = 0;
+	  else
+	       s->iact[n++] = j;
+     }
+     s->nact = n;
+}
 
-	  eval_integral(vc, m, fdim, dim, V, &mi, val, err, val1);
-	  if (converged(fdim, val, err, reqAbsError, reqRelError, norm)
-	      || (numEval > maxEval && maxEval)) {
-	       ret = SUCCESS;
-	       goto done;
+/* If the cache entries after the current grid are those of refining
+   the dimensions mis[0..nmi-1] of m in turn, left from a previous call,
+   refine m to include them and return 1.  Otherwise, discard any
+   entries after the current grid (the refinements have diverged from
+   those of the previous call) and return 0.  (The entries of finer
+   grids along the same path are never summed by evals, since each of
+   them has a higher degree in its dimension mi than m.) */
+static int rc_reuse(pcubature_rc *s, const unsigned *mis, unsigned nmi)
+{
+     unsigned dim = s->dim, k, mk[MAXDIM];
+     size_t i;
+
+     if (s->ngrid + nmi <= s->vc.ncache) {
+	  memcpy(mk, s->m, sizeof(unsigned) * dim);
+	  for (k = 0; k < nmi; ++k) {
+	       const cacheval *c = s->vc.c + s->ngrid + k;
+	       mk[mis[k]] += 1;
+	       if (c->mi != mis[k]
+		   || memcmp(c->m, mk, sizeof(unsigned) * dim))
+		    break;
 	  }
-	  m[mi] += 1;
-	  if (m[mi] > clencurt_M) goto done; /* FAILURE */
-
-	  new_nbuf = num_cacheval(m, mi, dim);
-	  if (new_nbuf > *nbuf && *nbuf < max_nbuf) {
-	       *nbuf = new_nbuf;
-	       if (*nbuf > max_nbuf) *nbuf = max_nbuf;
-	       free(*buf);
-	       *buf = (double *) malloc(sizeof(double) * *nbuf * dim);
-	       if (!*buf) goto done; /* FAILURE */
+	  if (k == nmi) {
+	       memcpy(s->m, mk, sizeof(unsigned) * dim);
+	       s->ngrid += nmi;
+	       return 1;
 	  }
+     }
+     for (i = s->ngrid; i < s->vc.ncache; ++i)
+	  if (s->vc.c[i].own_val)
+	       free(s->vc.c[i].val);
+     s->vc.ncache = s->ngrid;
+     return 0;
+}
 
-	  if (add_cacheval(&vc, m, mi, fdim, f, fdata, 
-			   dim, xmin, xmax, *buf, *nbuf) != SUCCESS)
-	       goto done; /* FAILURE */
-	  numEval += new_nbuf;
+/* one step of the adaptive loop: evaluate the integral and, unless we
+   are done, refine the grid (stage RC_EVAL).  Returns nonzero if we
+   are done (with the return value in s->status) or on failure. */
+static int rc_select(pcubature_rc *s)
+{
+     const nested_rule *r = s->r;
+     unsigned fdim = s->fdim, dim = s->dim;
+     unsigned *m = s->m;
+     cubature_stats *stats = s->stats;
+     const cubature_options *opt = &s->opt;
+     size_t maxEval = s->maxEval, numEval = s->numEval, maxNew, new_nbuf;
+     size_t maxTimeNew = 0;
+     unsigned mi, nmi, mis[MAXDIM];
+     double derr[MAXDIM], t = 0;
+
+     PROFILE_LAP(stats, CUBATURE_PHASE_HEAP, s->c);
+     eval_integral(s->vc, r, m, fdim, s->iact, s->nact, dim, s->V, &mi,
+		   s->val, s->err, s->val1, derr);
+     PROFILE_LAP(stats, CUBATURE_PHASE_RULE, s->c);
+     if (opt->progress
+	 && opt->progress(opt->progress_data, fdim, s->val, s->err,
+			  s->numEval0 + numEval, s->vc.ncache)) {
+	  if (stats) stats->reason = CUBATURE_STOPPED;
+	  s->status = SUCCESS;
+	  return 1;
+     }
+     if (converged(fdim, s->val, s->err,
+		   s->reqAbsError, s->reqRelError, s->norm)) {
+	  s->status = SUCCESS;
+	  return 1;
+     }
+     if (numEval > maxEval && maxEval) {
+	  if (stats) stats->reason = CUBATURE_MAXEVAL;
+	  s->status = SUCCESS;
+	  return 1;
      }
+     rc_retire(s);
+     if (m[mi] + 1 > s->maxm) {
+	  if (stats) stats->reason = CUBATURE_MAXDEGREE;
+	  return 1; /* FAILURE */
+     }
+     if (opt->maxTime > 0 && (t = stats_time() - s->t0) >= opt->maxTime) {
+	  if (stats) stats->reason = CUBATURE_MAXTIME;
+	  s->status = CUBATURE_TIMEOUT;
+	  return 1;
+     }
+     PROFILE_LAP(stats, CUBATURE_PHASE_CONVERGED, s->c);
+
+     /* limit the new points to the remaining maxEval and (judging by
+	the time per point so far) the remaining maxTime */
+     maxNew = maxEval ? (numEval < maxEval ? maxEval - numEval : 1) : 0;
+     if (t > 0) {
+	  maxTimeNew = (size_t) ((opt->maxTime - t) / t
+				 * (s->numEval0 + numEval)) + 1;
+	  if (!maxNew || maxTimeNew < maxNew) maxNew = maxTimeNew;
+     }
+     nmi = refine_dims(r, s->maxm, m, mi, derr, dim, opt, maxNew, mis,
+		       &new_nbuf);
+     if (rc_reuse(s, mis, nmi)) { /* no new points are needed */
+	  if (stats) stats->numSteps += 1;
+	  return 0;
+     }
+     if (maxTimeNew && new_nbuf > maxTimeNew) {
+	  /* even refining mi alone would probably miss the deadline */
+	  if (stats) stats->reason = CUBATURE_MAXTIME;
+	  s->status = CUBATURE_TIMEOUT;
+	  return 1;
+     }
+     s->numEval += new_nbuf;
+
+     if (new_nbuf > *s->nbuf && *s->nbuf < s->max_nbuf) {
+	  *s->nbuf = new_nbuf;
+	  if (*s->nbuf > s->max_nbuf) *s->nbuf = s->max_nbuf;
+	  free(*s->buf);
+	  *s->buf = (double *) malloc(sizeof(double) * *s->nbuf * dim);
+	  if (!*s->buf) return 1; /* FAILURE */
+     }
+
+     PROFILE_LAP(stats, CUBATURE_PHASE_HEAP, s->c);
+     s->valid = 0;
+     s->ic = s->vc.ncache;
+     if (!(s->fval = add_cachevals(&s->vc, r, m, mis, nmi, fdim, dim)))
+	  return 1; /* FAILURE */
+     s->ngrid = s->vc.ncache;
+     grid_init(&s->g, r, s->vc.c[s->ic].m, s->vc.c[s->ic].mi, dim,
+	       s->xmin, s->xmax);
+     s->initial = 0;
+     s->stage = RC_EVAL;
+     return 0;
+}
+
+/* run the integration until the integrand is needed (stage RC_WAIT)
+   or we are done (stage RC_DONE) */
+static void rc_advance(pcubature_rc *s)
+{
+     unsigned dim = s->dim, i;
+     size_t n;
+
+     while (s->stage == RC_EVAL || s->stage == RC_SELECT) {
+	  if (s->stage == RC_SELECT) {
+	       if (rc_select(s)) goto done;
+	       continue;
+	  }
+	  /* fill the buffer with the next points of the new entries */
+	  n = 0;
+	  while (s->ic < s->vc.ncache) {
+	       n += grid_points(&s->g, *s->buf + n * dim, *s->nbuf - n);
+	       if (n == *s->nbuf) break;
+	       if (++s->ic < s->vc.ncache)
+		    grid_init(&s->g, s->r, s->vc.c[s->ic].m, s->vc.c[s->ic].mi,
+			      dim, s->xmin, s->xmax);
+	  }
+	  if (n > 0) {
+	       s->npt = n;
+	       s->x = *s->buf;
+	       if (s->inf.kind
+		   && !(s->x = infwrap_points(&s->inf, n, *s->buf))) {
+		    s->status = FAILURE;
+		    goto done;
+	       }
+	       s->stage = RC_WAIT;
+	       stats_batch_begin(&s->sd);
+	       return;
+	  }
+	  PROFILE_LAP(s->stats, CUBATURE_PHASE_POINTS, s->c);
+	  s->valid = 1;
+	  if (s->stats) {
+	       if (!s->initial) s->stats->numSteps += 1;
+	       cache_stats(s->stats, s->vc, s->r, s->fdim, dim, *s->nbuf);
+	  }
+	  s->stage = RC_SELECT;
+     }
+     return;
 
 done:
-     free(val1);
-     free_cachevals(&vc);
+     PROFILE_LAP(s->stats, CUBATURE_PHASE_CONVERGED, s->c);
+     if (s->stats)
+	  for (i = 0; i < dim && i < CUBATURE_STATS_MAXDIM; ++i)
+	       s->stats->m[i] = s->m[i];
+     s->stage = RC_DONE;
+}
+
+static int rc_submit(pcubature_rc *s, const double *fval)
+{
+     if (s->stage != RC_WAIT) return FAILURE;
+     stats_batch_end(&s->sd, s->npt);
+     if (fval != s->fval)
+	  memcpy(s->fval, fval, sizeof(double) * s->npt * s->fdim);
+     if (s->dim == 0) {
+	  s->status = SUCCESS;
+	  s->stage = RC_DONE;
+	  return SUCCESS;
+     }
+     if (s->inf.kind)
+	  infwrap_values(&s->inf, s->npt, s->fdim, s->fval);
+     s->fval += s->npt * s->fdim;
+     s->stage = RC_EVAL;
+     return SUCCESS;
+}
+
+/* store the results of s in val and err, free everything, and return
+   the status (FAILURE if the integration was not finished).  If vc is
+   non-NULL, the cached values are moved to *vc if they are complete
+   for the final m grid (and are freed otherwise). */
+static int rc_finish(pcubature_rc *s, double *val, double *err,
+		     valcache *vc)
+{
+     int ret = s->stage == RC_DONE ? s->status : FAILURE;
+     if (s->val) {
+	  memcpy(val, s->val, sizeof(double) * s->fdim);
+	  memcpy(err, s->err, sizeof(double) * s->fdim);
+     }
+     free(s->val);
+     free(s->active);
+     free(s->iact);
+     if (vc && s->valid) {
+	  *vc = s->vc;
+	  s->vc.ncache = 0;
+	  s->vc.c = NULL;
+     }
+     free_cachevals(&s->vc);
+     infwrap_free(&s->inf);
+     stats_end(&s->sd, ret);
+     return ret;
+}
+
+/* the usual driver of the state machine, calling f for each batch.  On
+   entry, *buf is of length *nbuf * dim (these parameters are changed
+   upon return to the final buffer and length that was used), and m
+   holds the starting degrees (on return, the final degrees).  If vc is
+   non-NULL, it holds the cached values (if any) for the m grid from a
+   previous call on entry, and those for the final m grid (if
+   available) on return, as in rc_init and rc_finish. */
+static int pcubature_buf(unsigned fdim, integrand_v f, integrand_vm fm,
+			 void *fdata,
+			 unsigned dim, const double *xmin, const double *xmax,
+			 size_t maxEval,
+			 double reqAbsError, double reqRelError,
+			 error_norm norm,
+			 unsigned *m,
+			 double **buf, size_t *nbuf, size_t max_nbuf,
+			 const cubature_options *opt, valcache *vc,
+			 double *val, double *err)
+{
+     pcubature_rc s;
+     rc_init(&s, fdim, dim, xmin, xmax, maxEval, reqAbsError, reqRelError,
+	     norm, opt, m, buf, nbuf, max_nbuf, vc, fm != NULL);
+     for (rc_advance(&s); s.stage == RC_WAIT; rc_advance(&s)) {
+	  if (fm ? fm(dim, s.npt, s.x, fdata, fdim, s.active, s.fval)
+	      : f(dim, s.npt, s.x, fdata, fdim, s.fval))
+	       break;
+	  rc_submit(&s, s.fval);
+     }
+     return rc_finish(&s, val, err, vc);
+}
+
+pcubature_rc *pcubature_rc_begin(unsigned fdim, unsigned dim,
+				 const double *xmin, const double *xmax,
+				 size_t maxEval,
+				 double reqAbsError, double reqRelError,
+				 error_norm norm, const cubature_options *opt)
+{
+     pcubature_rc *s = (pcubature_rc *) malloc(sizeof(pcubature_rc));
+     if (s) {
+	  size_t max_nbuf = opt && opt->max_batch ? opt->max_batch
+	       : DEFAULT_MAX_NBUF;
+	  memset(s->m_, 0, sizeof(s->m_));
+	  s->buf_ = NULL;
+	  s->nbuf_ = 0;
+	  rc_init(s, fdim, dim, xmin, xmax, maxEval,
+		  reqAbsError, reqRelError, norm, opt,
+		  s->m_, &s->buf_, &s->nbuf_, max_nbuf, NULL, 0);
+     }
+     return s;
+}
+
+int pcubature_rc_next(pcubature_rc *s, const double **x, size_t *npt)
+{
+     rc_advance(s);
+     if (s->stage != RC_WAIT) return 0;
+     *x = s->x;
+     *npt = s->npt;
+     return 1;
+}
+
+int pcubature_rc_submit(pcubature_rc *s, const double *fval)
+{
+     return rc_submit(s, fval);
+}
+
+int pcubature_rc_end(pcubature_rc *s, double *val, double *err)
+{
+     double *buf = *s->buf;
+     int ret = rc_finish(s, val, err, NULL);
+     free(buf);
+     free(s);
      return ret;
 }
 
 /***************************************************************************/
+/* Vectorized version with user-supplied buffer to store points and values.
+   The buffer *buf should be of length *nbuf * dim on entry (these parameters
+   are changed upon return to the final buffer and length that was used).
+   The buffer length will be kept <= max(max_nbuf, 1) * dim.
 
-#define DEFAULT_MAX_NBUF (1U << 20)
+   Also allows the caller to specify an array m[dim] of starting degrees
+   for the rule, which upon return will hold the final degrees.  The
+   number of points in each dimension i is 2^(m[i]+1) + 1 (or 2^(m[i]+2) - 1
+   with Gauss-Patterson rules). */
+
+int pcubature_v_buf(unsigned fdim, integrand_v f, void *fdata,
+		    unsigned dim, const double *xmin, const double *xmax,
+		    size_t maxEval,
+		    double reqAbsError, double reqRelError,
+		    error_norm norm,
+		    unsigned *m,
+		    double **buf, size_t *nbuf, size_t max_nbuf,
+		    double *val, double *err)
+{
+     return pcubature_buf(fdim, f, NULL, fdata, dim, xmin, xmax,
+			  maxEval, reqAbsError, reqRelError, norm,
+			  m, buf, nbuf, max_nbuf, NULL, NULL, val, err);
+}
+
+/***************************************************************************/
 
 int pcubature_v(unsigned fdim, integrand_v f, void *fdata,
 		unsigned dim, const double *xmin, const double *xmax,
@@ -398,6 +2036,116 @@ int pcubature_v(unsigned fdim, integrand_v f, void *fdata,
      return ret;
 }
 
+int pcubature_ex(unsigned fdim, integrand_v f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err)
+{
+     int ret;
+     size_t nbuf = 0;
+     unsigned m[MAXDIM];
+     double *buf = NULL;
+     proc_data d;
+     if (dim > MAXDIM) return FAILURE; /* unsupported */
+     memset(m, 0, sizeof(unsigned) * dim);
+     if (opt && opt->nprocs > 1 && fdim > 0) {
+	  proc_init(&d, opt->nprocs, f, fdata, dim, fdim, opt->max_batch);
+	  f = proc_f;
+	  fdata = &d;
+     }
+     ret = pcubature_buf(fdim, f, NULL, fdata, dim, xmin, xmax,
+			 maxEval, reqAbsError, reqRelError, norm,
+			 m, &buf, &nbuf,
+			 opt && opt->max_batch ? opt->max_batch : DEFAULT_MAX_NBUF,
+			 opt, NULL, val, err);
+     if (fdata == &d) proc_free(&d);
+     free(buf);
+     return ret;
+}
+
+int pcubature_vm(unsigned fdim, integrand_vm f, void *fdata,
+		 unsigned dim, const double *xmin, const double *xmax,
+		 size_t maxEval, double reqAbsError, double reqRelError,
+		 error_norm norm, const cubature_options *opt,
+		 double *val, double *err)
+{
+     int ret;
+     size_t nbuf = 0;
+     unsigned m[MAXDIM];
+     double *buf = NULL;
+     if (dim > MAXDIM) return FAILURE; /* unsupported */
+     memset(m, 0, sizeof(unsigned) * dim);
+     ret = pcubature_buf(fdim, NULL, f, fdata, dim, xmin, xmax,
+			 maxEval, reqAbsError, reqRelError, norm,
+			 m, &buf, &nbuf,
+			 opt && opt->max_batch ? opt->max_batch : DEFAULT_MAX_NBUF,
+			 opt, NULL, val, err);
+     free(buf);
+     return ret;
+}
+
+/***************************************************************************/
+/* A context for repeated integrations of the same integrand over the
+   same domain, which keeps the cached values (and the m grid and the
+   buffer) between calls, so that each call only evaluates the
+   integrand on grid levels that are not cached yet. */
+
+struct pcubature_ctx_s {
+     unsigned fdim, dim;
+     integrand_v f;
+     void *fdata;
+     double xmin[MAXDIM], xmax[MAXDIM];
+     cubature_options opt; /* a copy of the options (all 0 if none) */
+     unsigned m[MAXDIM]; /* the grid of the cached values */
+     valcache vc; /* the cached values, if any */
+     double *buf;
+     size_t nbuf;
+};
+
+pcubature_ctx *pcubature_ctx_new(unsigned fdim, integrand_v f, void *fdata,
+				 unsigned dim,
+				 const double *xmin, const double *xmax,
+				 const cubature_options *opt)
+{
+     pcubature_ctx *ctx;
+     if (dim > MAXDIM) return NULL; /* unsupported */
+     ctx = (pcubature_ctx *) malloc(sizeof(pcubature_ctx));
+     if (!ctx) return NULL;
+     memset(ctx, 0, sizeof(pcubature_ctx));
+     ctx->fdim = fdim;
+     ctx->dim = dim;
+     ctx->f = f;
+     ctx->fdata = fdata;
+     memcpy(ctx->xmin, xmin, sizeof(double) * dim);
+     memcpy(ctx->xmax, xmax, sizeof(double) * dim);
+     if (opt) ctx->opt = *opt;
+     return ctx;
+}
+
+int pcubature_ctx_integrate(pcubature_ctx *ctx, size_t maxEval,
+			    double reqAbsError, double reqRelError,
+			    error_norm norm, double *val, double *err)
+{
+     if (ctx->vc.ncache == 0) /* start from scratch */
+	  memset(ctx->m, 0, sizeof(ctx->m));
+     return pcubature_buf(ctx->fdim, ctx->f, NULL, ctx->fdata,
+			  ctx->dim, ctx->xmin, ctx->xmax,
+			  maxEval, reqAbsError, reqRelError, norm,
+			  ctx->m, &ctx->buf, &ctx->nbuf,
+			  ctx->opt.max_batch ? ctx->opt.max_batch
+			  : DEFAULT_MAX_NBUF,
+			  &ctx->opt, &ctx->vc, val, err);
+}
+
+void pcubature_ctx_destroy(pcubature_ctx *ctx)
+{
+     if (!ctx) return;
+     free_cachevals(&ctx->vc);
+     free(ctx->buf);
+     free(ctx);
+}
+
 #include "vwrapper.h"
 
 int pcubature(unsigned fdim, integrand f, void *fdata,
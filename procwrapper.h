@@ -0,0 +1,227 @@
+/* Evaluation of a vectorized integrand by worker processes (see
+   cubature_options.nprocs), for integrands that are not thread-safe.
+
+   proc_init forks the workers once per integration.  Each batch of
+   points passed to proc_f is copied into a buffer of shared memory,
+   split into one contiguous chunk per worker, and each worker calls the
+   integrand on its chunk, storing the values directly in a shared
+   buffer in the usual fval layout.  The commands ("evaluate the points
+   offset..offset+n-1") and the integrand return values are exchanged
+   over a socket per worker, which also wakes up the worker.  Batches of
+   more than maxpts points (the size of the shared buffers) are
+   evaluated in several rounds.
+
+   If the workers cannot be started (or on Windows, where there is no
+   fork), proc_f simply calls the integrand itself.  Since the workers
+   are separate processes, any side effects of the integrand (e.g.
+   counting its calls in a global variable) are not seen by the caller.
+   (The including file must #define _POSIX_C_SOURCE before including
+   any system header.) */
+
+#if !defined(_WIN32)
+#  include <stdio.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/types.h>
+#  include <sys/mman.h>
+#  include <sys/socket.h>
+#  include <sys/wait.h>
+#  define PROC_FORK 1
+#  ifndef MSG_NOSIGNAL /* don't die of SIGPIPE if a worker crashed */
+#    define MSG_NOSIGNAL 0
+#  endif
+#endif
+
+#define PROC_DEFAULT_MAXPTS 65536
+
+typedef struct proc_data_s {
+     integrand_v f;
+     void *fdata;
+     unsigned dim, fdim;
+     unsigned n; /* # worker processes (0 if f is called directly) */
+#ifdef PROC_FORK
+     pid_t *pid; /* arrays of length n */
+     int *fd; /* our ends of the sockets */
+     double *x, *fval; /* shared buffers of maxpts points & values */
+     size_t maxpts, shmsize;
+#endif
+} proc_data;
+
+#ifdef PROC_FORK
+typedef struct {
+     size_t offset, n; /* the points of the chunk (n == 0: exit) */
+} proc_cmd;
+
+static int proc_write(int fd, const void *buf, size_t len)
+{
+     const char *p = (const char *) buf;
+     while (len > 0) {
+	  ssize_t k = send(fd, p, len, MSG_NOSIGNAL);
+	  if (k < 0 && errno == EINTR) continue;
+	  if (k <= 0) return FAILURE;
+	  p += k; len -= (size_t) k;
+     }
+     return SUCCESS;
+}
+
+static int proc_read(int fd, void *buf, size_t len)
+{
+     char *p = (char *) buf;
+     while (len > 0) {
+	  ssize_t k = recv(fd, p, len, 0);
+	  if (k < 0 && errno == EINTR) continue;
+	  if (k <= 0) return FAILURE; /* error, or the other end exited */
+	  p += k; len -= (size_t) k;
+     }
+     return SUCCESS;
+}
+
+/* the main loop of a worker, which never returns */
+static void proc_worker(proc_data *d, int fd)
+{
+     proc_cmd c;
+     int ret;
+     while (!proc_read(fd, &c, sizeof(c)) && c.n > 0) {
+	  ret = d->f(d->dim, c.n, d->x + c.offset * d->dim, d->fdata,
+		     d->fdim, d->fval + c.offset * d->fdim);
+	  if (proc_write(fd, &ret, sizeof(ret))) break;
+     }
+     fflush(NULL); /* any output of the integrand */
+     _exit(0);
+}
+
+/* allocate n bytes of memory that is shared with forked processes,
+   or return NULL */
+static void *proc_shm(size_t n)
+{
+     void *p;
+#  if defined(MAP_ANONYMOUS) || defined(MAP_ANON)
+#    ifndef MAP_ANONYMOUS
+#      define MAP_ANONYMOUS MAP_ANON
+#    endif
+     p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+	      -1, 0);
+#  else
+     int fd = open("/dev/zero", O_RDWR);
+     if (fd < 0) return NULL;
+     p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+     close(fd);
+#  endif
+     return p == MAP_FAILED ? NULL : p;
+}
+#endif /* PROC_FORK */
+
+static void proc_free(proc_data *d)
+{
+#ifdef PROC_FORK
+     unsigned i;
+     for (i = 0; i < d->n; ++i) close(d->fd[i]); /* workers see EOF */
+     for (i = 0; i < d->n; ++i)
+	  while (waitpid(d->pid[i], NULL, 0) < 0 && errno == EINTR) ;
+     if (d->x) munmap(d->x, d->shmsize);
+     free(d->pid);
+     d->pid = NULL;
+     d->fd = NULL;
+     d->x = d->fval = NULL;
+#endif
+     d->n = 0;
+}
+
+/* Set up d to evaluate f on nprocs workers, in batches of at most
+   maxpts points (0 for the default).  If this is impossible, d->n is
+   0 and proc_f just calls f; this never fails. */
+static void proc_init(proc_data *d, unsigned nprocs, integrand_v f,
+		      void *fdata, unsigned dim, unsigned fdim,
+		      size_t maxpts)
+{
+#ifdef PROC_FORK
+     unsigned i;
+#endif
+     d->f = f;
+     d->fdata = fdata;
+     d->dim = dim;
+     d->fdim = fdim;
+     d->n = 0;
+#ifdef PROC_FORK
+     d->maxpts = maxpts ? maxpts : PROC_DEFAULT_MAXPTS;
+     d->shmsize = sizeof(double) * d->maxpts * (dim + fdim);
+     d->pid = (pid_t *) malloc((sizeof(pid_t) + sizeof(int)) * nprocs);
+     d->x = NULL;
+     if (!d->pid || !d->shmsize
+	 || !(d->x = (double *) proc_shm(d->shmsize))) {
+	  proc_free(d);
+	  return;
+     }
+     d->fd = (int *) (d->pid + nprocs);
+     d->fval = d->x + d->maxpts * dim;
+     fflush(NULL); /* don't duplicate our buffered output in the workers */
+     for (i = 0; i < nprocs; ++i) {
+	  int sv[2];
+	  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) break;
+	  d->pid[i] = fork();
+	  if (d->pid[i] == 0) { /* the worker */
+	       unsigned j;
+	       for (j = 0; j < i; ++j) close(d->fd[j]);
+	       close(sv[0]);
+	       proc_worker(d, sv[1]);
+	  }
+	  close(sv[1]);
+	  if (d->pid[i] < 0) {
+	       close(sv[0]);
+	       break;
+	  }
+	  d->fd[i] = sv[0];
+	  d->n = i + 1;
+     }
+     if (d->n < 2) /* no point in using a single worker */
+	  proc_free(d);
+#else
+     (void) nprocs; (void) maxpts;
+#endif
+}
+
+#ifdef PROC_FORK
+/* evaluate the integrand at npt points x on the d->n workers */
+static int proc_eval(proc_data *d, size_t npt, const double *x,
+		     double *fval)
+{
+     unsigned ndim = d->dim, fdim = d->fdim;
+     int failed = 0;
+     while (npt > 0 && !failed) {
+	  size_t m = npt < d->maxpts ? npt : d->maxpts;
+	  size_t chunk = (m + d->n - 1) / d->n;
+	  unsigned i, nsent = 0;
+	  proc_cmd c;
+	  memcpy(d->x, x, sizeof(double) * m * ndim);
+	  for (c.offset = 0; c.offset < m; c.offset += chunk, ++nsent) {
+	       c.n = m - c.offset < chunk ? m - c.offset : chunk;
+	       if (proc_write(d->fd[nsent], &c, sizeof(c))) {
+		    failed = 1;
+		    break;
+	       }
+	  }
+	  for (i = 0; i < nsent; ++i) { /* wait for all of them */
+	       int ret;
+	       if (proc_read(d->fd[i], &ret, sizeof(ret)) || ret)
+		    failed = 1;
+	  }
+	  memcpy(fval, d->fval, sizeof(double) * m * fdim);
+	  x += m * ndim;
+	  fval += m * fdim;
+	  npt -= m;
+     }
+     return failed ? FAILURE : SUCCESS;
+}
+#endif
+
+/* the integrand_v that evaluates d->f on the workers of d = d_ */
+static int proc_f(unsigned ndim, size_t npt, const double *x, void *d_,
+		  unsigned fdim, double *fval)
+{
+     proc_data *d = (proc_data *) d_;
+#ifdef PROC_FORK
+     if (d->n > 0) return proc_eval(d, npt, x, fval);
+#endif
+     return d->f(ndim, npt, x, d->fdata, fdim, fval);
+}
@@ -0,0 +1,130 @@
+/* Optional instrumentation of the phases of an integration (see
+   phase_cycles and counters in cubature_stats), enabled by compiling
+   the library with -DCUBATURE_PROFILE.  Otherwise, all of the PROFILE_
+   macros expand to nothing, so that there is no cost at all.
+
+   A prof_clock measures the time between successive "laps" with the
+   processor's cycle counter (or with a wall-clock timer in nanoseconds
+   where no cycle counter is available), and PROFILE_LAP(s, phase, c)
+   adds the time since the previous lap of c to s->phase_cycles[phase],
+   excluding the time spent in the integrand meanwhile (which
+   stats_batch_end adds to CUBATURE_PHASE_INTEGRAND).  All of the macros do nothing if
+   s is NULL (no statistics were requested).
+
+   On Linux, the hardware counters are read with perf_event_open for the
+   whole integration (if permitted by the kernel), which requires the
+   including file to #define _GNU_SOURCE before any system header. */
+
+#ifdef CUBATURE_PROFILE
+
+#if defined(__linux__)
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <sys/ioctl.h>
+#  include <unistd.h>
+#endif
+
+static double prof_cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+     unsigned lo, hi;
+     __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+     return hi * 4294967296.0 + lo;
+#elif defined(__GNUC__) && defined(__aarch64__)
+     unsigned long t;
+     __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (t));
+     return (double) t;
+#else
+     return stats_time() * 1e9;
+#endif
+}
+
+typedef struct {
+     double t; /* cycle counter at the previous lap */
+     double tf; /* phase_cycles[CUBATURE_PHASE_INTEGRAND] at the previous lap */
+} prof_clock;
+
+#  define PROFILE_DECL(c) prof_clock c = { 0, 0 };
+#  define PROFILE_FIELD(c) prof_clock c; /* in a struct */
+#  define PROFILE_START(s, c) do { if (s) { \
+	       (c).t = prof_cycles(); \
+	       (c).tf = (s)->phase_cycles[CUBATURE_PHASE_INTEGRAND]; } \
+     } while (0)
+#  define PROFILE_LAP(s, phase, c) do { if (s) { \
+	       double prof_t_ = prof_cycles(); \
+	       double prof_tf_ = (s)->phase_cycles[CUBATURE_PHASE_INTEGRAND]; \
+	       (s)->phase_cycles[phase] += prof_t_ - (c).t - (prof_tf_ - (c).tf); \
+	       (c).t = prof_t_; (c).tf = prof_tf_; } \
+     } while (0)
+
+/***************************************************************************/
+/* hardware counters */
+
+#if defined(__linux__) && defined(__NR_perf_event_open)
+static const unsigned prof_counter_config[CUBATURE_NCOUNTERS] = {
+     PERF_COUNT_HW_CPU_CYCLES,
+     PERF_COUNT_HW_INSTRUCTIONS,
+     PERF_COUNT_HW_CACHE_MISSES,
+     PERF_COUNT_HW_BRANCH_MISSES
+};
+#  define PROF_PERF 1
+#endif
+
+typedef struct {
+     int fd[CUBATURE_NCOUNTERS]; /* perf_event file descriptors, or -1 */
+} prof_counters;
+
+/* open and start the counters (those that can't be opened are -1) */
+static void prof_counters_start(prof_counters *pc)
+{
+     unsigned i;
+     for (i = 0; i < CUBATURE_NCOUNTERS; ++i) {
+	  pc->fd[i] = -1;
+#ifdef PROF_PERF
+	  {
+	       struct perf_event_attr attr;
+	       memset(&attr, 0, sizeof(attr));
+	       attr.type = PERF_TYPE_HARDWARE;
+	       attr.size = sizeof(attr);
+	       attr.config = prof_counter_config[i];
+	       attr.disabled = 1;
+	       attr.exclude_kernel = 1;
+	       attr.exclude_hv = 1;
+	       pc->fd[i] = (int) syscall(__NR_perf_event_open, &attr,
+					 0, -1, -1, 0);
+	       if (pc->fd[i] >= 0) {
+		    ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+		    ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	       }
+	  }
+#endif
+     }
+}
+
+/* stop and close the counters, storing their values in counters[]
+   (-1 for those that are unavailable) */
+static void prof_counters_stop(prof_counters *pc, double *counters)
+{
+     unsigned i;
+     for (i = 0; i < CUBATURE_NCOUNTERS; ++i) {
+	  counters[i] = -1;
+#ifdef PROF_PERF
+	  if (pc->fd[i] >= 0) {
+	       __u64 v;
+	       ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	       if (read(pc->fd[i], &v, sizeof(v)) == sizeof(v))
+		    counters[i] = (double) v;
+	       close(pc->fd[i]);
+	  }
+#endif
+     }
+}
+
+#else /* !CUBATURE_PROFILE */
+
+#  define PROFILE_DECL(c)
+#  define PROFILE_FIELD(c)
+#  define PROFILE_START(s, c)
+#  define PROFILE_LAP(s, phase, c)
+
+#endif /* !CUBATURE_PROFILE */
@@ -0,0 +1,109 @@
+/* Statistics of an integration (see cubature_stats in cubature.h): a
+   wall-clock timer, and the counting and timing of the batches of
+   points that are handed to the integrand.  (For clock_gettime, the
+   including file must #define _POSIX_C_SOURCE before including any
+   system header.) */
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+/* wall-clock time in seconds, from an arbitrary origin */
+static double stats_time(void)
+{
+#if defined(_WIN32)
+     LARGE_INTEGER t, f;
+     QueryPerformanceCounter(&t);
+     QueryPerformanceFrequency(&f);
+     return (double) t.QuadPart / (double) f.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return t.tv_sec + 1e-9 * t.tv_nsec;
+#else /* C89 fallback: processor time */
+     return clock() * (1.0 / CLOCKS_PER_SEC);
+#endif
+}
+
+#include "profile.h"
+
+typedef struct stats_data_s {
+     cubature_stats *stats; /* NULL if no statistics were requested */
+     double t; /* stats_time() when the current batch of points was
+		  handed to the integrand */
+#ifdef CUBATURE_PROFILE
+     double c; /* prof_cycles() at the same time */
+     prof_counters pc;
+#endif
+} stats_data;
+
+/* If opt requests statistics, reset them and start the timer.  Returns
+   the statistics, or NULL if none were requested.  The reason is
+   CUBATURE_CONVERGED unless the integration routine sets it to
+   something else. */
+static cubature_stats *stats_begin(const cubature_options *opt,
+				   stats_data *d)
+{
+     cubature_stats *s = opt ? opt->stats : NULL;
+     unsigned i;
+     d->stats = s;
+     if (!s) return NULL;
+     memset(s, 0, sizeof(cubature_stats));
+     s->reason = CUBATURE_CONVERGED;
+     for (i = 0; i < CUBATURE_NCOUNTERS; ++i) s->counters[i] = -1;
+#ifdef CUBATURE_PROFILE
+     prof_counters_start(&d->pc);
+#endif
+     s->time_total = stats_time();
+     return s;
+}
+
+/* call before a batch of points is handed to the integrand ... */
+static void stats_batch_begin(stats_data *d)
+{
+     if (!d->stats) return;
+#ifdef CUBATURE_PROFILE
+     d->c = prof_cycles();
+#endif
+     d->t = stats_time();
+}
+
+/* ... and after its npt values are returned: count and time the call */
+static void stats_batch_end(stats_data *d, size_t npt)
+{
+     cubature_stats *s = d->stats;
+     unsigned k = 0;
+     size_t n;
+     if (!s) return;
+     s->time_integrand += stats_time() - d->t;
+#ifdef CUBATURE_PROFILE
+     s->phase_cycles[CUBATURE_PHASE_INTEGRAND] += prof_cycles() - d->c;
+#endif
+     s->numEval += npt;
+     s->numCalls += 1;
+     for (n = npt; n > 1 && k < CUBATURE_STATS_NBATCH - 1; n >>= 1) ++k;
+     s->batch_hist[k] += 1;
+     if (npt > s->max_batch) s->max_batch = npt;
+}
+
+/* stop the timer, given the return value ret of the integration */
+static void stats_end(stats_data *d, int ret)
+{
+     cubature_stats *s = d->stats;
+     if (!s) return;
+     s->time_total = stats_time() - s->time_total;
+#ifdef CUBATURE_PROFILE
+     prof_counters_stop(&d->pc, s->counters);
+#endif
+     if (ret != SUCCESS && s->reason == CUBATURE_CONVERGED)
+	  s->reason = CUBATURE_ERROR;
+}
+
+/* record the current # regions and memory usage */
+static void stats_peak(cubature_stats *s, size_t nregions, size_t bytes)
+{
+     if (nregions > s->peak_regions) s->peak_regions = nregions;
+     if (bytes > s->peak_bytes) s->peak_bytes = bytes;
+}
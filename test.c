@@ -26,33 +26,111 @@
  *
  */
 
-/* Usage: ./test <dim> <tol> <integrand> <maxeval>
+/* Usage: ./test <dim> <tol> <integrand> <maxeval> [switches]
 
    where <dim> = # dimensions, <tol> = relative tolerance,
    <integrand> is either 0/1/2 for the three test integrands (see below),
    and <maxeval> is the maximum # function evaluations (0 for none).
 
    Compile with -DSCUBATURE to test scubature instead of cubature.
+
+   The optional switches (anywhere on the command line) test features
+   of the extended interfaces (hcubature_ex etcetera):
+
+     -gp                  pcubature: Gauss-Patterson rules
+     -gk21, -gk31, -gk61  hcubature: a Gauss-Kronrod rule (for dim = 1)
+     -inf                 integrate over [0,infinity)^dim instead, with
+                          the integrand transformed by x = (1-u)/u back
+                          to u in the unit hypercube (so the exact
+                          integrals are the same)
+     -break               hcubature: breakpoints at 1/4 and 1/2 in each
+                          dimension
+     -mask                the masked interfaces (hcubature_vm/pcubature_vm)
+     -det                 deterministic mode, also checking that the
+                          results are bitwise identical for several
+                          nthreads, nprocs and max_batch
+     -rc                  also integrate through the reverse-communication
+                          interface, checking that the results are
+                          bitwise identical (not with -mask)
+     -ctx                 pcubature: also integrate with the tolerances
+                          1e-3, 1e-8, 1e-10 and 1e-5 in turn through one
+                          pcubature_ctx, checking that the results are
+                          bitwise identical to those of pcubature_ex,
+                          and that the last one needs no new
+                          evaluations (not with -mask)
+     -exec                hcubature: also run 4 concurrent integrations of
+                          the integrands times 1, 2, 3 and 4 (as their
+                          fdata) through one hcubature_executor, with
+                          min_batch = 0 and 100, checking that their
+                          batches were combined and that the results
+                          are bitwise identical to those of
+                          hcubature_ex (not with -mask)
+     -compact             hcubature: compact storage of the regions,
+                          checking that the true errors are within the
+                          error estimates (for tolerances above 1e-7)
+     -threads             hcubature: nthreads = 4 (not deterministic,
+                          unlike -det)
+     -trace               hcubature: also integrate twice, writing the
+                          refinement trace in CSV to htest_trace.csv
+                          and in binary to htest_trace.bin, checking
+                          that the results are bitwise identical (make
+                          check then compares the cubature_tracesum
+                          summaries of the two traces)
+     -stop                also integrate with a progress callback that
+                          stops the integration at its third call,
+                          checking that it returns 0 with the
+                          CUBATURE_STOPPED reason, after fewer
+                          evaluations, and with (to rounding) the
+                          estimates that the callback saw last
+     -maxtime             a maxTime of 0.1 seconds, checking that the
+                          integration times out (for a tolerance that
+                          it cannot reach in that time)
+
+   With any switch, the exit status is nonzero if the integration
+   fails, if the true error of a component exceeds 10 times its error
+   estimate or tolerance (whichever is larger), or if a check of a
+   switch fails.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "cubature.h"
+#include "testfuncs.h"
+
+#if !defined(PCUBATURE) && !defined(_WIN32)
+#  include <pthread.h> /* for -exec */
+#  define EXEC_THREADS 1
+#endif
 
 #define VERBOSE 0
 
 #if defined(PCUBATURE)
 #  define cubature pcubature
+#  define cubature_ex pcubature_ex
+#  define cubature_vm pcubature_vm
+#  define cubature_rc pcubature_rc
+#  define cubature_rc_begin pcubature_rc_begin
+#  define cubature_rc_next pcubature_rc_next
+#  define cubature_rc_submit pcubature_rc_submit
+#  define cubature_rc_end pcubature_rc_end
 #else
 #  define cubature hcubature
+#  define cubature_ex hcubature_ex
+#  define cubature_vm hcubature_vm
+#  define cubature_rc hcubature_rc
+#  define cubature_rc_begin hcubature_rc_begin
+#  define cubature_rc_next hcubature_rc_next
+#  define cubature_rc_submit hcubature_rc_submit
+#  define cubature_rc_end hcubature_rc_end
 #endif
 
 int count = 0;
 unsigned integrand_fdim = 0;
 int *which_integrand = NULL;
-const double radius = 0.50124145262344534123412; /* random */
+int inf_limits = 0; /* -inf */
 
 /* Simple constant function */
 double
@@ -61,211 +139,499 @@ fconst (double x[], size_t dim, void *params)
   return 1;
 }
 
-/*** f0, f1, f2, and f3 are test functions from the Monte-Carlo
-     integration routines in GSL 1.6 (monte/test.c).  Copyright (c)
-     1996-2000 Michael Booth, GNU GPL. ****/
-
-/* Simple product function */
-double f0 (unsigned dim, const double *x, void *params)
+int f_test(unsigned dim, const double *x, void *data_,
+	   unsigned fdim, double *retval)
 {
-     double prod = 1.0;
-     unsigned int i;
-     for (i = 0; i < dim; ++i)
-	  prod *= 2.0 * x[i];
-     return prod;
+     double val;
+     unsigned j;
+     ++count;
+     (void) data_; /* not used */
+     for (j = 0; j < fdim; ++j) {
+     val = test_integrand(which_integrand[j], dim, x);
+#if VERBOSE
+     if (count < 100) {
+	  unsigned i;
+	  printf("%d: f(%g", count, x[0]);
+	  for (i = 1; i < dim; ++i) printf(", %g", x[i]);
+	  printf(") = %g\n", val);
+     }
+#endif
+     retval[j] = val;
+     }
+     return 0;
 }
 
-#define K_2_SQRTPI 1.12837916709551257390
+#define MAXDIM 20 /* for -inf and -break */
 
-/* Gaussian centered at 1/2. */
-double f1 (unsigned dim, const double *x, void *params)
+/* test integrand which at x, transformed from [0,infinity)^dim to the
+   unit hypercube for -inf */
+static double f_point(int which, unsigned dim, const double *x)
 {
-     double a = *(double *)params;
-     double sum = 0.;
-     unsigned int i;
-     for (i = 0; i < dim; i++) {
-	  double dx = x[i] - 0.5;
-	  sum += dx * dx;
+     double u[MAXDIM], jac = 1;
+     unsigned i;
+     if (!inf_limits) return test_integrand(which, dim, x);
+     for (i = 0; i < dim; ++i) {
+	  u[i] = 1 / (1 + x[i]);
+	  jac *= u[i] * u[i];
      }
-     return (pow (K_2_SQRTPI / (2. * a), (double) dim) *
-	     exp (-sum / (a * a)));
+     return jac == 0 ? 0 : test_integrand(which, dim, u) * jac;
 }
 
-/* double gaussian */
-double f2 (unsigned dim, const double *x, void *params)
+/* the integrands for the switches: vectorized, and masked (for -mask);
+   the points are counted unless fdata is non-NULL (which is the case
+   for the integrations on several threads) */
+int fv_test(unsigned dim, size_t npt, const double *x, void *data_,
+	    unsigned fdim, double *retval)
 {
-     double a = *(double *)params;
-     double sum1 = 0.;
-     double sum2 = 0.;
-     unsigned int i;
-     for (i = 0; i < dim; i++) {
-	  double dx1 = x[i] - 1. / 3.;
-	  double dx2 = x[i] - 2. / 3.;
-	  sum1 += dx1 * dx1;
-	  sum2 += dx2 * dx2;
-     }
-     return 0.5 * pow (K_2_SQRTPI / (2. * a), dim)
-	  * (exp (-sum1 / (a * a)) + exp (-sum2 / (a * a)));
+     size_t i;
+     unsigned j;
+     if (!data_) count += npt;
+     for (i = 0; i < npt; ++i)
+	  for (j = 0; j < fdim; ++j)
+	       retval[i*fdim + j] = f_point(which_integrand[j], dim,
+					    x + i*dim);
+     return 0;
 }
 
-/* Tsuda's example */
-double f3 (unsigned dim, const double *x, void *params)
+int fm_test(unsigned dim, size_t npt, const double *x, void *data_,
+	    unsigned fdim, const char *active, double *retval)
 {
-     double c = *(double *)params;
-     double prod = 1.;
-     unsigned int i;
-     for (i = 0; i < dim; i++)
-	  prod *= c / (c + 1) * pow((c + 1) / (c + x[i]), 2.0);
-     return prod;
+     size_t i;
+     unsigned j;
+     if (!data_) count += npt;
+     for (i = 0; i < npt; ++i)
+	  for (j = 0; j < fdim; ++j)
+	       if (active[j])
+		    retval[i*fdim + j] = f_point(which_integrand[j], dim,
+						 x + i*dim);
+     return 0;
 }
 
-/* test integrand from W. J. Morokoff and R. E. Caflisch, "Quasi=
-   Monte Carlo integration," J. Comput. Phys 122, 218-230 (1995).
-   Designed for integration on [0,1]^dim, integral = 1. */
-static double morokoff(unsigned dim, const double *x, void *params)
+/* integrate with the extended interface selected by the switches */
+static int integrate(int mask, void *data, unsigned dim,
+		     const double *xmin, const double *xmax,
+		     unsigned maxEval, double tol,
+		     const cubature_options *opt, double *val, double *err)
 {
-     double p = 1.0 / dim;
-     double prod = pow(1 + p, dim);
-     unsigned int i;
-     for (i = 0; i < dim; i++)
-	  prod *= pow(x[i], p);
-     return prod;
+     if (mask)
+	  return cubature_vm(integrand_fdim, fm_test, data, dim, xmin, xmax,
+			     maxEval, 0, tol, ERROR_INDIVIDUAL, opt, val, err);
+     return cubature_ex(integrand_fdim, fv_test, data, dim, xmin, xmax,
+			maxEval, 0, tol, ERROR_INDIVIDUAL, opt, val, err);
 }
 
-/*** end of GSL test functions ***/
-
-int f_test(unsigned dim, const double *x, void *data_,
-	   unsigned fdim, double *retval)
+/* the same as integrate(0, ...), but through the reverse-communication
+   interface (for -rc) */
+static int integrate_rc(unsigned dim, const double *xmin, const double *xmax,
+			unsigned maxEval, double tol,
+			const cubature_options *opt, double *val, double *err)
 {
-     double val;
-     unsigned i, j;
-     ++count;
-     (void) data_; /* not used */
-     for (j = 0; j < fdim; ++j) {
-     double fdata = which_integrand[j] == 6 ? (1.0+sqrt (10.0))/9.0 : 0.1;
-     switch (which_integrand[j]) {
-	 case 0: /* simple smooth (separable) objective: prod. cos(x[i]). */
-	      val = 1;
-	      for (i = 0; i < dim; ++i)
-		   val *= cos(x[i]);
-	      break;
-	 case 1: { /* integral of exp(-x^2), rescaled to (0,infinity) limits */
-	      double scale = 1.0;
-	      val = 0;
-	      for (i = 0; i < dim; ++i) {
-		   if (x[i] > 0) {
-			double z = (1 - x[i]) / x[i];
-			val += z * z;
-			scale *= K_2_SQRTPI / (x[i] * x[i]);
-		   }
-		   else {
-			scale = 0;
-			break;
-		   }
-	      }
-	      val = exp(-val) * scale;
-	      break;
-	 }
-	 case 2: /* discontinuous objective: volume of hypersphere */
-	      val = 0;
-	      for (i = 0; i < dim; ++i)
-		   val += x[i] * x[i];
-	      val = val < radius * radius;
-	      break;
-	 case 3:
-	      val = f0(dim, x, &fdata);
-	      break;
-	 case 4:
-	      val = f1(dim, x, &fdata);
-	      break;
-	 case 5:
-	      val = f2(dim, x, &fdata);
-	      break;
-	 case 6:
-	      val = f3(dim, x, &fdata);
-	      break;
-	 case 7:
-	      val = morokoff(dim, x, &fdata);
-	      break;
-	 case 8: /* from HCubature.jl#4 */
-		  if (dim != 3) {
-			fprintf(stderr, "test 8 requires dim == 3\n");
-			exit(EXIT_FAILURE);
-		  }
-		  val = x[0]*0.2 * (x[2]-0.5)*0.4 * sin(x[1] * 6.283185307179586);
-		  val = 1 + val*val;
-	 	  break;
-	 default:
-	      fprintf(stderr, "unknown integrand %d\n", which_integrand[j]);
-	      exit(EXIT_FAILURE);
+     cubature_rc *rc = cubature_rc_begin(integrand_fdim, dim, xmin, xmax,
+					 maxEval, 0, tol, ERROR_INDIVIDUAL,
+					 opt);
+     const double *x;
+     double *fval = NULL;
+     size_t npt;
+     if (!rc) return 1;
+     while (cubature_rc_next(rc, &x, &npt)) {
+	  double *f = (double *) realloc(fval, sizeof(double) * npt
+					 * integrand_fdim);
+	  if (!f) break; /* _end aborts the integration */
+	  fval = f;
+	  fv_test(dim, npt, x, rc, integrand_fdim, fval);
+	  cubature_rc_submit(rc, fval);
      }
-#if VERBOSE
-     if (count < 100) {
-	  printf("%d: f(%g", count, x[0]);
-	  for (i = 1; i < dim; ++i) printf(", %g", x[i]);
-	  printf(") = %g\n", val);
+     free(fval);
+     return cubature_rc_end(rc, val, err);
+}
+
+/* whether an integration returned 0 with bitwise the same val1 and err1
+   as val and err */
+static int same_results(int ret, const double *val, const double *err,
+			const double *val1, const double *err1)
+{
+     return !ret
+	  && !memcmp(val, val1, sizeof(double) * integrand_fdim)
+	  && !memcmp(err, err1, sizeof(double) * integrand_fdim);
+}
+
+#define STOP_CALLS 3
+
+/* the progress callback of -stop, which keeps the last estimates in
+   val and err and stops the integration at its STOP_CALLS-th call */
+typedef struct {
+     unsigned ncalls;
+     double *val, *err;
+} stop_data;
+
+static int stop_progress(void *data, unsigned fdim,
+			 const double *val, const double *err,
+			 size_t numEval, size_t nregions)
+{
+     stop_data *d = (stop_data *) data;
+     (void) numEval; (void) nregions;
+     memcpy(d->val, val, sizeof(double) * fdim);
+     memcpy(d->err, err, sizeof(double) * fdim);
+     return ++d->ncalls >= STOP_CALLS;
+}
+
+/* repeat an integration that took numEval evaluations, stopping it with
+   the progress callback (for -stop); returns whether all of the checks
+   passed, where the results need only match the callback's estimates to
+   rounding since hcubature re-sums them over the regions */
+static int check_stop(int mask, unsigned dim,
+		      const double *xmin, const double *xmax,
+		      unsigned maxEval, double tol,
+		      const cubature_options *opt, size_t numEval)
+{
+     cubature_options opt1 = *opt;
+     cubature_stats stats;
+     stop_data d;
+     unsigned i;
+     int ret, ok;
+
+     d.ncalls = 0;
+     d.val = (double *) malloc(sizeof(double) * integrand_fdim * 4);
+     if (!d.val) return 0;
+     d.err = d.val + integrand_fdim;
+     opt1.progress = stop_progress;
+     opt1.progress_data = &d;
+     opt1.stats = &stats;
+     ret = integrate(mask, &opt1, dim, xmin, xmax, maxEval, tol, &opt1,
+		     d.val + 2 * integrand_fdim, d.val + 3 * integrand_fdim);
+     ok = ret == 0 && stats.reason == CUBATURE_STOPPED
+	  && d.ncalls == STOP_CALLS && stats.numEval < numEval;
+     for (i = 0; i < 2 * integrand_fdim; ++i) { /* the same, to rounding */
+	  double x = d.val[i], y = d.val[i + 2 * integrand_fdim];
+	  if (fabs(x - y) > 1e-12 * (fabs(x) + fabs(y)))
+	       ok = 0;
      }
-#endif
-     retval[j] = val;
+     printf("stopped after %u progress calls and %u evaluations "
+	    "(returned %d, reason %d): %s\n", d.ncalls,
+	    (unsigned) stats.numEval, ret, (int) stats.reason,
+	    ok ? "ok" : "FAILED");
+     free(d.val);
+     return ok;
+}
+
+#if !defined(PCUBATURE)
+/* the integrands times *(double *) fdata (for -exec) */
+static int fv_scaled(unsigned dim, size_t npt, const double *x, void *data,
+		     unsigned fdim, double *retval)
+{
+     double scale = *(const double *) data;
+     size_t i;
+     fv_test(dim, npt, x, data, fdim, retval);
+     for (i = 0; i < npt * fdim; ++i) retval[i] *= scale;
+     return 0;
+}
+
+#  define EXEC_NJOBS 4
+
+#  if defined(EXEC_THREADS)
+/* the integrations of -exec that have started, and the most of them
+   in one call of fvs_test */
+static pthread_mutex_t exec_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t exec_cond = PTHREAD_COND_INITIALIZER;
+static unsigned exec_nstarted = 0, exec_maxseg = 0;
+#  endif
+
+static int fvs_test(unsigned dim, size_t npt, const double *x,
+		    unsigned nseg, const size_t *npts, void *const *fdata,
+		    unsigned fdim, double *retval)
+{
+     unsigned k;
+     (void) npt;
+#  if defined(EXEC_THREADS)
+     /* wait for all of the integrations to start, so that the first one
+	does not finish on its own before the others join it */
+     pthread_mutex_lock(&exec_lock);
+     while (exec_nstarted < EXEC_NJOBS)
+	  pthread_cond_wait(&exec_cond, &exec_lock);
+     pthread_mutex_unlock(&exec_lock);
+     if (nseg > exec_maxseg) exec_maxseg = nseg; /* (one call at a time) */
+#  endif
+     for (k = 0; k < nseg; ++k) {
+	  fv_scaled(dim, npts[k], x, fdata[k], fdim, retval);
+	  x += npts[k] * dim;
+	  retval += npts[k] * fdim;
      }
      return 0;
 }
 
-#define K_PI 3.14159265358979323846
+/* one of the concurrent integrations of -exec */
+typedef struct {
+     hcubature_executor *e;
+     unsigned dim, maxEval;
+     const double *xmin, *xmax;
+     double tol, scale;
+     const cubature_options *opt;
+     double *val, *err; /* 2*fdim: the results, then those of _ex */
+     int ret;
+} exec_job;
 
-/* surface area of n-dimensional unit hypersphere */
-static double S(unsigned n)
+#  if defined(EXEC_THREADS)
+static void *exec_thread(void *job_)
 {
-     double val;
-     int fact = 1;
-     if (n % 2 == 0) { /* n even */
-	  val = 2 * pow(K_PI, n * 0.5);
-	  n = n / 2;
-	  while (n > 1) fact *= (n -= 1);
-	  val /= fact;
+     exec_job *job = (exec_job *) job_;
+     pthread_mutex_lock(&exec_lock);
+     exec_nstarted += 1;
+     pthread_cond_broadcast(&exec_cond);
+     pthread_mutex_unlock(&exec_lock);
+     job->ret = hcubature_executor_integrate(job->e, &job->scale,
+					     job->xmin, job->xmax,
+					     job->maxEval, 0, job->tol,
+					     ERROR_INDIVIDUAL, job->opt,
+					     job->val, job->err);
+     return NULL;
+}
+#  endif
+
+/* run EXEC_NJOBS concurrent integrations through an executor with the
+   given min_batch, and compare with hcubature_ex (for -exec); returns
+   whether all of the checks passed */
+static int check_exec(unsigned dim, const double *xmin, const double *xmax,
+		      unsigned maxEval, double tol,
+		      const cubature_options *opt, size_t min_batch)
+{
+#  if defined(EXEC_THREADS)
+     exec_job jobs[EXEC_NJOBS];
+     pthread_t threads[EXEC_NJOBS];
+     hcubature_executor *e;
+     unsigned k, nstarted = 0;
+     int ok = 1;
+
+     e = hcubature_executor_new(integrand_fdim, fvs_test, dim, min_batch);
+     if (!e) return 0;
+     exec_nstarted = exec_maxseg = 0;
+     for (k = 0; k < EXEC_NJOBS; ++k) {
+	  jobs[k].e = e;
+	  jobs[k].dim = dim;
+	  jobs[k].maxEval = maxEval;
+	  jobs[k].xmin = xmin;
+	  jobs[k].xmax = xmax;
+	  jobs[k].tol = tol;
+	  jobs[k].scale = k + 1;
+	  jobs[k].opt = opt;
+	  jobs[k].val = (double *) malloc(sizeof(double) * integrand_fdim * 4);
+	  jobs[k].err = jobs[k].val + 2 * integrand_fdim;
+	  jobs[k].ret = 1;
+     }
+     for (k = 0; k < EXEC_NJOBS; ++k) {
+	  if (!jobs[k].val
+	      || pthread_create(threads + k, NULL, exec_thread, jobs + k))
+	       break;
+	  ++nstarted;
      }
-     else { /* n odd */
-	  val = (1 << (n/2 + 1)) * pow(K_PI, n/2);
-	  while (n > 2) fact *= (n -= 2);
-	  val /= fact;
+     if (nstarted < EXEC_NJOBS) { /* do not wait for the others */
+	  pthread_mutex_lock(&exec_lock);
+	  exec_nstarted = EXEC_NJOBS;
+	  pthread_cond_broadcast(&exec_cond);
+	  pthread_mutex_unlock(&exec_lock);
+	  ok = 0;
      }
-     return val;
+     for (k = 0; k < nstarted; ++k)
+	  pthread_join(threads[k], NULL);
+     hcubature_executor_destroy(e);
+     for (k = 0; k < EXEC_NJOBS; ++k) {
+	  int same = k < nstarted && !hcubature_ex(integrand_fdim, fv_scaled,
+						   &jobs[k].scale, dim,
+						   xmin, xmax, maxEval, 0,
+						   tol, ERROR_INDIVIDUAL, opt,
+						   jobs[k].val + integrand_fdim,
+						   jobs[k].err + integrand_fdim)
+	       && same_results(jobs[k].ret, jobs[k].val, jobs[k].err,
+			       jobs[k].val + integrand_fdim,
+			       jobs[k].err + integrand_fdim);
+	  printf("executor with min_batch = %u, fdata %u: %s\n",
+		 (unsigned) min_batch, k, same ? "identical" : "DIFFERENT");
+	  if (!same) ok = 0;
+	  free(jobs[k].val);
+     }
+     printf("executor with min_batch = %u: at most %u integrations "
+	    "per call\n", (unsigned) min_batch, exec_maxseg);
+     return ok && exec_maxseg > 1;
+#  else
+     (void) dim; (void) xmin; (void) xmax; (void) maxEval; (void) tol;
+     (void) opt; (void) min_batch;
+     printf("executor: not supported\n");
+     return 1;
+#  endif
 }
 
-static double exact_integral(int which, unsigned dim, const double *xmax) {
+/* repeat the integration with its trace written in each format (for
+   -trace), checking that the results are bitwise identical to val and
+   err; returns whether they all were */
+static int check_trace(int mask, unsigned dim,
+		       const double *xmin, const double *xmax,
+		       unsigned maxEval, double tol,
+		       const cubature_options *opt,
+		       const double *val, const double *err)
+{
+     static const char *names[2] = { "htest_trace.csv", "htest_trace.bin" };
+     static const char *modes[2] = { "w", "wb" };
+     static const cubature_trace_format formats[2] = {
+	  CUBATURE_TRACE_CSV, CUBATURE_TRACE_BINARY
+     };
+     cubature_options opt1 = *opt;
+     double *val1, *err1;
+     int i, ok = 1;
+
+     val1 = (double *) malloc(sizeof(double) * integrand_fdim * 2);
+     if (!val1) return 0;
+     err1 = val1 + integrand_fdim;
+     for (i = 0; i < 2; ++i) {
+	  int ret, same;
+	  opt1.trace = fopen(names[i], modes[i]);
+	  if (!opt1.trace) {
+	       printf("cannot write %s: FAILED\n", names[i]);
+	       ok = 0;
+	       continue;
+	  }
+	  opt1.trace_format = formats[i];
+	  ret = integrate(mask, &opt1, dim, xmin, xmax, maxEval, tol, &opt1,
+			  val1, err1);
+	  same = !fclose(opt1.trace)
+	       && same_results(ret, val, err, val1, err1);
+	  printf("trace in %s: %s\n", names[i],
+		 same ? "identical" : "DIFFERENT");
+	  if (!same) ok = 0;
+     }
+     free(val1);
+     return ok;
+}
+#else /* PCUBATURE */
+/* integrate with a sequence of tolerances through one pcubature_ctx,
+   and compare with pcubature_ex (for -ctx); returns whether all of the
+   checks passed */
+static int check_ctx(unsigned dim, const double *xmin, const double *xmax,
+		     unsigned maxEval, cubature_options *opt,
+		     double *val, double *err)
+{
+     static const double tols[] = { 1e-3, 1e-8, 1e-10, 1e-5 };
+     double *val1 = val + integrand_fdim, *err1 = err + integrand_fdim;
+     cubature_stats stats;
+     pcubature_ctx *ctx;
      unsigned i;
-     double val;
-     switch(which) {
-	 case 0:
-	      val = 1;
-	      for (i = 0; i < dim; ++i)
-		   val *= sin(xmax[i]);
-	      break;
-	 case 2:
-	      val = dim == 0 ? 1 : S(dim) * pow(radius * 0.5, dim) / dim;
-	      break;
-	 default:
-	      val = 1.0;
+     int ok = 1;
+
+     opt->stats = &stats;
+     ctx = pcubature_ctx_new(integrand_fdim, fv_test, opt, dim, xmin, xmax,
+			     opt);
+     if (!ctx) return 0;
+     for (i = 0; i < sizeof(tols) / sizeof(tols[0]); ++i) {
+	  int ret = pcubature_ctx_integrate(ctx, maxEval, 0, tols[i],
+					    ERROR_INDIVIDUAL, val1, err1);
+	  size_t numEval = stats.numEval;
+	  int same = !ret && !pcubature_ex(integrand_fdim, fv_test, opt,
+					   dim, xmin, xmax, maxEval, 0,
+					   tols[i], ERROR_INDIVIDUAL, opt,
+					   val, err)
+	       && same_results(ret, val, err, val1, err1);
+	  printf("context with tolerance %g: %s, %u new evaluations\n",
+		 tols[i], same ? "identical" : "DIFFERENT",
+		 (unsigned) numEval);
+	  if (!same || (i > 0 && tols[i] > tols[i-1] && numEval > 0))
+	       ok = 0;
      }
-     return val;
+     pcubature_ctx_destroy(ctx);
+     opt->stats = NULL;
+     return ok;
 }
+#endif /* PCUBATURE */
 
 #include <ctype.h>
 int main(int argc, char **argv)
 {
-     double *xmin, *xmax;
+     double *xmin, *xmax, *xmin_c, *xmax_c;
      double tol, *val, *err;
      unsigned i, dim, maxEval;
+     int switches = 0, mask = 0, det = 0, brk = 0, rc = 0, ctx = 0;
+     int exec = 0, compact = 0, stop = 0, maxtime = 0;
+     int ret = 0, failed = 0;
+#if !defined(PCUBATURE)
+     int trace = 0;
+#endif
+     cubature_options opt;
+     cubature_stats stats;
+     unsigned nbreak[MAXDIM];
+     const double *breaks[MAXDIM];
+     static const double break_points[2] = { 0.25, 0.5 };
+
+     memset(&opt, 0, sizeof(opt));
+     for (i = 1; i < (unsigned) argc; ++i) { /* remove the switches */
+	  const char *sw = argv[i];
+	  if (sw[0] != '-' || !isalpha((unsigned char) sw[1]))
+	       continue;
+#if defined(PCUBATURE)
+	  if (!strcmp(sw, "-gp"))
+	       opt.rule = PCUBATURE_GAUSS_PATTERSON;
+	  else if (!strcmp(sw, "-ctx"))
+	       ctx = 1;
+	  else
+#else
+	  if (!strcmp(sw, "-gk21"))
+	       opt.rule1d = HCUBATURE_GK21;
+	  else if (!strcmp(sw, "-gk31"))
+	       opt.rule1d = HCUBATURE_GK31;
+	  else if (!strcmp(sw, "-gk61"))
+	       opt.rule1d = HCUBATURE_GK61;
+	  else if (!strcmp(sw, "-break"))
+	       brk = 1;
+	  else if (!strcmp(sw, "-exec"))
+	       exec = 1;
+	  else if (!strcmp(sw, "-compact"))
+	       compact = opt.compact = 1;
+	  else if (!strcmp(sw, "-trace"))
+	       trace = 1;
+	  else if (!strcmp(sw, "-threads")) {
+	       opt.nthreads = 4;
+	       opt.stats = &stats;
+	  }
+	  else
+#endif
+	  if (!strcmp(sw, "-inf"))
+	       inf_limits = 1;
+	  else if (!strcmp(sw, "-mask"))
+	       mask = 1;
+	  else if (!strcmp(sw, "-det"))
+	       det = opt.deterministic = 1;
+	  else if (!strcmp(sw, "-rc"))
+	       rc = 1;
+	  else if (!strcmp(sw, "-stop"))
+	       stop = 1;
+	  else if (!strcmp(sw, "-maxtime")) {
+	       maxtime = 1;
+	       opt.maxTime = 0.1;
+	       opt.stats = &stats;
+	  }
+	  else {
+	       fprintf(stderr, "unknown switch \"%s\"\n", sw);
+	       return EXIT_FAILURE;
+	  }
+	  switches = 1;
+	  memmove(argv + i, argv + i + 1, sizeof(char *) * (argc - i));
+	  --argc; --i;
+     }
 
      if (argc <= 1) {
-	  fprintf(stderr, "Usage: %s [dim] [reltol] [integrand] [maxeval]\n",
-		  argv[0]);
+	  fprintf(stderr, "Usage: %s [dim] [reltol] [integrand] [maxeval] "
+		  "[switches]\n", argv[0]);
 	  return EXIT_FAILURE;
      }
 
      dim = argc > 1 ? atoi(argv[1]) : 2;
      tol = argc > 2 ? atof(argv[2]) : 1e-2;
      maxEval = argc > 4 ? atoi(argv[4]) : 0;
+     if ((rc || ctx || exec) && mask) {
+	  fprintf(stderr, "-rc, -ctx and -exec cannot be combined with "
+		  "-mask\n");
+	  return EXIT_FAILURE;
+     }
+     if ((inf_limits || brk) && dim > MAXDIM) {
+	  fprintf(stderr, "-inf and -break require dim <= %d\n", MAXDIM);
+	  return EXIT_FAILURE;
+     }
 
      /* parse: e.g. "x/y/z" is treated as fdim = 3, which_integrand={x,y,z} */
      if (argc <= 3) {
@@ -295,26 +661,119 @@ int main(int argc, char **argv)
 	       }
 	  }
      }
-     val = (double *) malloc(sizeof(double) * integrand_fdim);
-     err = (double *) malloc(sizeof(double) * integrand_fdim);
+     val = (double *) malloc(sizeof(double) * integrand_fdim * 2);
+     err = (double *) malloc(sizeof(double) * integrand_fdim * 2);
 
-     xmin = (double *) malloc(dim * sizeof(double));
-     xmax = (double *) malloc(dim * sizeof(double));
+     xmin = (double *) malloc(dim * sizeof(double) * 2);
+     xmax = (double *) malloc(dim * sizeof(double) * 2);
+     xmin_c = xmin + dim; /* the limits of the integration */
+     xmax_c = xmax + dim;
      for (i = 0; i < dim; ++i) {
-	  xmin[i] = 0;
+	  xmin[i] = xmin_c[i] = 0;
 	  xmax[i] = 1;
+	  xmax_c[i] = inf_limits ? HUGE_VAL : 1;
+	  nbreak[i] = 2;
+	  breaks[i] = break_points;
+     }
+     if (brk) {
+	  opt.nbreak = nbreak;
+	  opt.breakpoints = breaks;
      }
 
      printf("%u-dim integral, tolerance = %g\n", dim, tol);
-     cubature(integrand_fdim, f_test, NULL,
-	      dim, xmin, xmax,
-	      maxEval, 0, tol, ERROR_INDIVIDUAL, val, err);
+     if (!switches)
+	  cubature(integrand_fdim, f_test, NULL,
+		   dim, xmin, xmax,
+		   maxEval, 0, tol, ERROR_INDIVIDUAL, val, err);
+     else if (opt.nthreads > 1) { /* count is not thread-safe */
+	  ret = integrate(mask, &opt, dim, xmin_c, xmax_c, maxEval, tol,
+			  &opt, val, err);
+	  count = (int) stats.numEval;
+     }
+     else
+	  ret = integrate(mask, NULL, dim, xmin_c, xmax_c, maxEval, tol,
+			  &opt, val, err);
      for (i = 0; i < integrand_fdim; ++i) {
+	  double exact = exact_integral(which_integrand[i], dim, xmax);
+	  double trueerr = fabs(val[i] - exact);
 	  printf("integrand %d: integral = %0.11g, est err = %g, true err = %g\n",
-		 which_integrand[i], val[i], err[i],
-		 fabs(val[i] - exact_integral(which_integrand[i], dim, xmax)));
+		 which_integrand[i], val[i], err[i], trueerr);
+	  if (switches && !(trueerr <= 10 * err[i]
+			    || trueerr <= 10 * tol * fabs(exact))) {
+	       printf("integrand %d: FAILED (true error too large)\n",
+		      which_integrand[i]);
+	       failed = 1;
+	  }
+	  else if (compact && trueerr > err[i]) {
+	       printf("integrand %d: FAILED (true error above the estimate)\n",
+		      which_integrand[i]);
+	       failed = 1;
+	  }
      }
      printf("#evals = %d\n", count);
+     if (maxtime) { /* the integration must have timed out */
+	  if (ret != CUBATURE_TIMEOUT || stats.reason != CUBATURE_MAXTIME) {
+	       printf("FAILED (no timeout: returned %d, reason %d)\n",
+		      ret, (int) stats.reason);
+	       failed = 1;
+	  }
+	  else
+	       printf("timed out after %g seconds\n", stats.time_total);
+	  ret = 0;
+     }
+     if (ret) {
+	  printf("FAILED (returned %d)\n", ret);
+	  failed = 1;
+     }
+
+     if (rc) { /* the same integration, driven by the caller */
+	  ret = integrate_rc(dim, xmin_c, xmax_c, maxEval, tol, &opt,
+			     val + integrand_fdim, err + integrand_fdim);
+	  if (same_results(ret, val, err,
+			   val + integrand_fdim, err + integrand_fdim))
+	       printf("reverse communication: identical\n");
+	  else {
+	       printf("reverse communication: DIFFERENT\n");
+	       failed = 1;
+	  }
+     }
+
+     if (stop && !check_stop(mask, dim, xmin_c, xmax_c, maxEval, tol, &opt,
+			     count))
+	  failed = 1;
+
+#if defined(PCUBATURE)
+     if (ctx && !check_ctx(dim, xmin_c, xmax_c, maxEval, &opt, val, err))
+	  failed = 1;
+#else
+     if (exec && (!check_exec(dim, xmin_c, xmax_c, maxEval, tol, &opt, 0)
+		  || !check_exec(dim, xmin_c, xmax_c, maxEval, tol, &opt,
+				 100)))
+	  failed = 1;
+     if (trace && !check_trace(mask, dim, xmin_c, xmax_c, maxEval, tol, &opt,
+			       val, err))
+	  failed = 1;
+#endif
+
+     if (det) { /* the same integration on other threads/processes/batches */
+	  static const unsigned nthreads[] = { 2, 4, 3, 1, 1 };
+	  static const unsigned nprocs[] = { 0, 0, 0, 2, 0 };
+	  static const size_t max_batch[] = { 0, 0, 100, 0, 37 };
+	  double *val1 = val + integrand_fdim, *err1 = err + integrand_fdim;
+	  for (i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); ++i) {
+	       int same;
+	       opt.nthreads = nthreads[i];
+	       opt.nprocs = nprocs[i];
+	       opt.max_batch = max_batch[i];
+	       ret = integrate(mask, &opt, dim, xmin_c, xmax_c, maxEval, tol,
+			       &opt, val1, err1);
+	       same = same_results(ret, val, err, val1, err1);
+	       printf("deterministic with nthreads = %u, nprocs = %u, "
+		      "max_batch = %u: %s\n", nthreads[i], nprocs[i],
+		      (unsigned) max_batch[i], same ? "identical" : "DIFFERENT");
+	       if (!same) failed = 1;
+	  }
+     }
 
      free(xmax);
      free(xmin);
@@ -322,5 +781,5 @@ int main(int argc, char **argv)
      free(val);
      free(which_integrand);
 
-     return EXIT_SUCCESS;
+     return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
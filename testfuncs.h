@@ -0,0 +1,218 @@
+/* Test integrands on the unit hypercube [0,1]^dim, shared by the test
+ * program (test.c) and the benchmark programs.
+ *
+ * Copyright (c) 2005-2013 Steven G. Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef TESTFUNCS_H
+#define TESTFUNCS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define TEST_NUM_INTEGRANDS 9 /* integrands 0 .. 8 */
+
+static const double radius = 0.50124145262344534123412; /* random */
+
+/*** f0, f1, f2, and f3 are test functions from the Monte-Carlo
+     integration routines in GSL 1.6 (monte/test.c).  Copyright (c)
+     1996-2000 Michael Booth, GNU GPL. ****/
+
+/* Simple product function */
+static double f0 (unsigned dim, const double *x, void *params)
+{
+     double prod = 1.0;
+     unsigned int i;
+     (void) params; /* not used */
+     for (i = 0; i < dim; ++i)
+	  prod *= 2.0 * x[i];
+     return prod;
+}
+
+#define K_2_SQRTPI 1.12837916709551257390
+
+/* Gaussian centered at 1/2. */
+static double f1 (unsigned dim, const double *x, void *params)
+{
+     double a = *(double *)params;
+     double sum = 0.;
+     unsigned int i;
+     for (i = 0; i < dim; i++) {
+	  double dx = x[i] - 0.5;
+	  sum += dx * dx;
+     }
+     return (pow (K_2_SQRTPI / (2. * a), (double) dim) *
+	     exp (-sum / (a * a)));
+}
+
+/* double gaussian */
+static double f2 (unsigned dim, const double *x, void *params)
+{
+     double a = *(double *)params;
+     double sum1 = 0.;
+     double sum2 = 0.;
+     unsigned int i;
+     for (i = 0; i < dim; i++) {
+	  double dx1 = x[i] - 1. / 3.;
+	  double dx2 = x[i] - 2. / 3.;
+	  sum1 += dx1 * dx1;
+	  sum2 += dx2 * dx2;
+     }
+     return 0.5 * pow (K_2_SQRTPI / (2. * a), dim)
+	  * (exp (-sum1 / (a * a)) + exp (-sum2 / (a * a)));
+}
+
+/* Tsuda's example */
+static double f3 (unsigned dim, const double *x, void *params)
+{
+     double c = *(double *)params;
+     double prod = 1.;
+     unsigned int i;
+     for (i = 0; i < dim; i++)
+	  prod *= c / (c + 1) * pow((c + 1) / (c + x[i]), 2.0);
+     return prod;
+}
+
+/* test integrand from W. J. Morokoff and R. E. Caflisch, "Quasi=
+   Monte Carlo integration," J. Comput. Phys 122, 218-230 (1995).
+   Designed for integration on [0,1]^dim, integral = 1. */
+static double morokoff(unsigned dim, const double *x, void *params)
+{
+     double p = 1.0 / dim;
+     double prod = pow(1 + p, dim);
+     unsigned int i;
+     (void) params; /* not used */
+     for (i = 0; i < dim; i++)
+	  prod *= pow(x[i], p);
+     return prod;
+}
+
+/*** end of GSL test functions ***/
+
+/* the value of test integrand number which at the point x */
+static double test_integrand(int which, unsigned dim, const double *x)
+{
+     double val;
+     unsigned i;
+     double fdata = which == 6 ? (1.0+sqrt (10.0))/9.0 : 0.1;
+     switch (which) {
+	 case 0: /* simple smooth (separable) objective: prod. cos(x[i]). */
+	      val = 1;
+	      for (i = 0; i < dim; ++i)
+		   val *= cos(x[i]);
+	      break;
+	 case 1: { /* integral of exp(-x^2), rescaled to (0,infinity) limits */
+	      double scale = 1.0;
+	      val = 0;
+	      for (i = 0; i < dim; ++i) {
+		   if (x[i] > 0) {
+			double z = (1 - x[i]) / x[i];
+			val += z * z;
+			scale *= K_2_SQRTPI / (x[i] * x[i]);
+		   }
+		   else {
+			scale = 0;
+			break;
+		   }
+	      }
+	      val = exp(-val) * scale;
+	      break;
+	 }
+	 case 2: /* discontinuous objective: volume of hypersphere */
+	      val = 0;
+	      for (i = 0; i < dim; ++i)
+		   val += x[i] * x[i];
+	      val = val < radius * radius;
+	      break;
+	 case 3:
+	      val = f0(dim, x, &fdata);
+	      break;
+	 case 4:
+	      val = f1(dim, x, &fdata);
+	      break;
+	 case 5:
+	      val = f2(dim, x, &fdata);
+	      break;
+	 case 6:
+	      val = f3(dim, x, &fdata);
+	      break;
+	 case 7:
+	      val = morokoff(dim, x, &fdata);
+	      break;
+	 case 8: /* from HCubature.jl#4 */
+		  if (dim != 3) {
+			fprintf(stderr, "test 8 requires dim == 3\n");
+			exit(EXIT_FAILURE);
+		  }
+		  val = x[0]*0.2 * (x[2]-0.5)*0.4 * sin(x[1] * 6.283185307179586);
+		  val = 1 + val*val;
+	 	  break;
+	 default:
+	      fprintf(stderr, "unknown integrand %d\n", which);
+	      exit(EXIT_FAILURE);
+     }
+     return val;
+}
+
+#define K_PI 3.14159265358979323846
+
+/* surface area of n-dimensional unit hypersphere */
+static double S(unsigned n)
+{
+     double val;
+     int fact = 1;
+     if (n % 2 == 0) { /* n even */
+	  val = 2 * pow(K_PI, n * 0.5);
+	  n = n / 2;
+	  while (n > 1) fact *= (n -= 1);
+	  val /= fact;
+     }
+     else { /* n odd */
+	  val = (1 << (n/2 + 1)) * pow(K_PI, n/2);
+	  while (n > 2) fact *= (n -= 2);
+	  val /= fact;
+     }
+     return val;
+}
+
+/* the exact integral of test integrand which from 0 to xmax (for
+   integrands 4 and 5, this neglects the small tails of the Gaussians
+   outside the unit hypercube) */
+static double exact_integral(int which, unsigned dim, const double *xmax) {
+     unsigned i;
+     double val;
+     switch(which) {
+	 case 0:
+	      val = 1;
+	      for (i = 0; i < dim; ++i)
+		   val *= sin(xmax[i]);
+	      break;
+	 case 2:
+	      val = dim == 0 ? 1 : S(dim) * pow(radius * 0.5, dim) / dim;
+	      break;
+	 case 8: /* 1 + 0.08^2 * <x^2> * <(z-1/2)^2> * <sin^2(2 pi y)> */
+	      val = 1 + 0.0064 / 72;
+	      break;
+	 default:
+	      val = 1.0;
+     }
+     return val;
+}
+
+#endif /* TESTFUNCS_H */
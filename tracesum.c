@@ -0,0 +1,373 @@
+/* Summary of a refinement trace of hcubature (see the trace field of
+ * cubature_options).
+ *
+ * Copyright (c) 2005-2013 Steven G. Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Usage: ./cubature_tracesum [options] [tracefile]
+
+     -n 0           summarize per initial region (0), or per cell of a
+                    grid with n cells per dimension over the initial
+                    regions
+     -t 20          print the subdomains with the top 20 numbers of
+                    evaluations (0 for all)
+
+   The trace (read from stdin if no file is given) is in either of the
+   formats of cubature_trace_format, and may contain several
+   integrations.  For each one, this prints the numbers of evaluations,
+   bisections and batches, the bisections per split dimension, and for
+   each subdomain the number of evaluations in it (attributing each
+   bisection to the subdomain that contains the center of the region
+   that was bisected), its number of bisections, and (per initial
+   region) the sum over the components of the error estimates in it,
+   initially and at the end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "cubature.h"
+
+typedef struct {
+     double evals, cuts, err0, err; /* err0: initial error */
+     double *box; /* center[dim], halfwidth[dim] (per initial region) */
+} subdomain;
+
+typedef struct {
+     FILE *f;
+     int binary;
+     unsigned dim, fdim, npts; /* from the I record */
+     double *x; /* the fields of the current record */
+     size_t nx, nx_alloc;
+} reader;
+
+/* # fields of a record of the given type, or 0 if the type is invalid */
+static size_t record_len(const reader *rd, int type)
+{
+     switch (type) {
+	 case 'I': return 3;
+	 case 'R': return 1 + 2 * rd->dim + rd->fdim;
+	 case 'C': return 3 + 2 * rd->dim + 2 * rd->fdim;
+	 case 'B': return 3;
+	 case 'E': return 2;
+     }
+     return 0;
+}
+
+/* read the fields of a record of the given type into rd->x[0..nx-1],
+   returning the type, or EOF if the record is incomplete or invalid */
+static int read_fields(reader *rd, int type)
+{
+     int c;
+     size_t len;
+     if (type == EOF || (rd->dim == 0 && type != 'I')) return EOF;
+     len = record_len(rd, type);
+     if (!len) return EOF;
+     if (len > rd->nx_alloc) {
+	  double *x = (double *) realloc(rd->x, sizeof(double) * len);
+	  if (!x) return EOF;
+	  rd->x = x;
+	  rd->nx_alloc = len;
+     }
+     for (rd->nx = 0; rd->nx < len; ++rd->nx)
+	  if (rd->binary) {
+	       if (fread(rd->x + rd->nx, sizeof(double), 1, rd->f) < 1)
+		    return EOF;
+	  }
+	  else if (getc(rd->f) != ','
+		   || fscanf(rd->f, "%lf", rd->x + rd->nx) < 1)
+	       return EOF;
+     if (!rd->binary && (c = getc(rd->f)) != '\n' && c != EOF) return EOF;
+     return type;
+}
+
+/* read the next record, returning its type, or EOF */
+static int read_record(reader *rd)
+{
+     return read_fields(rd, getc(rd->f));
+}
+
+/* the subdomain containing the point c[dim] (ih is the last result, which
+   is tried first) */
+static size_t find_subdomain(const subdomain *sd, size_t nsd, unsigned dim,
+			     unsigned nbins, const double *lo,
+			     const double *hi, const double *c, size_t ih)
+{
+     unsigned i;
+     if (nbins) { /* cell of the grid */
+	  size_t k = 0;
+	  for (i = 0; i < dim; ++i) {
+	       double t = (c[i] - lo[i]) / (hi[i] - lo[i]) * nbins;
+	       unsigned b = t > 0 ? (unsigned) t : 0;
+	       k = k * nbins + (b < nbins ? b : nbins - 1);
+	  }
+	  return k;
+     }
+     for (i = 0; i < dim; ++i)
+	  if (c[i] < sd[ih].box[i] - sd[ih].box[dim + i]
+	      || c[i] > sd[ih].box[i] + sd[ih].box[dim + i])
+	       break;
+     if (i == dim) return ih;
+     for (ih = 0; ih < nsd; ++ih) {
+	  for (i = 0; i < dim; ++i)
+	       if (c[i] < sd[ih].box[i] - sd[ih].box[dim + i]
+		   || c[i] > sd[ih].box[i] + sd[ih].box[dim + i])
+		    break;
+	  if (i == dim) return ih;
+     }
+     return 0; /* not in any initial region: shouldn't happen */
+}
+
+static const subdomain *sort_base;
+static int cmp_evals(const void *a, const void *b)
+{
+     double ea = sort_base[*(const size_t *) a].evals;
+     double eb = sort_base[*(const size_t *) b].evals;
+     return ea > eb ? -1 : (ea < eb ? 1 : 0);
+}
+
+/* print the box of the subdomain k */
+static void print_box(const subdomain *sd, size_t k, unsigned dim,
+		      unsigned nbins, const double *lo, const double *hi)
+{
+     unsigned i;
+     size_t cell = k;
+     double *b = (double *) malloc(sizeof(double) * 2 * dim);
+     if (!b) return;
+     for (i = dim; i-- > 0; ) {
+	  if (nbins) {
+	       double w = (hi[i] - lo[i]) / nbins;
+	       b[i] = lo[i] + w * (cell % nbins);
+	       b[dim + i] = b[i] + w;
+	       cell /= nbins;
+	  }
+	  else {
+	       b[i] = sd[k].box[i] - sd[k].box[dim + i];
+	       b[dim + i] = sd[k].box[i] + sd[k].box[dim + i];
+	  }
+     }
+     printf("  ");
+     for (i = 0; i < dim; ++i)
+	  printf("%s[%g,%g]", i ? "x" : "", b[i], b[dim + i]);
+     free(b);
+}
+
+static double sum(const double *x, unsigned n)
+{
+     double s = 0;
+     unsigned i;
+     for (i = 0; i < n; ++i) s += x[i];
+     return s;
+}
+
+/* read the rest of an integration (after its I record) and print its
+   summary; returns the type of the last record read: 'E' at the end of
+   the integration, 'I' if the next one starts without an E record, or
+   EOF at the end of an incomplete trace */
+static int summarize(reader *rd, unsigned nbins, size_t ntop, unsigned num)
+{
+     unsigned dim = rd->dim, fdim = rd->fdim, i;
+     size_t nsd = 0, nregions = 0, k, ih = 0;
+     size_t nbatch = 0, maxbatch = 0, nbatch_regions = 0;
+     double ncuts = 0, numEval = -1, status = -1;
+     double *splits = (double *) calloc(dim, sizeof(double));
+     double *boxes = NULL, *lo = NULL, *hi = NULL;
+     unsigned maxlevel = 0;
+     subdomain *sd = NULL;
+     size_t *order = NULL;
+     int type;
+
+     if (!splits) return EOF;
+     while ((type = read_record(rd)) != EOF && type != 'E' && type != 'I') {
+	  const double *x = rd->x;
+	  if (type == 'R') { /* collect the initial regions */
+	       double *b = (double *) realloc(boxes, sizeof(double)
+					      * (2 * dim + 1) * (nregions + 1));
+	       if (!b) break;
+	       boxes = b;
+	       b += (2 * dim + 1) * nregions++;
+	       memcpy(b, x + 1, sizeof(double) * 2 * dim);
+	       b[2 * dim] = sum(x + 1 + 2 * dim, fdim);
+	       continue;
+	  }
+	  if (!sd && nregions > 0) { /* first record after the R records */
+	       lo = (double *) malloc(sizeof(double) * 2 * dim);
+	       if (!lo) break;
+	       hi = lo + dim;
+	       for (i = 0, nsd = 1; i < dim; ++i) {
+		    lo[i] = HUGE_VAL; hi[i] = -HUGE_VAL;
+		    if (nbins && nsd <= 16777216) nsd *= nbins;
+	       }
+	       if (!nbins) nsd = nregions;
+	       else if (nsd > 16777216) { /* too many cells */
+		    fprintf(stderr, "too many grid cells\n");
+		    break;
+	       }
+	       for (k = 0; k < nregions; ++k)
+		    for (i = 0; i < dim; ++i) {
+			 const double *b = boxes + (2 * dim + 1) * k;
+			 if (b[i] - b[dim+i] < lo[i]) lo[i] = b[i] - b[dim+i];
+			 if (b[i] + b[dim+i] > hi[i]) hi[i] = b[i] + b[dim+i];
+		    }
+	       sd = (subdomain *) calloc(nsd, sizeof(subdomain));
+	       if (!sd) break;
+	       for (k = 0; k < nregions; ++k) {
+		    double *b = boxes + (2 * dim + 1) * k;
+		    if (!nbins) sd[k].box = b;
+		    ih = find_subdomain(sd, nsd, dim, nbins, lo, hi, b, k);
+		    sd[ih].evals += rd->npts;
+		    sd[ih].err0 += b[2 * dim];
+		    sd[ih].err += b[2 * dim];
+	       }
+	  }
+	  if (type == 'C') {
+	       unsigned level = (unsigned) x[1], d = (unsigned) x[2];
+	       const double *c = x + 3;
+	       ncuts += 1;
+	       if (d < dim) splits[d] += 1;
+	       if (level + 1 > maxlevel) maxlevel = level + 1;
+	       if (sd) {
+		    ih = find_subdomain(sd, nsd, dim, nbins, lo, hi, c, ih);
+		    sd[ih].evals += 2 * rd->npts;
+		    sd[ih].cuts += 1;
+		    sd[ih].err += sum(c + 2 * dim + fdim, fdim)
+			 - sum(c + 2 * dim, fdim);
+	       }
+	  }
+	  else if (type == 'B') {
+	       size_t n = (size_t) x[1];
+	       nbatch += 1;
+	       if (x[0] > 0) { /* not the initial batch */
+		    nbatch_regions += n;
+		    if (n > maxbatch) maxbatch = n;
+	       }
+	  }
+     }
+     if (type == 'E') {
+	  numEval = rd->x[0];
+	  status = rd->x[1];
+     }
+
+     printf("integration %u: dim %u, fdim %u, %u points per region\n",
+	    num, dim, fdim, rd->npts);
+     if (numEval >= 0)
+	  printf("  %.0f evaluations, status %.0f\n", numEval, status);
+     else
+	  printf("  (incomplete trace)\n");
+     printf("  %lu initial regions, %.0f bisections",
+	    (unsigned long) nregions, ncuts);
+     if (nbatch > 1)
+	  printf(" in %lu batches (%.1f regions per batch, at most %lu)",
+		 (unsigned long) (nbatch - 1),
+		 (double) nbatch_regions / (nbatch - 1),
+		 (unsigned long) maxbatch);
+     printf(", maximum depth %u\n", maxlevel);
+     if (ncuts > 0) {
+	  printf("  bisections per dimension:");
+	  for (i = 0; i < dim; ++i)
+	       printf(" x%u %.0f (%.1f%%)", i, splits[i],
+		      100 * splits[i] / ncuts);
+	  printf("\n");
+     }
+     if (sd && (order = (size_t *) malloc(sizeof(size_t) * nsd))) {
+	  double total = 0;
+	  for (k = 0; k < nsd; ++k) {
+	       order[k] = k;
+	       total += sd[k].evals;
+	  }
+	  sort_base = sd;
+	  qsort(order, nsd, sizeof(size_t), cmp_evals);
+	  printf("  %-12s %12s %7s %12s", "subdomain",
+		 "evaluations", "%", "bisections");
+	  if (!nbins) printf(" %12s %12s", "err initial", "err final");
+	  printf("\n");
+	  for (k = 0; k < nsd && (k < ntop || !ntop); ++k) {
+	       const subdomain *s = sd + order[k];
+	       if (s->evals == 0) break;
+	       printf("  %-12lu %12.0f %7.2f %12.0f",
+		      (unsigned long) order[k], s->evals,
+		      100 * s->evals / total, s->cuts);
+	       if (!nbins) printf(" %12.4g %12.4g", s->err0, s->err);
+	       printf("\n");
+	  }
+	  for (k = 0; k < nsd && (k < ntop || !ntop); ++k) {
+	       if (sd[order[k]].evals == 0) break;
+	       printf("  %-12lu", (unsigned long) order[k]);
+	       print_box(sd, order[k], dim, nbins, lo, hi);
+	       printf("\n");
+	  }
+	  if (ntop && nsd > ntop)
+	       printf("  (%lu more subdomains)\n", (unsigned long) (nsd - ntop));
+     }
+     free(order);
+     free(sd);
+     free(lo);
+     free(boxes);
+     free(splits);
+
+     return type;
+}
+
+int main(int argc, char **argv)
+{
+     reader rd;
+     unsigned nbins = 0, num = 0;
+     size_t ntop = 20;
+     int i, c, type;
+
+     for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+	  if (!strcmp(argv[i], "-n")) nbins = (unsigned) atoi(argv[i+1]);
+	  else if (!strcmp(argv[i], "-t")) ntop = (size_t) atoi(argv[i+1]);
+	  else break;
+     }
+     if (i + 1 < argc || (i < argc && argv[i][0] == '-')) {
+	  fprintf(stderr, "Usage: %s [-n nbins] [-t ntop] [tracefile]\n",
+		  argv[0]);
+	  return EXIT_FAILURE;
+     }
+     memset(&rd, 0, sizeof(reader));
+     rd.f = i < argc ? fopen(argv[i], "rb") : stdin;
+     if (!rd.f) {
+	  fprintf(stderr, "cannot open %s\n", argv[i]);
+	  return EXIT_FAILURE;
+     }
+     /* CSV has a comma after the type of a record, and binary has the
+	first byte of a double (the dim field of the I record), which is
+	never a comma */
+     type = getc(rd.f);
+     c = getc(rd.f);
+     if (c != EOF) ungetc(c, rd.f);
+     rd.binary = c != ',';
+     type = read_fields(&rd, type);
+     while (type == 'I') {
+	  rd.dim = (unsigned) rd.x[0];
+	  rd.fdim = (unsigned) rd.x[1];
+	  rd.npts = (unsigned) rd.x[2];
+	  if (rd.dim == 0) break; /* invalid */
+	  type = summarize(&rd, nbins, ntop, ++num);
+	  if (type == 'E') type = read_record(&rd);
+     }
+     if (type != EOF || !feof(rd.f)) {
+	  fprintf(stderr, "invalid trace\n");
+	  return EXIT_FAILURE;
+     }
+     if (rd.f != stdin) fclose(rd.f);
+     free(rd.x);
+     return EXIT_SUCCESS;
+}
@@ -0,0 +1,16 @@
+# Check that cubature_tracesum (TRACESUM) gives the same summary of the
+# CSV and binary traces written by "htest ... -trace" (the htest_trace
+# test), run with cmake -DTRACESUM=... -P tracesum_check.cmake
+
+foreach( fmt csv bin )
+  execute_process( COMMAND ${TRACESUM} -n 2 -t 0 htest_trace.${fmt}
+    RESULT_VARIABLE ret OUTPUT_VARIABLE sum_${fmt} )
+  if( NOT ret EQUAL 0 OR sum_${fmt} STREQUAL "" )
+    message( FATAL_ERROR "cubature_tracesum htest_trace.${fmt} failed" )
+  endif()
+endforeach()
+if( NOT sum_csv STREQUAL sum_bin )
+  message( FATAL_ERROR "the CSV and binary traces have different summaries:\n"
+    "${sum_csv}\n${sum_bin}" )
+endif()
+message( "${sum_csv}" )
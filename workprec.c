@@ -0,0 +1,253 @@
+/* Work-precision data for hcubature/pcubature on the test integrands.
+ *
+ * Copyright (c) 2005-2013 Steven G. Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Usage: ./cubature_workprec [options]
+
+     -d 1,2,3       dimensions
+     -i 0,1,...,8   integrands (see testfuncs.h; 8 is only run for dim 3)
+     -e h,p,pgp     engines: hcubature_v, pcubature_v (Clenshaw-Curtis),
+                    pcubature_ex with Gauss-Patterson rules
+     -t 1,10        relative tolerances 10^-1 to 10^-10 (decades)
+     -m 1000000     maximum # function evaluations per run (0 for none)
+     -r 1           repetitions of each run (the minimum time is used)
+     -o prefix      write the curve for integrand i in dimension d to the
+                    file prefix_i<i>_d<d>.dat (default: all to stdout)
+
+   For each integrand and dimension, the data consists of one block per
+   engine (separated by two blank lines, i.e. one gnuplot "index" per
+   engine) with the columns
+
+     tol  true_err  est_err  evals  time  status  maxeval_hit
+
+   followed by a summary (as comment lines) of the smallest number of
+   evaluations with which each engine achieved a true error of at most
+   10^-k for each k, which shows where the efficiency of the engines
+   crosses over.  For example, in gnuplot:
+
+     set logscale xy; plot for [e=0:2] 'wp_i4_d3.dat' index e u 4:2 w lp */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "cubature.h"
+#include "testfuncs.h"
+#include "benchutil.h"
+
+#define NUM_ENGINES 3
+static const char *engine_names[NUM_ENGINES] = { "h", "p", "pgp" };
+
+typedef struct {
+     int which; /* test integrand */
+     size_t npts; /* total # points evaluated */
+} wp_data;
+
+static int f_vector(unsigned dim, size_t npt, const double *x, void *d_,
+		    unsigned fdim, double *fval)
+{
+     wp_data *d = (wp_data *) d_;
+     size_t j;
+     (void) fdim; /* fdim == 1 */
+     for (j = 0; j < npt; ++j)
+	  fval[j] = test_integrand(d->which, dim, x + j*dim);
+     d->npts += npt;
+     return 0;
+}
+
+static int run(int engine, wp_data *d, unsigned dim,
+	       const double *xmin, const double *xmax, size_t maxEval,
+	       double tol, double *val, double *err)
+{
+     cubature_options opt;
+     switch (engine) {
+	 case 0: return hcubature_v(1, f_vector, d, dim, xmin, xmax,
+				    maxEval, 0, tol, ERROR_INDIVIDUAL, val, err);
+	 case 1: return pcubature_v(1, f_vector, d, dim, xmin, xmax,
+				    maxEval, 0, tol, ERROR_INDIVIDUAL, val, err);
+	 default:
+	      memset(&opt, 0, sizeof(opt));
+	      opt.rule = PCUBATURE_GAUSS_PATTERSON;
+	      return pcubature_ex(1, f_vector, d, dim, xmin, xmax,
+				  maxEval, 0, tol, ERROR_INDIVIDUAL, &opt,
+				  val, err);
+     }
+}
+
+/* parse a comma-separated list of integers into a (static) array */
+static unsigned parse_list(const char *s, int *a, unsigned nmax)
+{
+     unsigned n = 0;
+     char *end;
+     while (*s && n < nmax) {
+	  a[n++] = (int) strtol(s, &end, 10);
+	  if (end == s || (*end && *end != ',')) {
+	       fprintf(stderr, "invalid list \"%s\"\n", s);
+	       exit(EXIT_FAILURE);
+	  }
+	  s = end + (*end == ',');
+     }
+     return n;
+}
+
+#define MAXLIST 64
+#define MAXDEC 16 /* max # decades of tolerance */
+
+int main(int argc, char **argv)
+{
+     int dims[MAXLIST], whichs[MAXLIST], engines[NUM_ENGINES], decs[2];
+     unsigned ndims = 3, nwhichs = TEST_NUM_INTEGRANDS, nengines = NUM_ENGINES;
+     unsigned reps = 1, id, iw, ie, i;
+     size_t maxEval = 1000000;
+     const char *prefix = NULL;
+     int kmin = 1, kmax = 10;
+
+     for (i = 0; i < 3; ++i) dims[i] = i + 1;
+     for (i = 0; i < TEST_NUM_INTEGRANDS; ++i) whichs[i] = i;
+     for (i = 0; i < NUM_ENGINES; ++i) engines[i] = i;
+
+     for (i = 1; i < (unsigned) argc; i += 2) {
+	  const char *arg = argv[i];
+	  if (arg[0] != '-' || !arg[1] || arg[2] || i + 1 >= (unsigned) argc)
+	       break;
+	  switch (arg[1]) {
+	      case 'd': ndims = parse_list(argv[i+1], dims, MAXLIST); break;
+	      case 'i': nwhichs = parse_list(argv[i+1], whichs, MAXLIST); break;
+	      case 'e': {
+		   char *tok;
+		   nengines = 0;
+		   for (tok = strtok(argv[i+1], ","); tok; tok = strtok(NULL, ",")) {
+			int e;
+			for (e = 0; e < NUM_ENGINES
+				  && strcmp(tok, engine_names[e]); ++e) ;
+			if (e == NUM_ENGINES || nengines == NUM_ENGINES) {
+			     fprintf(stderr, "invalid engine \"%s\"\n", tok);
+			     return EXIT_FAILURE;
+			}
+			engines[nengines++] = e;
+		   }
+		   break;
+	      }
+	      case 't':
+		   if (parse_list(argv[i+1], decs, 2) != 2
+		       || decs[0] < 0 || decs[1] < decs[0]
+		       || decs[1] - decs[0] >= MAXDEC) {
+			fprintf(stderr, "invalid decades \"%s\"\n", argv[i+1]);
+			return EXIT_FAILURE;
+		   }
+		   kmin = decs[0]; kmax = decs[1];
+		   break;
+	      case 'm': maxEval = (size_t) atof(argv[i+1]); break;
+	      case 'r': reps = (unsigned) atoi(argv[i+1]); break;
+	      case 'o': prefix = argv[i+1]; break;
+	      default: i = argc; break;
+	  }
+     }
+     if (i < (unsigned) argc) {
+	  fprintf(stderr, "Usage: %s [-d dims] [-i integrands] [-e engines] "
+		  "[-t kmin,kmax] [-m maxeval] [-r reps] [-o prefix]\n",
+		  argv[0]);
+	  return EXIT_FAILURE;
+     }
+     if (reps < 1) reps = 1;
+
+     for (iw = 0; iw < nwhichs; ++iw)
+     for (id = 0; id < ndims; ++id) {
+	  int which = whichs[iw];
+	  unsigned dim = (unsigned) dims[id];
+	  /* best[e][k]: fewest evals for true err <= 10^-(kmin+k) (0 if none) */
+	  size_t best[NUM_ENGINES][MAXDEC];
+	  double *xmin, *xmax;
+	  FILE *out = stdout;
+	  int k;
+
+	  if (which < 0 || which >= TEST_NUM_INTEGRANDS || dims[id] < 1) {
+	       fprintf(stderr, "invalid integrand or dim\n");
+	       return EXIT_FAILURE;
+	  }
+	  if (which == 8 && dim != 3) continue; /* only defined for dim 3 */
+
+	  if (prefix) {
+	       char *fname = (char *) malloc(strlen(prefix) + 64);
+	       sprintf(fname, "%s_i%d_d%u.dat", prefix, which, dim);
+	       out = fopen(fname, "w");
+	       if (!out) { perror(fname); return EXIT_FAILURE; }
+	       free(fname);
+	  }
+	  else if (iw || id)
+	       fprintf(out, "\n\n");
+
+	  xmin = (double *) malloc(sizeof(double) * dim * 2);
+	  xmax = xmin + dim;
+	  for (i = 0; i < dim; ++i) { xmin[i] = 0; xmax[i] = 1; }
+
+	  fprintf(out, "# integrand %d, dim %u, exact integral %.15g\n",
+		  which, dim, exact_integral(which, dim, xmax));
+	  memset(best, 0, sizeof(best));
+	  for (ie = 0; ie < nengines; ++ie) {
+	       int engine = engines[ie];
+	       if (ie) fprintf(out, "\n\n");
+	       fprintf(out, "# engine %s\n"
+		       "# tol true_err est_err evals time status maxeval_hit\n",
+		       engine_names[engine]);
+	       for (k = kmin; k <= kmax; ++k) {
+		    double tol = pow(10.0, -k), val, err, true_err;
+		    double tmin = HUGE_VAL;
+		    int status = 0, j;
+		    unsigned rep;
+		    wp_data d;
+		    for (rep = 0; rep < reps; ++rep) {
+			 double t0 = bench_time(), t;
+			 d.which = which; d.npts = 0;
+			 status = run(engine, &d, dim, xmin, xmax, maxEval,
+				      tol, &val, &err);
+			 t = bench_time() - t0;
+			 if (t < tmin) tmin = t;
+		    }
+		    true_err = fabs(val - exact_integral(which, dim, xmax));
+		    fprintf(out, "%g %g %g %lu %g %d %d\n",
+			    tol, true_err, err, (unsigned long) d.npts, tmin,
+			    status, maxEval && d.npts >= maxEval);
+		    for (j = 0; j <= kmax - kmin; ++j)
+			 if (!status && true_err <= pow(10.0, -(kmin + j))
+			     && (!best[engine][j] || d.npts < best[engine][j]))
+			      best[engine][j] = d.npts;
+	       }
+	  }
+
+	  fprintf(out, "#\n# fewest evals for true err <= 10^-k:\n# k");
+	  for (ie = 0; ie < nengines; ++ie)
+	       fprintf(out, " %10s", engine_names[engines[ie]]);
+	  fprintf(out, "\n");
+	  for (k = kmin; k <= kmax; ++k) {
+	       fprintf(out, "# %d", k);
+	       for (ie = 0; ie < nengines; ++ie) {
+		    size_t b = best[engines[ie]][k - kmin];
+		    if (b) fprintf(out, " %10lu", (unsigned long) b);
+		    else fprintf(out, " %10s", "-");
+	       }
+	       fprintf(out, "\n");
+	  }
+
+	  free(xmin);
+	  if (out != stdout) fclose(out);
+     }
+     return EXIT_SUCCESS;
+}